@@ -3,6 +3,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
+#include <sys/uio.h>
 
 #ifdef _POSIX_C_SOURCE
 #include <sys/time.h>
@@ -53,6 +54,20 @@ static const char *encoded_query = "search=hello%20world&filter=tag%3Dred&sort=d
 static const char *many_params = "p1=v1&p2=v2&p3=v3&p4=v4&p5=v5&p6=v6&p7=v7&p8=v8&p9=v9&p10=v10&p11=v11&p12=v12&p13=v13&p14=v14&p15=v15";
 static const char *duplicate_keys = "tag=red&tag=blue&tag=green&tag=yellow&tag=orange";
 
+/* 长查询：模拟广告追踪场景（约 2KB，48 个参数） */
+static char long_query[4096];
+
+static void build_long_query(void) {
+    size_t pos = 0;
+    for (int i = 0; i < 48; i++) {
+        pos += (size_t)sprintf(long_query + pos, "%sparam_%d=", i ? "&" : "", i);
+        for (int j = 0; j < 24 + (i * 5) % 17; j++) {
+            long_query[pos++] = (char)('a' + (i + j) % 26);
+        }
+    }
+    long_query[pos] = '\0';
+}
+
 /* 基准测试函数 */
 
 void benchmark_simple_parse(int iterations) {
@@ -91,6 +106,122 @@ void benchmark_many_params(int iterations) {
     });
 }
 
+void benchmark_long_query(int iterations) {
+    BENCHMARK("Long query parse (48 params, ~2KB)", iterations, {
+        struct llquery query;
+        llquery_init(&query, 0, LQF_DEFAULT);
+        llquery_parse(long_query, 0, &query);
+        llquery_free(&query);
+    });
+}
+
+void benchmark_zero_copy_parse(int iterations) {
+    BENCHMARK("Zero-copy parse with decode (6 params)", iterations, {
+        struct llquery query;
+        llquery_init(&query, 0, LQF_AUTO_DECODE | LQF_ZERO_COPY);
+        llquery_parse(complex_query, 0, &query);
+        llquery_free(&query);
+    });
+}
+
+void benchmark_reuse_parser(int iterations) {
+    // 同一个 llquery 反复解析，reset 保留内存池容量
+    struct llquery query;
+    llquery_init(&query, 0, LQF_DEFAULT);
+
+    BENCHMARK("Reuse one parser (6 params, decode)", iterations, {
+        llquery_parse(complex_query, 0, &query);
+    });
+
+    llquery_free(&query);
+}
+
+void benchmark_lazy_parse(int iterations) {
+    // 长查询只读取其中两个参数：立即模式与延迟模式对比
+    struct llquery query;
+    llquery_init(&query, 0, LQF_AUTO_DECODE);
+
+    BENCHMARK("Eager parse, read 2 of 48 params", iterations, {
+        llquery_parse(long_query, 0, &query);
+        llquery_get_value(&query, "param_7", 7);
+        llquery_get_value(&query, "param_40", 8);
+    });
+
+    query.flags |= LQF_LAZY;
+    BENCHMARK("Lazy parse, read 2 of 48 params", iterations, {
+        llquery_parse(long_query, 0, &query);
+        llquery_get_value(&query, "param_7", 7);
+        llquery_get_value(&query, "param_40", 8);
+    });
+
+    llquery_free(&query);
+}
+
+void benchmark_stream_parse(int iterations) {
+    // 长查询按 256 字节分块输入
+    struct llquery query;
+    llquery_init(&query, 0, LQF_AUTO_DECODE);
+    size_t len = strlen(long_query);
+
+    BENCHMARK("Stream parse (48 params, 256B chunks)", iterations, {
+        struct llquery_stream stream;
+        llquery_stream_init(&stream, &query, 0, NULL, NULL);
+        for (size_t off = 0; off < len; off += 256) {
+            llquery_stream_feed(&stream, long_query + off, len - off < 256 ? len - off : 256);
+        }
+        llquery_stream_finish(&stream);
+        llquery_stream_free(&stream);
+    });
+
+    llquery_free(&query);
+}
+
+void benchmark_iov_parse(int iterations) {
+    // 长查询分成三段，零拷贝解析
+    struct llquery query;
+    llquery_init(&query, 0, LQF_AUTO_DECODE | LQF_ZERO_COPY);
+    size_t len = strlen(long_query);
+    struct iovec iov[3] = {
+        { long_query, len / 3 },
+        { long_query + len / 3, len / 3 },
+        { long_query + 2 * (len / 3), len - 2 * (len / 3) }
+    };
+
+    BENCHMARK("Scatter/gather parse (48 params, 3 iov)", iterations, {
+        llquery_parse_iov(iov, 3, &query);
+    });
+
+    llquery_free(&query);
+}
+
+void benchmark_validate_utf8(int iterations) {
+    // 48 个 ASCII 参数：校验开销；20 个各含 30 个中文字符的值：多字节序列校验
+    static char cjk_query[16384];
+    size_t pos = 0;
+    for (int i = 0; i < 20; i++) {
+        pos += (size_t)snprintf(cjk_query + pos, sizeof(cjk_query) - pos, "%st%d=", i ? "&" : "", i);
+        for (int j = 0; j < 30; j++) {
+            pos += (size_t)snprintf(cjk_query + pos, sizeof(cjk_query) - pos, "%%E4%%B8%%%02X",
+                                    0x80 + (i + j) % 64);
+        }
+    }
+
+    struct llquery query;
+    for (int validate = 0; validate < 2; validate++) {
+        uint16_t flags = LQF_DEFAULT | (validate ? LQF_VALIDATE_UTF8 : 0);
+        llquery_init(&query, 0, flags);
+        BENCHMARK(validate ? "Parse 48 ASCII params + UTF-8 check" : "Parse 48 ASCII params",
+                  iterations / 10, {
+            llquery_parse(long_query, 0, &query);
+        });
+        BENCHMARK(validate ? "Parse 20 CJK values + UTF-8 check" : "Parse 20 CJK values",
+                  iterations / 10, {
+            llquery_parse(cjk_query, pos, &query);
+        });
+        llquery_free(&query);
+    }
+}
+
 void benchmark_duplicate_keys(int iterations) {
     BENCHMARK("Duplicate keys (5 params)", iterations, {
         struct llquery query;
@@ -130,6 +261,155 @@ void benchmark_has_key(int iterations) {
     llquery_free(&query);
 }
 
+void benchmark_lookup_many(int iterations) {
+    // 300 个参数的查询，每次请求解析后查找 16 个键
+    static char query_300[8192];
+    size_t pos = 0;
+    for (int i = 0; i < 300; i++) {
+        pos += (size_t)sprintf(query_300 + pos, "%sfield_%d=v%d", i ? "&" : "", i, i);
+    }
+    char keys[16][16];
+    for (int k = 0; k < 16; k++) {
+        sprintf(keys[k], "field_%d", (k * 37 + 11) % 320);
+    }
+
+    struct llquery query;
+    llquery_init(&query, 512, LQF_DEFAULT);
+
+    BENCHMARK("Parse 300 params + 16 lookups", iterations / 10, {
+        llquery_parse(query_300, pos, &query);
+        for (int k = 0; k < 16; k++) {
+            llquery_get_value(&query, keys[k], 0);
+        }
+    });
+
+    llquery_free(&query);
+}
+
+void benchmark_schema_lookup(int iterations) {
+    // 每次请求解析后读取 4 个已知参数：按键名查找与按模式槽位读取
+    const char *fields[] = {"name", "age", "email", "lang"};
+    struct llquery_schema *schema = NULL;
+    llquery_schema_create(&schema, fields, 4, LQS_NONE);
+
+    struct llquery query;
+    llquery_init(&query, 0, LQF_DEFAULT);
+
+    BENCHMARK("Parse + 4 lookups by key", iterations, {
+        llquery_parse(complex_query, 0, &query);
+        for (int k = 0; k < 4; k++) {
+            llquery_get_value(&query, fields[k], 0);
+        }
+    });
+
+    llquery_set_schema(&query, schema);
+    BENCHMARK("Parse + 4 lookups by schema slot", iterations, {
+        llquery_parse(complex_query, 0, &query);
+        for (uint32_t k = 0; k < 4; k++) {
+            llquery_get_slot_value(&query, k);
+        }
+    });
+
+    llquery_free(&query);
+    llquery_schema_free(schema);
+}
+
+void benchmark_get_values_multi(int iterations) {
+    // 48 个参数的查询，每次请求解析后读取 8 个参数：逐个查找与一次查找
+    const char *keys[] = {"param_3", "param_11", "param_17", "param_24",
+                          "param_30", "param_38", "param_45", "param_99"};
+    const char *values[8];
+
+    struct llquery query;
+    llquery_init(&query, 0, LQF_DEFAULT);
+
+    BENCHMARK("Parse 48 params + 8 get_value", iterations / 10, {
+        llquery_parse(long_query, 0, &query);
+        for (int k = 0; k < 8; k++) {
+            values[k] = llquery_get_value(&query, keys[k], 0);
+        }
+    });
+
+    BENCHMARK("Parse 48 params + get_values_multi(8)", iterations / 10, {
+        llquery_parse(long_query, 0, &query);
+        llquery_get_values_multi(&query, keys, NULL, 8, values);
+    });
+
+    llquery_free(&query);
+}
+
+void benchmark_find(int iterations) {
+    // 每个请求只需要一个参数：完整解析与直接提取
+    BENCHMARK("Init + parse + get_value + free", iterations / 10, {
+        struct llquery query;
+        llquery_init(&query, 0, LQF_DEFAULT);
+        llquery_parse(long_query, 0, &query);
+        llquery_get_value(&query, "param_40", 8);
+        llquery_free(&query);
+    });
+
+    BENCHMARK("llquery_find (no parse)", iterations / 10, {
+        const char *value;
+        size_t value_len;
+        llquery_find(long_query, 0, "param_40", 8, &value, &value_len, LQF_DEFAULT);
+    });
+}
+
+void benchmark_case_insensitive(int iterations) {
+    // 48 个参数中忽略大小写取 3 个键：解析时全部转小写，与零拷贝解析后按需折叠
+    BENCHMARK("Parse (lowercase keys) + 3 lookups", iterations / 10, {
+        struct llquery query;
+        llquery_init(&query, 0, LQF_DEFAULT | LQF_LOWERCASE_KEYS);
+        llquery_parse(long_query, 0, &query);
+        llquery_get_value(&query, "param_4", 7);
+        llquery_get_value(&query, "param_20", 8);
+        llquery_get_value(&query, "param_40", 8);
+        llquery_free(&query);
+    });
+
+    BENCHMARK("Parse (zero-copy) + 3 _ci lookups", iterations / 10, {
+        struct llquery query;
+        llquery_init(&query, 0, LQF_DEFAULT | LQF_ZERO_COPY);
+        llquery_parse(long_query, 0, &query);
+        llquery_get_value_ci(&query, "PARAM_4", 7);
+        llquery_get_value_ci(&query, "Param_20", 8);
+        llquery_get_value_ci(&query, "PARAM_40", 8);
+        llquery_free(&query);
+    });
+}
+
+void benchmark_intern(int iterations) {
+    // 48 个参数的查询：对比绑定驻留表前后的解析开销，以及按键名与按键 ID 取值
+    struct llquery_intern *table = NULL;
+    llquery_intern_create(&table, 0);
+
+    struct llquery query;
+    llquery_init(&query, 0, LQF_DEFAULT);
+
+    BENCHMARK("Parse 48 params", iterations / 10, {
+        llquery_parse(long_query, 0, &query);
+    });
+
+    llquery_set_intern(&query, table, true);
+    llquery_parse(long_query, 0, &query);
+    llquery_set_intern(&query, table, false);
+    BENCHMARK("Parse 48 params (interned keys)", iterations / 10, {
+        llquery_parse(long_query, 0, &query);
+    });
+
+    BENCHMARK("Get value by key string", iterations, {
+        llquery_get_value(&query, "param_40", 8);
+    });
+
+    uint32_t id = llquery_intern_find(table, "param_40", 8);
+    BENCHMARK("Get value by key ID", iterations, {
+        llquery_get_value_by_id(&query, id);
+    });
+
+    llquery_free(&query);
+    llquery_intern_free(table);
+}
+
 void benchmark_iterate(int iterations) {
     struct llquery query;
     llquery_init(&query, 0, LQF_DEFAULT);
@@ -154,6 +434,32 @@ void benchmark_sort(int iterations) {
     });
 }
 
+void benchmark_sort_many(int iterations) {
+    // 300 个逆序参数，解析后按键排序
+    static char query_300[8192];
+    size_t pos = 0;
+    for (int i = 299; i >= 0; i--) {
+        pos += (size_t)sprintf(query_300 + pos, "%sfield_%03d=v%d", i < 299 ? "&" : "", i, i);
+    }
+
+    struct llquery query;
+    llquery_init(&query, 512, LQF_DEFAULT);
+
+    BENCHMARK("Sort keys (300 params)", iterations / 10, {
+        llquery_parse(query_300, pos, &query);
+        llquery_sort(&query, NULL);
+    });
+
+    llquery_free(&query);
+}
+
+static int count_sink(const char *data, size_t len, void *user_data) {
+    (void)data;
+    (void)len;
+    (void)user_data;
+    return 0;
+}
+
 void benchmark_stringify(int iterations) {
     struct llquery query;
     llquery_init(&query, 0, LQF_DEFAULT);
@@ -163,6 +469,65 @@ void benchmark_stringify(int iterations) {
     BENCHMARK("Stringify (15 params)", iterations, {
         llquery_stringify(&query, buffer, sizeof(buffer), false);
     });
+
+    BENCHMARK("Stringify encoded (15 params)", iterations, {
+        llquery_stringify(&query, buffer, sizeof(buffer), true);
+    });
+
+    // 逐个编码键值再拼接（stringify 支持编码前调用方的做法）
+    BENCHMARK("Stringify encoded per value (15 params)", iterations, {
+        size_t len = 0;
+        for (uint16_t i = 0; i < llquery_count(&query); i++) {
+            const struct llquery_kv *kv = llquery_get_kv(&query, i);
+            char tmp[256];
+            if (i > 0) buffer[len++] = '&';
+            size_t n = llquery_url_encode(kv->key, kv->key_len, tmp, sizeof(tmp));
+            memcpy(buffer + len, tmp, n);
+            len += n;
+            buffer[len++] = '=';
+            n = kv->value_len ? llquery_url_encode(kv->value, kv->value_len, tmp, sizeof(tmp)) : 0;
+            memcpy(buffer + len, tmp, n);
+            len += n;
+        }
+        buffer[len] = '\0';
+    });
+
+    size_t sunk = 0;
+    BENCHMARK("Stringify sink encoded (15 params)", iterations, {
+        sunk += llquery_stringify_sink(&query, true, count_sink, NULL);
+    });
+    (void)sunk;
+
+    llquery_free(&query);
+
+    // 原样转发：20 个约 200 字节的值，零拷贝解析
+    static char forward[8192];
+    size_t pos = 0;
+    for (int i = 0; i < 20; i++) {
+        pos += (size_t)snprintf(forward + pos, sizeof(forward) - pos, "%sfield%d=", i ? "&" : "", i);
+        for (int j = 0; j < 200; j++) {
+            forward[pos++] = (char)('a' + (i + j) % 26);
+        }
+    }
+    forward[pos] = '\0';
+    llquery_init(&query, 0, LQF_DEFAULT | LQF_ZERO_COPY);
+    llquery_parse(forward, pos, &query);
+    static char out[8192];
+
+    struct iovec iov[64];
+    for (int enc = 0; enc < 2; enc++) {
+        BENCHMARK(enc ? "Stringify encoded (20 x 200B values)" : "Stringify (20 x 200B values)",
+                  iterations, {
+            llquery_stringify(&query, out, sizeof(out), enc);
+        });
+
+        BENCHMARK(enc ? "Stringify iov encoded (20 x 200B values)" : "Stringify iov (20 x 200B values)",
+                  iterations, {
+            int cnt = 64;
+            size_t scratch_len = sizeof(out);
+            llquery_stringify_iov(&query, enc, iov, &cnt, out, &scratch_len);
+        });
+    }
     
     llquery_free(&query);
 }
@@ -195,6 +560,14 @@ void benchmark_url_encode(int iterations) {
     BENCHMARK("URL encode", iterations, {
         llquery_url_encode(text, 0, buffer, sizeof(buffer));
     });
+
+    // 跳转链接：编码作为参数值的回调 URL，大部分为安全字符
+    const char *redirect = "https://accounts.example.com/oauth2/callback?client_id=8f14e45fceea167a"
+                           "5a36dedd4bea2543&state=c4ca4238a0b923820dcc509a6f75849b&scope=openid";
+    char url_buf[512];
+    BENCHMARK("URL encode (redirect URL, 160B)", iterations, {
+        llquery_url_encode_ex(redirect, 0, url_buf, sizeof(url_buf), LQENC_UNRESERVED);
+    });
 }
 
 void benchmark_url_decode(int iterations) {
@@ -204,6 +577,22 @@ void benchmark_url_decode(int iterations) {
     BENCHMARK("URL decode", iterations, {
         llquery_url_decode(encoded, 0, buffer, sizeof(buffer));
     });
+
+    // 约 4KB 的 base64 表单值：大段未转义字符，偶有 %2B、%2F
+    static char blob[4200];
+    static char blob_out[4200];
+    size_t pos = 0;
+    for (int i = 0; pos < 4096; i++) {
+        if (i % 97 == 96) {
+            pos += (size_t)sprintf(blob + pos, "%s", (i / 97) % 2 ? "%2B" : "%2F");
+        } else {
+            blob[pos++] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789"[i % 62];
+        }
+    }
+    blob[pos] = '\0';
+    BENCHMARK("URL decode (4KB base64)", iterations / 10, {
+        llquery_url_decode(blob, pos, blob_out, sizeof(blob_out));
+    });
 }
 
 void benchmark_count_pairs(int iterations) {
@@ -279,22 +668,37 @@ int main() {
     printf("\n\n");
     
     int iterations = 100000;
+    build_long_query();
     
     printf("=== Parse Benchmarks ===\n");
     benchmark_simple_parse(iterations);
     benchmark_complex_parse(iterations);
     benchmark_encoded_parse(iterations);
     benchmark_many_params(iterations);
+    benchmark_long_query(iterations / 10);
+    benchmark_zero_copy_parse(iterations);
+    benchmark_reuse_parser(iterations);
+    benchmark_lazy_parse(iterations / 10);
+    benchmark_stream_parse(iterations / 10);
+    benchmark_iov_parse(iterations / 10);
+    benchmark_validate_utf8(iterations);
     benchmark_duplicate_keys(iterations);
     benchmark_fast_parse(iterations);
     
     printf("\n=== Query Benchmarks ===\n");
     benchmark_get_value(iterations);
     benchmark_has_key(iterations);
+    benchmark_lookup_many(iterations);
+    benchmark_schema_lookup(iterations);
+    benchmark_get_values_multi(iterations);
+    benchmark_find(iterations);
+    benchmark_intern(iterations);
+    benchmark_case_insensitive(iterations);
     benchmark_iterate(iterations);
     
     printf("\n=== Manipulation Benchmarks ===\n");
     benchmark_sort(iterations / 10);  // 更慢，减少迭代
+    benchmark_sort_many(iterations / 10);
     benchmark_stringify(iterations);
     benchmark_clone(iterations);
     
@@ -1,12 +1,54 @@
 #include "llquery.h"
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <assert.h>
+#include <time.h>
+#include <stdio.h>
+
+/* struct iovec：POSIX 平台使用系统定义，其他平台使用相同布局 */
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/uio.h>
+#else
+struct iovec {
+  void *iov_base;
+  size_t iov_len;
+};
+#endif
+
+/* 哈希种子的熵来源：Linux 用 getrandom()，BSD/Apple 用 arc4random_buf()，
+ * 其他 POSIX 平台读 /dev/urandom */
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<sys/random.h>)
+#include <sys/random.h>
+#define LQ_HAVE_GETRANDOM 1
+#endif
+#endif
+#if defined(__APPLE__) || defined(__FreeBSD__) || defined(__OpenBSD__) || \
+    defined(__NetBSD__) || defined(__DragonFly__)
+#define LQ_HAVE_ARC4RANDOM 1
+#endif
+
+/* SIMD 内核：SSE2 为 x86-64 基线指令集，AVX2 通过运行时检测启用。
+ * 定义 LLQUERY_NO_SIMD 可强制只使用可移植内核。 */
+#if !defined(LLQUERY_NO_SIMD) && (defined(__GNUC__) || defined(__clang__)) && \
+    defined(__SSE2__)
+#define LLQUERY_HAVE_SSE2 1
+#include <emmintrin.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define LLQUERY_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
 
 /* 默认配置 */
 #define DEFAULT_MAX_PAIRS 128
+#define GROWABLE_INITIAL_PAIRS 16
+#define LQ_INDEX_MIN_PAIRS 16    /* 键值对数量达到此值时按键查找才考虑哈希索引 */
+#define LQ_INDEX_SCAN_RATIO 8    /* 线性查找累计扫描超过 8 倍键值对数量后建立索引 */
 #define DEFAULT_DECODE_BUF_SIZE 1024
 #define MAX_STACK_BUF 2048
+#define LQ_NPOS UINT32_MAX     /* 无效下标 */
 
 /* 分支预测提示 */
 #if defined(__GNUC__) || defined(__clang__)
@@ -17,6 +59,77 @@
 #define UNLIKELY(x) (x)
 #endif
 
+/* 强制内联：按常量选项展开的模板函数依赖它做常量折叠 */
+#if defined(__GNUC__) || defined(__clang__)
+#define LQ_ALWAYS_INLINE inline __attribute__((always_inline))
+#else
+#define LQ_ALWAYS_INLINE inline
+#endif
+
+/* SWAR（寄存器内 SIMD）扫描：每次检查 8 字节，用于无 x86 SIMD 的可移植构建。
+ * 编译时定义 LLQUERY_USE_SWAR=0 可回退到逐字节 char_flags 查表。 */
+#ifndef LLQUERY_USE_SWAR
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define LLQUERY_USE_SWAR 1
+#else
+#define LLQUERY_USE_SWAR 0
+#endif
+#endif
+
+/* 位扫描：返回最低置位的下标，x 不能为 0 */
+static inline unsigned lq_ctz64(uint64_t x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return (unsigned)__builtin_ctzll(x);
+#else
+  unsigned n = 0;
+  while (!(x & 1)) {
+    x >>= 1;
+    n++;
+  }
+  return n;
+#endif
+}
+
+static inline unsigned lq_popcount8(unsigned x) {
+#if defined(__GNUC__) || defined(__clang__)
+  return (unsigned)__builtin_popcount(x);
+#else
+  unsigned n = 0;
+  for (; x; x &= x - 1) n++;
+  return n;
+#endif
+}
+
+#if LLQUERY_USE_SWAR
+#define SWAR_ONES  0x0101010101010101ULL
+#define SWAR_HIGHS 0x8080808080808080ULL
+#define SWAR_LOWS  0x7F7F7F7F7F7F7F7FULL
+
+static inline uint64_t swar_load(const char *p) {
+  uint64_t w;
+  memcpy(&w, p, sizeof(w));
+  return w;
+}
+
+/* 等于 c 的字节最高位置 1，其余字节为 0（精确版本，无借位误报） */
+static inline uint64_t swar_eq(uint64_t w, unsigned char c) {
+  uint64_t x = w ^ (SWAR_ONES * c);
+  return ~(((x & SWAR_LOWS) + SWAR_LOWS) | x) & SWAR_HIGHS;
+}
+
+/* 落在 [lo, hi] 区间的字节最高位置 1；要求 w 中所有字节 < 0x80 */
+static inline uint64_t swar_range(uint64_t w, unsigned char lo, unsigned char hi) {
+  uint64_t ge_lo = w + SWAR_ONES * (unsigned char)(0x80 - lo);
+  uint64_t gt_hi = w + SWAR_ONES * (unsigned char)(0x7F - hi);
+  return ge_lo & ~gt_hi & SWAR_HIGHS;
+}
+
+/* 将每字节最高位收集为 8 位掩码，bit i 对应第 i 个字节（小端） */
+static inline unsigned swar_movemask(uint64_t m) {
+  return (unsigned)(((m >> 7) * 0x0102040810204080ULL) >> 56);
+}
+#endif
+
 /* 字符属性位掩码 */
 #define CHAR_SEPARATOR   0x01  /* & 分隔符 */
 #define CHAR_EQUAL       0x02  /* = 等号 */
@@ -38,8 +151,107 @@ typedef struct llquery_internal {
   size_t string_pool_size;   /* 内存池总大小 */
   size_t string_pool_used;   /* 已使用的大小 */
   bool string_pool_owned;    /* 是否拥有内存池 */
+  struct lq_pool_chunk *pool_overflow;  /* 内存池溢出块链表 */
+  size_t decode_buffer_used; /* 解码缓冲区已使用的大小（零拷贝模式） */
+  char *owned_decode_buffer; /* 自有解码缓冲区，跨 reset 保留 */
+  size_t owned_decode_size;  /* 自有解码缓冲区容量 */
+  size_t side_capacity;      /* 零拷贝自有解码缓冲区的最小容量（查询长度） */
+  uint32_t lazy_pending;     /* 延迟模式下尚未生成的键值对数量 */
+  uint32_t kv_count;         /* 键值对数量（q->kv_count 为其 16 位饱和值） */
+  uint32_t kv_capacity;      /* kv_pairs 数组容量 */
+  uint32_t kv_limit;         /* 键值对数量上限 */
+  bool kv_growable;          /* kv_pairs 按需倍增（llquery_init_growable） */
+  bool index_valid;          /* 键哈希索引与当前结果一致 */
+  uint32_t scan_work;        /* 索引失效后线性查找累计扫描的键值对数量 */
+  uint32_t index_mask;       /* 索引槽位数 - 1，0 表示未分配 */
+  uint32_t index_next_cap;   /* index_next 容量 */
+  struct lq_index_slot *index_slots;  /* 键哈希索引（开放寻址），首次按键查找时建立 */
+  uint32_t *index_next;      /* 同键链表：下一个同键键值对的下标 */
+  bool ci_valid;             /* 忽略大小写的键索引与当前结果一致 */
+  uint32_t ci_scan_work;     /* 忽略大小写的线性查找累计扫描量 */
+  uint32_t ci_mask;          /* ci_slots 槽位数 - 1，0 表示未分配 */
+  struct lq_index_slot *ci_slots;  /* 忽略大小写的键索引，按折叠后的键哈希，只记录首个下标 */
+  uint64_t hash_seed[2];     /* 每个解析器独立的随机哈希种子 */
+  bool kv_sorted;            /* 键值对按键有序（LQF_SORT_KEYS 或默认比较的 llquery_sort） */
+  bool keytab_valid;         /* 小查询键表与当前结果一致 */
+  uint32_t keytab_wild;      /* 位 i 置位：第 i 个键尚未解码，签名未知，总作为候选 */
+  uint64_t keytab_sig[LQ_INDEX_MIN_PAIRS];  /* 小查询键表：每个键的 8 字节签名（SoA） */
+  const struct llquery_schema *schema;  /* 绑定的键模式（llquery_set_schema），NULL 表示未绑定 */
+  uint32_t *slot_first;      /* 每个槽位第一个键值对的下标，LQ_NPOS 表示未出现 */
+  uint32_t slot_cap;         /* slot_first 容量 */
+  uint32_t unknown_count;    /* 解析时遇到的不在模式中的键数量 */
+  bool slots_valid;          /* slot_first 与当前结果一致 */
+  struct llquery_intern *intern;  /* 绑定的键驻留表（llquery_set_intern），NULL 表示未绑定 */
+  bool intern_learn;         /* 解析时把新键加入驻留表 */
 } llquery_internal_t;
 
+/* 键哈希索引槽位：每个不同的键一个槽，head/tail 为同键链表首尾下标 */
+typedef struct lq_index_slot {
+  uint32_t hash;
+  uint32_t head;             /* LQ_NPOS 表示空槽 */
+  uint32_t tail;
+} lq_index_slot_t;
+
+/*
+ * 键模式：已知键的两级完美哈希表（hash-and-displace）。键先按哈希分到桶中，
+ * 每个桶记录一个位移，键在 entries 中的位置由键哈希和所在桶的位移决定，
+ * 每个已知键恰好占一项，查找只需一次哈希、一次比较。
+ * 位移表与键字符串复制在同一块内存中。
+ */
+typedef struct lq_schema_entry {
+  const char *key;           /* NULL 表示空项 */
+  uint32_t key_len;
+  uint32_t slot;
+} lq_schema_entry_t;
+
+struct llquery_schema {
+  uint64_t seed;             /* 键哈希种子 */
+  const uint16_t *disp;      /* 每个桶的位移，共 bucket_count 项 */
+  uint32_t mask;             /* entries 项数 - 1 */
+  uint32_t bucket_count;
+  uint32_t key_count;
+  uint16_t flags;            /* enum llquery_schema_flags */
+  llquery_free_fn free_fn;
+  void *alloc_data;
+  lq_schema_entry_t entries[];
+};
+
+/*
+ * 键驻留表：开放寻址哈希表，键 ID 从 1 开始按加入顺序分配，在表的生命周期内不变。
+ * 键字符串存放在只增不减的块链表中，解析结果可以直接引用。
+ */
+typedef struct lq_intern_slot {
+  uint32_t hash;
+  uint32_t id;               /* 0 表示空槽 */
+} lq_intern_slot_t;
+
+struct llquery_intern {
+  uint64_t seed[2];
+  uint32_t mask;
+  uint32_t count;
+  uint32_t max_keys;
+  lq_intern_slot_t *slots;
+  const char **keys;         /* keys[id]，以'\0'结尾 */
+  uint32_t *key_lens;
+  struct lq_pool_chunk *chunks;
+  llquery_alloc_fn alloc_fn;
+  llquery_free_fn free_fn;
+  void *alloc_data;
+};
+
+/* 键值对内部状态位（struct llquery_kv::_state） */
+#define LQ_KV_PENDING    0x01  /* 延迟模式：只记录了原始偏移 */
+#define LQ_KV_KEY_ESC    0x02  /* 原始键需要解码 */
+#define LQ_KV_VALUE_ESC  0x04  /* 原始值需要解码 */
+#define LQ_KV_DUP        0x08  /* 键哈希索引：不是该键首次出现（索引有效时才有意义） */
+
+/* 内存池溢出块：主池空间不足时追加，随内存池一起释放 */
+typedef struct lq_pool_chunk {
+  struct lq_pool_chunk *next;
+  size_t size;
+  size_t used;
+} lq_pool_chunk_t;
+
 /* 字符分类查找表：使用位掩码实现零分支字符检查 */
 static const unsigned char char_flags[256] = {
   /* 0x00-0x08 */ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
@@ -127,8 +339,75 @@ static llquery_internal_t *get_internal(struct llquery *q) {
   return (llquery_internal_t *)q->_reserved;
 }
 
+/* 键值对数量（32 位） */
+static LQ_ALWAYS_INLINE uint32_t kv_count(const struct llquery *q) {
+  const llquery_internal_t *internal = (const llquery_internal_t *)q->_reserved;
+  return internal ? internal->kv_count : q->kv_count;
+}
+
+/* 结果变化后键索引与键表失效 */
+static void lookup_invalidate(llquery_internal_t *internal) {
+  internal->slots_valid = false;
+  internal->index_valid = false;
+  internal->keytab_valid = false;
+  internal->scan_work = 0;
+  internal->ci_valid = false;
+  internal->ci_scan_work = 0;
+}
+
+/* 设置键值对数量，同步 16 位的 q->kv_count（超出时饱和） */
+static void set_kv_count(struct llquery *q, llquery_internal_t *internal, uint32_t count) {
+  internal->kv_count = count;
+  internal->kv_sorted = false;
+  lookup_invalidate(internal);
+  q->kv_count = count > UINT16_MAX ? UINT16_MAX : (uint16_t)count;
+}
+
+/* 可增长模式：确保 kv_pairs 至少容纳 need 个键值对，按至少两倍扩容，保留前 used 个 */
+static bool kv_reserve(struct llquery *q, llquery_internal_t *internal,
+                       uint32_t used, uint32_t need) {
+  if (LIKELY(need <= internal->kv_capacity)) {
+    return true;
+  }
+  if (!internal->kv_growable || need > internal->kv_limit) {
+    return false;
+  }
+
+  uint32_t new_cap = internal->kv_capacity > UINT32_MAX / 2 ? UINT32_MAX : internal->kv_capacity * 2;
+  if (new_cap < GROWABLE_INITIAL_PAIRS) new_cap = GROWABLE_INITIAL_PAIRS;
+  if (new_cap < need) new_cap = need;
+  if (new_cap > internal->kv_limit) new_cap = internal->kv_limit;
+#if SIZE_MAX <= UINT32_MAX
+  if (new_cap > SIZE_MAX / sizeof(struct llquery_kv)) {
+    return false;
+  }
+#endif
+
+  struct llquery_kv *pairs = internal->alloc_fn(sizeof(struct llquery_kv) * new_cap,
+                                                internal->alloc_data);
+  if (UNLIKELY(!pairs)) {
+    return false;
+  }
+  if (q->kv_pairs) {
+    memcpy(pairs, q->kv_pairs, sizeof(struct llquery_kv) * used);
+    internal->free_fn(q->kv_pairs, internal->alloc_data);
+  }
+  q->kv_pairs = pairs;
+  internal->kv_capacity = new_cap;
+  return true;
+}
+
 static bool has_encoded_chars(const char *str, size_t len) {
-  for (size_t i = 0; i < len; i++) {
+  size_t i = 0;
+#if LLQUERY_USE_SWAR
+  for (; i + 8 <= len; i += 8) {
+    uint64_t w = swar_load(str + i);
+    if (UNLIKELY(swar_eq(w, '%') | swar_eq(w, '+'))) {
+      return true;
+    }
+  }
+#endif
+  for (; i < len; i++) {
     unsigned char c = (unsigned char)str[i];
     if (UNLIKELY(IS_ENCODED(c))) {
       return true;
@@ -137,439 +416,3772 @@ static bool has_encoded_chars(const char *str, size_t len) {
   return false;
 }
 
-/* 从内存池分配字符串 */
+/*
+ * 从内存池分配字符串
+ *
+ * 所有键值字符串都归内存池所有：主池空间不足时追加溢出块，
+ * 而不是单独分配字符串，因此释放时无需逐个检查指针来源。
+ */
 static char* pool_alloc_string(llquery_internal_t *internal, size_t size) {
-  if (UNLIKELY(!internal->string_pool)) {
-    // 没有内存池，使用常规分配
-    return internal->alloc_fn(size, internal->alloc_data);
-  }
-  
   // 检查内存池是否有足够空间
-  if (internal->string_pool_used + size <= internal->string_pool_size) {
+  if (LIKELY(internal->string_pool &&
+             internal->string_pool_used + size <= internal->string_pool_size)) {
     char *ptr = internal->string_pool + internal->string_pool_used;
     internal->string_pool_used += size;
     return ptr;
   }
-  
-  // 内存池空间不足，使用常规分配
-  // 注意：这会导致混合分配，需要在free时检查地址
-  return internal->alloc_fn(size, internal->alloc_data);
-}
-
-/* 估算需要的总字符串大小 */
-static size_t estimate_string_size(const char *query __attribute__((unused)), size_t len) {
-  // 估算：每个字符最多需要2字节（\0终止符），加上一些缓冲
-  // 实际大小通常小于查询字符串长度的2倍
-  return len * 2 + 256;  // 额外的256字节缓冲
-}
-
-static size_t decode_in_place(char *str) {
-  if (UNLIKELY(!str)) return 0;
-
-  char *src = str;
-  char *dst = str;
-
-  while (*src) {
-    unsigned char c = (unsigned char)*src;
 
-    if (UNLIKELY(c == '+')) {
-      *dst++ = ' ';
-      src++;
-    } else if (UNLIKELY(c == '%' && src[1] && src[2])) {
-      int h1 = HEX_LOOKUP[(unsigned char)src[1]];
-      int h2 = HEX_LOOKUP[(unsigned char)src[2]];
-
-      if (LIKELY(h1 >= 0 && h2 >= 0)) {
-        *dst++ = (char)((h1 << 4) | h2);
-        src += 3;
-      } else {
-        // 无效的百分号编码，保留原字符
-        *dst++ = *src++;
-      }
-    } else {
-      *dst++ = *src++;
+  lq_pool_chunk_t *chunk = internal->pool_overflow;
+  if (!chunk || chunk->used + size > chunk->size) {
+    // 追加溢出块：大小至少与主池相当且逐块翻倍，避免频繁分配
+    size_t chunk_size = chunk ? chunk->size * 2 : internal->string_pool_size;
+    if (chunk_size < size) chunk_size = size;
+    if (chunk_size < 256) chunk_size = 256;
+    chunk = internal->alloc_fn(sizeof(lq_pool_chunk_t) + chunk_size, internal->alloc_data);
+    if (UNLIKELY(!chunk)) {
+      return NULL;
     }
+    chunk->next = internal->pool_overflow;
+    chunk->size = chunk_size;
+    chunk->used = 0;
+    internal->pool_overflow = chunk;
   }
 
-  *dst = '\0';
-  return (size_t)(dst - str);
+  char *ptr = (char *)(chunk + 1) + chunk->used;
+  chunk->used += size;
+  return ptr;
 }
 
-static char* trim_string(char *str, size_t *len) {
-  if (UNLIKELY(!str || *len == 0)) return str;
+/*
+ * 准备主内存池：已有容量足够时直接复用，否则按至少两倍扩容。
+ * 同一个 llquery 反复解析相近长度的查询时，稳态下不再分配内存。
+ */
+static void pool_prepare(llquery_internal_t *internal, size_t size) {
+  internal->string_pool_used = 0;
+  if (LIKELY(internal->string_pool_owned && size <= internal->string_pool_size)) {
+    return;
+  }
 
-  // 去除前导空白
-  char *start = str;
-  while (*start && IS_SPACE(*start)) {
-    start++;
+  size_t new_size = internal->string_pool_size * 2;
+  if (new_size < size) new_size = size;
+  char *string_pool = internal->alloc_fn(new_size, internal->alloc_data);
+  if (LIKELY(string_pool != NULL)) {
+    if (internal->string_pool_owned && internal->string_pool) {
+      internal->free_fn(internal->string_pool, internal->alloc_data);
+    }
+    internal->string_pool = string_pool;
+    internal->string_pool_size = new_size;
+    internal->string_pool_owned = true;
   }
+  // 分配失败时保留旧池，不足部分由溢出块承担
+}
 
-  // 去除尾随空白
-  char *end = str + *len - 1;
-  while (end >= start && IS_SPACE(*end)) {
-    end--;
+/* 释放溢出块 */
+static void pool_release_overflow(llquery_internal_t *internal) {
+  lq_pool_chunk_t *chunk = internal->pool_overflow;
+  while (chunk) {
+    lq_pool_chunk_t *next = chunk->next;
+    internal->free_fn(chunk, internal->alloc_data);
+    chunk = next;
   }
+  internal->pool_overflow = NULL;
+}
 
-  size_t new_len = (size_t)(end - start + 1);
-  memmove(str, start, new_len);
-  str[new_len] = '\0';
-  *len = new_len;
-  return str;
+/* 释放内存池及其溢出块 */
+static void pool_release(llquery_internal_t *internal) {
+  if (internal->string_pool_owned && internal->string_pool) {
+    internal->free_fn(internal->string_pool, internal->alloc_data);
+  }
+  internal->string_pool = NULL;
+  internal->string_pool_size = 0;
+  internal->string_pool_used = 0;
+  internal->string_pool_owned = false;
+  pool_release_overflow(internal);
 }
 
-static int compare_keys(const char *a, size_t a_len, const char *b, size_t b_len) {
-  size_t min_len = a_len < b_len ? a_len : b_len;
-  int cmp = memcmp(a, b, min_len);
-  if (cmp != 0) return cmp;
-  return (int)a_len - (int)b_len;
+/* 释放空闲的自有解码缓冲区（当前结果未引用时） */
+static void decode_buffer_release(llquery_internal_t *internal) {
+  if (internal->owned_decode_buffer && !internal->decode_buffer_owned) {
+    internal->free_fn(internal->owned_decode_buffer, internal->alloc_data);
+    internal->owned_decode_buffer = NULL;
+    internal->owned_decode_size = 0;
+  }
 }
 
-static void lowercase_string(char *str, size_t len) {
-  for (size_t i = 0; i < len; i++) {
-    unsigned char c = (unsigned char)str[i];
-    if (IS_UPPER(c)) {
-      str[i] = (char)(c + ASCII_CASE_OFFSET);  /* Convert A-Z to a-z */
+/*
+ * 零拷贝模式：从解码缓冲区分配空间，只有需要解码或改写的 token 才会用到。
+ * 未提供外部缓冲区时使用自有缓冲区，容量不小于查询长度（解码结果不会长于输入），
+ * 不足时按至少两倍扩容；自有缓冲区跨 reset 保留。
+ */
+static char *side_alloc(struct llquery *q, llquery_internal_t *internal,
+                        size_t size, size_t capacity) {
+  if (!q->decode_buffer) {
+    if (internal->owned_decode_size < capacity) {
+      size_t new_size = internal->owned_decode_size * 2;
+      if (new_size < capacity) new_size = capacity;
+      char *buf = internal->alloc_fn(new_size, internal->alloc_data);
+      if (!buf) {
+        return NULL;
+      }
+      if (internal->owned_decode_buffer) {
+        internal->free_fn(internal->owned_decode_buffer, internal->alloc_data);
+      }
+      internal->owned_decode_buffer = buf;
+      internal->owned_decode_size = new_size;
     }
+    q->decode_buffer = internal->owned_decode_buffer;
+    q->decode_buffer_size = internal->owned_decode_size;
+    internal->decode_buffer_owned = true;
+    internal->decode_buffer_used = 0;
   }
+  if (internal->decode_buffer_used + size > q->decode_buffer_size) {
+    return NULL;
+  }
+  char *ptr = q->decode_buffer + internal->decode_buffer_used;
+  internal->decode_buffer_used += size;
+  return ptr;
 }
 
-/* 公共API实现 */
+/* 估算需要的总字符串大小 */
+static size_t estimate_string_size(const char *query __attribute__((unused)), size_t len) {
+  // 估算：每个字符最多需要2字节（\0终止符），加上一些缓冲
+  // 实际大小通常小于查询字符串长度的2倍
+  return len * 2 + 256;  // 额外的256字节缓冲
+}
 
-enum llquery_error llquery_init(struct llquery *q,
-                                uint16_t max_pairs,
-                                uint16_t flags) {
-  return llquery_init_ex(q, max_pairs, flags,
-                         default_alloc, default_free, NULL);
+/* 大小写折叠：CHAR_UPPER 右移一位恰为 ASCII_CASE_OFFSET，查 char_flags 一次即可，无分支 */
+#define LQ_FOLD_LOWER(c) \
+  ((unsigned char)((unsigned char)(c) + ((char_flags[(unsigned char)(c)] & CHAR_UPPER) >> 1)))
+
+/* 8 字节同时转小写：最高位为 0 且落在 'A'..'Z' 的字节加 0x20（按字节计算，不跨字节进位） */
+static LQ_ALWAYS_INLINE uint64_t fold_word(uint64_t w) {
+  uint64_t low7 = w & 0x7F7F7F7F7F7F7F7FULL;
+  uint64_t ge_a = low7 + 0x3F3F3F3F3F3F3F3FULL;   /* 0x80 - 'A' */
+  uint64_t gt_z = low7 + 0x2525252525252525ULL;   /* 0x7F - 'Z' */
+  uint64_t upper = ge_a & ~gt_z & ~w & 0x8080808080808080ULL;
+  return w | (upper >> 2);
 }
 
-enum llquery_error llquery_init_ex(struct llquery *q,
-                                   uint16_t max_pairs,
-                                   uint16_t flags,
-                                   llquery_alloc_fn alloc_fn,
-                                   llquery_free_fn free_fn,
-                                   void *alloc_data) {
-  if (!q || !alloc_fn || !free_fn) {
-    return LQE_NULL_INPUT;
+/*
+ * 查找 [p, end) 中第一个 '%' 或 '+'，未找到返回 end。
+ * SSE2 下每次检查 32 字节（两个 16 字节向量合并判断），不足时逐 16 字节；
+ * 可移植构建按 LLQUERY_USE_SWAR 每次检查 8 字节或逐字节查表。
+ */
+static LQ_ALWAYS_INLINE const char *find_escape(const char *p, const char *end) {
+#ifdef LLQUERY_HAVE_SSE2
+  const __m128i pct_c = _mm_set1_epi8('%');
+  const __m128i plus_c = _mm_set1_epi8('+');
+  while (end - p >= 32) {
+    __m128i a = _mm_loadu_si128((const __m128i *)p);
+    __m128i b = _mm_loadu_si128((const __m128i *)(p + 16));
+    __m128i ea = _mm_or_si128(_mm_cmpeq_epi8(a, pct_c), _mm_cmpeq_epi8(a, plus_c));
+    __m128i eb = _mm_or_si128(_mm_cmpeq_epi8(b, pct_c), _mm_cmpeq_epi8(b, plus_c));
+    uint32_t mask = (uint32_t)(uint16_t)_mm_movemask_epi8(ea) |
+                    ((uint32_t)(uint16_t)_mm_movemask_epi8(eb) << 16);
+    if (mask) return p + lq_ctz64(mask);
+    p += 32;
   }
-
-  memset(q, 0, sizeof(struct llquery));
-
-  // 设置默认值
-  if (max_pairs == 0) {
-    max_pairs = DEFAULT_MAX_PAIRS;
+  if (end - p >= 16) {
+    __m128i a = _mm_loadu_si128((const __m128i *)p);
+    __m128i ea = _mm_or_si128(_mm_cmpeq_epi8(a, pct_c), _mm_cmpeq_epi8(a, plus_c));
+    uint32_t mask = (uint16_t)_mm_movemask_epi8(ea);
+    if (mask) return p + lq_ctz64(mask);
+    p += 16;
   }
-
-  // 分配内部结构
-  llquery_internal_t *internal = alloc_fn(sizeof(llquery_internal_t), alloc_data);
-  if (!internal) {
-    return LQE_MEMORY_ERROR;
+#elif LLQUERY_USE_SWAR
+  while (end - p >= 8) {
+    uint64_t w = swar_load(p);
+    uint64_t m = swar_eq(w, '%') | swar_eq(w, '+');
+    if (m) return p + lq_ctz64(m) / 8;
+    p += 8;
   }
+#endif
+  while (p < end && !IS_ENCODED(*p)) p++;
+  return p;
+}
 
-  internal->alloc_fn = alloc_fn;
-  internal->free_fn = free_fn;
-  internal->alloc_data = alloc_data;
-  internal->use_custom_alloc = true;
-  internal->decode_buffer_owned = false;
-  internal->string_pool = NULL;
-  internal->string_pool_size = 0;
-  internal->string_pool_used = 0;
-  internal->string_pool_owned = false;
-
-  // 分配键值对数组
-  struct llquery_kv *kv_pairs = alloc_fn(sizeof(struct llquery_kv) * max_pairs, alloc_data);
-  if (!kv_pairs) {
-    free_fn(internal, alloc_data);
-    return LQE_MEMORY_ERROR;
+/* 复制并转小写（一遍完成），dst 可以与 src 相同 */
+static void copy_lower(char *dst, const char *src, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = (unsigned char)src[i];
+    dst[i] = (char)LQ_FOLD_LOWER(c);
   }
+}
 
-  memset(kv_pairs, 0, sizeof(struct llquery_kv) * max_pairs);
-
-  q->kv_pairs = kv_pairs;
-  q->max_kv_count = max_pairs;
-  q->flags = flags;
-  q->_reserved = internal;
+/*
+ * 块解码：每块（SSE2 为 16 字节，SWAR 为 8 字节）先求 '%'/'+' 位掩码，
+ * 无转义的块整块写出；有转义时写出转义前的部分，再逐个处理连续的转义。
+ * 整块写出会越过本块有效输出的末尾，只在 dst 为独立缓冲区时这样做；
+ * 原地解码（dst 与 src 重叠）时只写有效部分，避免覆盖尚未读取的输入。
+ */
+#if defined(LLQUERY_HAVE_SSE2)
+#define LQ_DECODE_BLOCK 16
+
+static LQ_ALWAYS_INLINE uint32_t decode_block_mask(const char *src) {
+  __m128i v = _mm_loadu_si128((const __m128i *)src);
+  __m128i e = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('%')),
+                           _mm_cmpeq_epi8(v, _mm_set1_epi8('+')));
+  return (uint16_t)_mm_movemask_epi8(e);
+}
 
-  return LQE_OK;
+static LQ_ALWAYS_INLINE void decode_block_store(char *dst, const char *src, const bool lower) {
+  __m128i v = _mm_loadu_si128((const __m128i *)src);
+  if (lower) {
+    // 有符号比较：0x80 以上的字节为负数，不在 'A'..'Z' 范围内
+    __m128i up = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('A' - 1)),
+                               _mm_cmplt_epi8(v, _mm_set1_epi8('Z' + 1)));
+    v = _mm_or_si128(v, _mm_and_si128(up, _mm_set1_epi8(ASCII_CASE_OFFSET)));
+  }
+  _mm_storeu_si128((__m128i *)dst, v);
 }
+#elif LLQUERY_USE_SWAR
+#define LQ_DECODE_BLOCK 8
 
-enum llquery_error llquery_parse(const char *query,
-                                 size_t query_len,
-                                 struct llquery *q) {
-  return llquery_parse_ex(query, query_len, q, NULL, 0);
+static LQ_ALWAYS_INLINE uint32_t decode_block_mask(const char *src) {
+  uint64_t w = swar_load(src);
+  return swar_movemask(swar_eq(w, '%') | swar_eq(w, '+'));
 }
 
-enum llquery_error llquery_parse_ex(const char *query,
-                                    size_t query_len,
-                                    struct llquery *q,
-                                    char *decode_buf,
-                                    size_t decode_buf_size) {
-  if (!query || !q || !q->_reserved) {
-    return LQE_NULL_INPUT;
-  }
+static LQ_ALWAYS_INLINE void decode_block_store(char *dst, const char *src, const bool lower) {
+  uint64_t w = swar_load(src);
+  if (lower) w = fold_word(w);
+  memcpy(dst, &w, sizeof(w));
+}
+#endif
 
-  // 获取字符串长度
-  if (query_len == 0) {
-    query_len = strlen(query);
+/* 处理 src 处的一个转义（'+' 或 '%'）；无效或不完整的百分号编码保留 '%' 原样输出 */
+static LQ_ALWAYS_INLINE void decode_escape(char **out, const char **src, const char *end,
+                                           const bool lower) {
+  const char *p = *src;
+  if (*p == '+') {
+    *(*out)++ = ' ';
+    *src = p + 1;
+    return;
   }
-  if (query_len == 0) {
-    return LQE_EMPTY_STRING;
+  int h1 = end - p >= 3 ? HEX_LOOKUP[(unsigned char)p[1]] : -1;
+  int h2 = h1 >= 0 ? HEX_LOOKUP[(unsigned char)p[2]] : -1;
+  if (LIKELY(h2 >= 0)) {
+    unsigned char d = (unsigned char)((h1 << 4) | h2);
+    *(*out)++ = (char)(lower ? LQ_FOLD_LOWER(d) : d);
+    *src = p + 3;
+  } else {
+    *(*out)++ = '%';
+    *src = p + 1;
   }
+}
 
-  // 重置解析器
-  llquery_reset(q);
-
-  // 跳过前导'?'
-  const char *work_query = query;
-  if (*work_query == '?') {
-    work_query++;
-    query_len--;
-    if (query_len == 0) {
-      return LQE_OK;
+/*
+ * 解码长度受限的片段：src[0..len) 解码写入 dst，返回解码后长度，不写终止符。
+ * 解码结果不会长于输入，调用方无需预先计算长度：dst 至少容纳 len 字节，
+ * 可以与 src 相同（原地解码）。exact 为 true 时不写出有效输出以外的字节，
+ * dst 只需容纳解码结果。lower 为编译期常量，
+ * 生成 decode_span 与同时转小写的 decode_span_lower。
+ */
+static LQ_ALWAYS_INLINE size_t decode_span_impl(char *dst, const char *src, size_t len,
+                                                const bool lower, bool exact) {
+  const char *end = src + len;
+  char *out = dst;
+
+#ifdef LQ_DECODE_BLOCK
+  exact = exact || (dst < end && src < dst + len);
+  while (end - src >= LQ_DECODE_BLOCK) {
+    uint32_t mask = decode_block_mask(src);
+    // 原地解码且尚无转义时输出与输入重合，不必写出
+    bool same = !lower && out == src;
+    if (LIKELY(mask == 0)) {
+      if (!same) decode_block_store(out, src, lower);
+      out += LQ_DECODE_BLOCK;
+      src += LQ_DECODE_BLOCK;
+      continue;
+    }
+    unsigned n = lq_ctz64(mask);
+    if (!exact) {
+      decode_block_store(out, src, lower);
+    } else if (!same) {
+      for (unsigned i = 0; i < n; i++) {
+        out[i] = lower ? (char)LQ_FOLD_LOWER(src[i]) : src[i];
+      }
     }
+    out += n;
+    src += n;
+    do {
+      decode_escape(&out, &src, end, lower);
+    } while (src < end && IS_ENCODED(*src));
   }
+#else
+  (void)exact;
+#endif
 
-  // 获取内部结构
-  llquery_internal_t *internal = get_internal(q);
+  while (src < end) {
+    if (LIKELY(!IS_ENCODED(*src))) {
+      *out++ = lower ? (char)LQ_FOLD_LOWER(*src) : *src;
+      src++;
+    } else {
+      decode_escape(&out, &src, end, lower);
+    }
+  }
+  return (size_t)(out - dst);
+}
 
-  // 判断是否需要解码
-  bool needs_decode = (q->flags & LQF_AUTO_DECODE) != 0;
-  bool has_encoded = needs_decode && has_encoded_chars(work_query, query_len);
+static size_t decode_span(char *dst, const char *src, size_t len) {
+  return decode_span_impl(dst, src, len, false, false);
+}
 
-  // 准备工作指针
-  const char *current = work_query;
-  const char *end = work_query + query_len;
+static size_t decode_span_lower(char *dst, const char *src, size_t len) {
+  return decode_span_impl(dst, src, len, true, false);
+}
 
-  // 处理解码
-  if (has_encoded) {
-    if (decode_buf && decode_buf_size > 0) {
-      // 使用外部提供的缓冲区
-      if (decode_buf_size < query_len + 1) {
-        return LQE_BUFFER_TOO_SMALL;
-      }
-      memcpy(decode_buf, work_query, query_len);
-      decode_buf[query_len] = '\0';
-      size_t decoded_len = decode_in_place(decode_buf);
-      current = decode_buf;
-      end = decode_buf + decoded_len;
-      q->decode_buffer = decode_buf;
-      q->decode_buffer_size = decode_buf_size;
+/* 解码后的长度（不含终止符）：每个有效的 %XX 少两个字节 */
+static size_t decoded_length(const char *src, size_t len) {
+  const char *end = src + len;
+  size_t shrink = 0;
+  for (const char *p = find_escape(src, end); p < end; p = find_escape(p, end)) {
+    if (*p == '%' && end - p >= 3 && HEX_LOOKUP[(unsigned char)p[1]] >= 0 &&
+        HEX_LOOKUP[(unsigned char)p[2]] >= 0) {
+      shrink += 2;
+      p += 3;
     } else {
-      // 分配解码缓冲区
-      char *buf = internal->alloc_fn(query_len + 1, internal->alloc_data);
-      if (!buf) {
-        return LQE_MEMORY_ERROR;
-      }
-      memcpy(buf, work_query, query_len);
-      buf[query_len] = '\0';
-      size_t decoded_len = decode_in_place(buf);
-      current = buf;
-      end = buf + decoded_len;
-      q->decode_buffer = buf;
-      q->decode_buffer_size = query_len + 1;
-      internal->decode_buffer_owned = true;
+      p++;
     }
   }
+  return len - shrink;
+}
 
-  // 阶段5优化：预分配字符串内存池以减少分配次数
-  size_t estimated_pool_size = estimate_string_size(work_query, query_len);
-  char *string_pool = internal->alloc_fn(estimated_pool_size, internal->alloc_data);
-  if (LIKELY(string_pool != NULL)) {
-    internal->string_pool = string_pool;
-    internal->string_pool_size = estimated_pool_size;
-    internal->string_pool_used = 0;
-    internal->string_pool_owned = true;
+/*
+ * UTF-8 校验
+ *
+ * ASCII 字节按块跳过（SSE2 每次 16 字节，SWAR 每次 8 字节），遇到最高位为 1 的字节
+ * 才逐个校验多字节序列，连续的非 ASCII 文本留在序列循环中，不反复进出块扫描。
+ * 序列按 Unicode 表 3-7：拒绝过长编码、代理区（U+D800..U+DFFF）与 U+10FFFF 以上。
+ */
+static LQ_ALWAYS_INLINE size_t ascii_prefix(const unsigned char *s, size_t len) {
+  size_t i = 0;
+#if defined(LLQUERY_HAVE_SSE2)
+  for (; i + 16 <= len; i += 16) {
+    uint32_t m = (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)(s + i)));
+    if (m) return i + lq_ctz64(m);
   }
+#endif
+#if LLQUERY_USE_SWAR
+  for (; i + 8 <= len; i += 8) {
+    uint64_t w = swar_load((const char *)s + i) & SWAR_HIGHS;
+    if (w) return i + lq_ctz64(w) / 8;
+  }
+#endif
+  for (; i < len; i++) {
+    if (s[i] & 0x80) return i;
+  }
+  return len;
+}
 
-  // 主解析循环 - 优化版本使用批量处理
-  uint16_t kv_index = 0;
-
-  while (LIKELY(current < end && kv_index < q->max_kv_count)) {
-    // 跳过前导'&'
-    while (LIKELY(current < end) && IS_SEPARATOR(*current)) current++;
-    if (UNLIKELY(current >= end)) break;
-
-    const char* key_start = current;
-    
-    // 批量查找 key 结束位置（'=' 或 '&'）
-    const char *key_end = current;
-    while (LIKELY(key_end < end) && !IS_EQUAL(*key_end) && !IS_SEPARATOR(*key_end)) {
-      key_end++;
+/* 是否全部为 ASCII：按块累积最高位，尾部与最后一整块重叠，短 token 不走逐字节循环 */
+static LQ_ALWAYS_INLINE bool ascii_only(const unsigned char *s, size_t len) {
+  size_t i = 0;
+#if defined(LLQUERY_HAVE_SSE2)
+  if (len >= 16) {
+    __m128i acc = _mm_loadu_si128((const __m128i *)(s + len - 16));
+    for (; i + 64 < len; i += 64) {
+      __m128i a = _mm_or_si128(_mm_loadu_si128((const __m128i *)(s + i)),
+                               _mm_loadu_si128((const __m128i *)(s + i + 16)));
+      __m128i b = _mm_or_si128(_mm_loadu_si128((const __m128i *)(s + i + 32)),
+                               _mm_loadu_si128((const __m128i *)(s + i + 48)));
+      acc = _mm_or_si128(acc, _mm_or_si128(a, b));
     }
-    current = key_end;
-
-    const char *value_start = NULL;
+    for (; i + 16 < len; i += 16) {
+      acc = _mm_or_si128(acc, _mm_loadu_si128((const __m128i *)(s + i)));
+    }
+    return _mm_movemask_epi8(acc) == 0;
+  }
+#endif
+#if LLQUERY_USE_SWAR
+  if (len >= 8) {
+    uint64_t acc = swar_load((const char *)s + len - 8);
+    for (; i + 8 < len; i += 8) {
+      acc |= swar_load((const char *)s + i);
+    }
+    return (acc & SWAR_HIGHS) == 0;
+  }
+  if (len >= 4) {
+    uint32_t a, b;
+    memcpy(&a, s, 4);
+    memcpy(&b, s + len - 4, 4);
+    return ((a | b) & 0x80808080u) == 0;
+  }
+#endif
+  unsigned acc = 0;
+  for (; i < len; i++) {
+    acc |= s[i];
+  }
+  return acc < 0x80;
+}
+
+#ifdef LLQUERY_HAVE_AVX2
+/*
+ * AVX2 查表校验（Keiser & Lemire，"Validating UTF-8 In Less Than One Instruction
+ * Per Byte"）：用前一字节的高、低半字节和当前字节的高半字节各查一张 16 项表，
+ * 三者按位与后非 0 即为错误（过短、过长、过长编码、代理区、超出范围）；
+ * 三、四字节序列的第 3、4 字节由两、三字节前的首字节推出，与"连续两个后续字节"位比较。
+ * 每次 32 字节，尾部补 0（ASCII）后按整块处理，块末未完成的序列并入下一块或最终结果。
+ */
+#define LQ_U8_TOO_SHORT   0x01
+#define LQ_U8_TOO_LONG    0x02
+#define LQ_U8_OVERLONG_3  0x04
+#define LQ_U8_TOO_LARGE   0x08
+#define LQ_U8_SURROGATE   0x10
+#define LQ_U8_OVERLONG_2  0x20
+#define LQ_U8_TOO_LARGE_1000 0x40
+#define LQ_U8_OVERLONG_4  0x40
+#define LQ_U8_TWO_CONTS   0x80
+#define LQ_U8_CARRY (LQ_U8_TOO_SHORT | LQ_U8_TOO_LONG | LQ_U8_TWO_CONTS)
+
+#define LQ_U8_TABLE(a, b, c, d, e, f, g, h, i, j, k, l, m, n, o, p) \
+  _mm256_setr_epi8((char)(a), (char)(b), (char)(c), (char)(d), (char)(e), (char)(f), \
+                   (char)(g), (char)(h), (char)(i), (char)(j), (char)(k), (char)(l), \
+                   (char)(m), (char)(n), (char)(o), (char)(p), \
+                   (char)(a), (char)(b), (char)(c), (char)(d), (char)(e), (char)(f), \
+                   (char)(g), (char)(h), (char)(i), (char)(j), (char)(k), (char)(l), \
+                   (char)(m), (char)(n), (char)(o), (char)(p))
+
+__attribute__((target("avx2")))
+static bool utf8_valid_avx2(const unsigned char *s, size_t len) {
+  const __m256i byte_1_high = LQ_U8_TABLE(
+    LQ_U8_TOO_LONG, LQ_U8_TOO_LONG, LQ_U8_TOO_LONG, LQ_U8_TOO_LONG,
+    LQ_U8_TOO_LONG, LQ_U8_TOO_LONG, LQ_U8_TOO_LONG, LQ_U8_TOO_LONG,
+    LQ_U8_TWO_CONTS, LQ_U8_TWO_CONTS, LQ_U8_TWO_CONTS, LQ_U8_TWO_CONTS,
+    LQ_U8_TOO_SHORT | LQ_U8_OVERLONG_2,
+    LQ_U8_TOO_SHORT,
+    LQ_U8_TOO_SHORT | LQ_U8_OVERLONG_3 | LQ_U8_SURROGATE,
+    LQ_U8_TOO_SHORT | LQ_U8_TOO_LARGE | LQ_U8_TOO_LARGE_1000 | LQ_U8_OVERLONG_4);
+  const __m256i byte_1_low = LQ_U8_TABLE(
+    LQ_U8_CARRY | LQ_U8_OVERLONG_3 | LQ_U8_OVERLONG_2 | LQ_U8_OVERLONG_4,
+    LQ_U8_CARRY | LQ_U8_OVERLONG_2,
+    LQ_U8_CARRY,
+    LQ_U8_CARRY,
+    LQ_U8_CARRY | LQ_U8_TOO_LARGE,
+    LQ_U8_CARRY | LQ_U8_TOO_LARGE | LQ_U8_TOO_LARGE_1000,
+    LQ_U8_CARRY | LQ_U8_TOO_LARGE | LQ_U8_TOO_LARGE_1000,
+    LQ_U8_CARRY | LQ_U8_TOO_LARGE | LQ_U8_TOO_LARGE_1000,
+    LQ_U8_CARRY | LQ_U8_TOO_LARGE | LQ_U8_TOO_LARGE_1000,
+    LQ_U8_CARRY | LQ_U8_TOO_LARGE | LQ_U8_TOO_LARGE_1000,
+    LQ_U8_CARRY | LQ_U8_TOO_LARGE | LQ_U8_TOO_LARGE_1000,
+    LQ_U8_CARRY | LQ_U8_TOO_LARGE | LQ_U8_TOO_LARGE_1000,
+    LQ_U8_CARRY | LQ_U8_TOO_LARGE | LQ_U8_TOO_LARGE_1000,
+    LQ_U8_CARRY | LQ_U8_TOO_LARGE | LQ_U8_TOO_LARGE_1000 | LQ_U8_SURROGATE,
+    LQ_U8_CARRY | LQ_U8_TOO_LARGE | LQ_U8_TOO_LARGE_1000,
+    LQ_U8_CARRY | LQ_U8_TOO_LARGE | LQ_U8_TOO_LARGE_1000);
+  const __m256i byte_2_high = LQ_U8_TABLE(
+    LQ_U8_TOO_SHORT, LQ_U8_TOO_SHORT, LQ_U8_TOO_SHORT, LQ_U8_TOO_SHORT,
+    LQ_U8_TOO_SHORT, LQ_U8_TOO_SHORT, LQ_U8_TOO_SHORT, LQ_U8_TOO_SHORT,
+    LQ_U8_TOO_LONG | LQ_U8_OVERLONG_2 | LQ_U8_TWO_CONTS | LQ_U8_OVERLONG_3 |
+      LQ_U8_TOO_LARGE_1000 | LQ_U8_OVERLONG_4,
+    LQ_U8_TOO_LONG | LQ_U8_OVERLONG_2 | LQ_U8_TWO_CONTS | LQ_U8_OVERLONG_3 | LQ_U8_TOO_LARGE,
+    LQ_U8_TOO_LONG | LQ_U8_OVERLONG_2 | LQ_U8_TWO_CONTS | LQ_U8_SURROGATE | LQ_U8_TOO_LARGE,
+    LQ_U8_TOO_LONG | LQ_U8_OVERLONG_2 | LQ_U8_TWO_CONTS | LQ_U8_SURROGATE | LQ_U8_TOO_LARGE,
+    LQ_U8_TOO_SHORT, LQ_U8_TOO_SHORT, LQ_U8_TOO_SHORT, LQ_U8_TOO_SHORT);
+  // 块末需要后续字节的首字节：倒数第 3 字节 >= 0xF0，倒数第 2 字节 >= 0xE0，最后一字节 >= 0xC0
+  const __m256i incomplete_max = _mm256_setr_epi8(
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    (char)(0xF0 - 1), (char)(0xE0 - 1), (char)(0xC0 - 1));
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+
+  __m256i prev = _mm256_setzero_si256();
+  __m256i prev_incomplete = _mm256_setzero_si256();
+  __m256i error = _mm256_setzero_si256();
+  unsigned char tail[32];
+
+  for (size_t i = 0; i < len; i += 32) {
+    __m256i in;
+    if (LIKELY(i + 32 <= len)) {
+      in = _mm256_loadu_si256((const __m256i *)(s + i));
+    } else {
+      memset(tail, 0, sizeof(tail));
+      memcpy(tail, s + i, len - i);
+      in = _mm256_loadu_si256((const __m256i *)tail);
+    }
+
+    if (_mm256_movemask_epi8(in) == 0) {
+      error = _mm256_or_si256(error, prev_incomplete);
+      prev_incomplete = _mm256_setzero_si256();
+    } else {
+      // 向前错开 1、2、3 字节的输入（跨 128 位通道取前一块的末尾）
+      __m256i carry = _mm256_permute2x128_si256(prev, in, 0x21);
+      __m256i prev1 = _mm256_alignr_epi8(in, carry, 15);
+      __m256i prev2 = _mm256_alignr_epi8(in, carry, 14);
+      __m256i prev3 = _mm256_alignr_epi8(in, carry, 13);
+
+      __m256i b1h = _mm256_shuffle_epi8(byte_1_high,
+                                        _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble));
+      __m256i b1l = _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, nibble));
+      __m256i b2h = _mm256_shuffle_epi8(byte_2_high,
+                                        _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble));
+      __m256i special = _mm256_and_si256(_mm256_and_si256(b1h, b1l), b2h);
+
+      __m256i third = _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80)));
+      __m256i fourth = _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80)));
+      __m256i must23 = _mm256_and_si256(_mm256_or_si256(third, fourth),
+                                        _mm256_set1_epi8((char)0x80));
+      error = _mm256_or_si256(error, _mm256_xor_si256(must23, special));
+      prev_incomplete = _mm256_subs_epu8(in, incomplete_max);
+    }
+    prev = in;
+  }
+  error = _mm256_or_si256(error, prev_incomplete);
+  return _mm256_testz_si256(error, error) != 0;
+}
+#endif
+
+static bool utf8_valid(const char *str, size_t len) {
+  const unsigned char *s = (const unsigned char *)str;
+  if (LIKELY(ascii_only(s, len))) {
+    return true;
+  }
+#ifdef LLQUERY_HAVE_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    return utf8_valid_avx2(s, len);
+  }
+#endif
+  size_t i = ascii_prefix(s, len);
+  while (i < len) {
+    unsigned char c = s[i];
+    if (c < 0x80) {
+      i += ascii_prefix(s + i, len - i);
+      continue;
+    }
+    // 第二个字节的范围随首字节收窄，其余后续字节为 0x80..0xBF
+    size_t n;
+    unsigned char lo = 0x80, hi = 0xBF;
+    if (c >= 0xC2 && c <= 0xDF) {
+      n = 1;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+      n = 2;
+      if (c == 0xE0) lo = 0xA0;
+      else if (c == 0xED) hi = 0x9F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+      n = 3;
+      if (c == 0xF0) lo = 0x90;
+      else if (c == 0xF4) hi = 0x8F;
+    } else {
+      return false;
+    }
+    if (len - i <= n || s[i + 1] < lo || s[i + 1] > hi) {
+      return false;
+    }
+    for (size_t k = 2; k <= n; k++) {
+      if ((s[i + k] & 0xC0) != 0x80) return false;
+    }
+    i += n + 1;
+  }
+  return true;
+}
+
+/* 校验生成后的键值对，记录到 invalid_utf8；严格模式下返回错误 */
+static enum llquery_error validate_pair(struct llquery_kv *kv, uint16_t flags) {
+  kv->invalid_utf8 = !utf8_valid(kv->key, kv->key_len) ||
+                     !utf8_valid(kv->value, kv->value_len);
+  return UNLIKELY(kv->invalid_utf8) && (flags & LQF_STRICT) ? LQE_INVALID_UTF8 : LQE_OK;
+}
+
+/*
+ * URL 编码
+ *
+ * encode_class 每个字节一项，位 (1 << set) 置位表示该字节在编码集 set
+ * （enum llquery_encode_set）中原样输出。各编码集都包含 RFC 3986 未保留字符，
+ * 块内全部为未保留字符时整块复制，其余字节逐个查表。
+ */
+static const unsigned char encode_class[256] = {
+  /* 0x00-0x07 */ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  /* 0x08-0x0F */ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  /* 0x10-0x17 */ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  /* 0x18-0x1F */ 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00,
+  /* 0x20-0x27 */ 0x00, 0x0C, 0x00, 0x00, 0x0C, 0x00, 0x0C, 0x0C,
+  /* 0x28-0x2F */ 0x0C, 0x0C, 0x0C, 0x0C, 0x0C, 0x0F, 0x0F, 0x00,
+  /* 0x30-0x37 */ 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F,
+  /* 0x38-0x3F */ 0x0F, 0x0F, 0x04, 0x0C, 0x00, 0x0C, 0x00, 0x00,
+  /* 0x40-0x47 */ 0x04, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F,
+  /* 0x48-0x4F */ 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F,
+  /* 0x50-0x57 */ 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F,
+  /* 0x58-0x5F */ 0x0F, 0x0F, 0x0F, 0x00, 0x00, 0x00, 0x00, 0x0F,
+  /* 0x60-0x67 */ 0x00, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F,
+  /* 0x68-0x6F */ 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F,
+  /* 0x70-0x77 */ 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F, 0x0F,
+  /* 0x78-0x7F */ 0x0F, 0x0F, 0x0F, 0x00, 0x00, 0x00, 0x0F, 0x00,
+  /* 0x80-0xFF：全部编码 */
+};
+
+static const char HEX_UPPER[] = "0123456789ABCDEF";
+
+/* 块内不是未保留字符（字母数字与 -._~）的字节位掩码 */
+#if defined(LLQUERY_HAVE_SSE2)
+#define LQ_ENCODE_BLOCK 16
+
+static LQ_ALWAYS_INLINE uint32_t encode_block_mask(const char *src) {
+  __m128i v = _mm_loadu_si128((const __m128i *)src);
+  // 有符号比较：0x80 以上的字节为负数，不落在任何范围内
+  __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8('0' - 1)),
+                                _mm_cmplt_epi8(v, _mm_set1_epi8('9' + 1)));
+  __m128i l = _mm_or_si128(v, _mm_set1_epi8(ASCII_CASE_OFFSET));
+  __m128i alpha = _mm_and_si128(_mm_cmpgt_epi8(l, _mm_set1_epi8('a' - 1)),
+                                _mm_cmplt_epi8(l, _mm_set1_epi8('z' + 1)));
+  __m128i mark = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('-')),
+                                           _mm_cmpeq_epi8(v, _mm_set1_epi8('.'))),
+                              _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('_')),
+                                           _mm_cmpeq_epi8(v, _mm_set1_epi8('~'))));
+  __m128i safe = _mm_or_si128(_mm_or_si128(digit, alpha), mark);
+  return (uint16_t)~_mm_movemask_epi8(safe);
+}
+#elif LLQUERY_USE_SWAR
+#define LQ_ENCODE_BLOCK 8
+
+static LQ_ALWAYS_INLINE uint32_t encode_block_mask(const char *src) {
+  uint64_t w = swar_load(src);
+  uint64_t low = w & SWAR_LOWS;
+  uint64_t safe = swar_range(low, '0', '9') |
+                  swar_range(low | (SWAR_ONES * ASCII_CASE_OFFSET), 'a', 'z') |
+                  swar_eq(w, '-') | swar_eq(w, '.') | swar_eq(w, '_') | swar_eq(w, '~');
+  // 最高位为 1 的字节不安全（范围判断只看低 7 位）
+  return swar_movemask(~(safe & ~w) & SWAR_HIGHS);
+}
+#endif
+
+/* 编码后的长度（不含终止符） */
+static size_t encoded_length(const unsigned char *src, size_t len, unsigned char bit,
+                             bool form) {
+  size_t needed = len;
+  size_t i = 0;
+#ifdef LQ_ENCODE_BLOCK
+  for (; i + LQ_ENCODE_BLOCK <= len; i += LQ_ENCODE_BLOCK) {
+    for (uint32_t mask = encode_block_mask((const char *)src + i); mask; mask &= mask - 1) {
+      unsigned char c = src[i + lq_ctz64(mask)];
+      if (!(encode_class[c] & bit) && !(form && c == ' ')) needed += 2;
+    }
+  }
+#endif
+  for (; i < len; i++) {
+    unsigned char c = src[i];
+    if (!(encode_class[c] & bit) && !(form && c == ' ')) needed += 2;
+  }
+  return needed;
+}
+
+/* 是否有字节需要改写（不在编码集内，包括表单编码中输出 '+' 的空格） */
+static bool encode_needed(const unsigned char *src, size_t len, unsigned char bit) {
+  size_t i = 0;
+#ifdef LQ_ENCODE_BLOCK
+  for (; i + LQ_ENCODE_BLOCK <= len; i += LQ_ENCODE_BLOCK) {
+    for (uint32_t mask = encode_block_mask((const char *)src + i); mask; mask &= mask - 1) {
+      if (!(encode_class[src[i + lq_ctz64(mask)]] & bit)) return true;
+    }
+  }
+#endif
+  for (; i < len; i++) {
+    if (!(encode_class[src[i]] & bit)) return true;
+  }
+  return false;
+}
+
+/* 编码一个字节：编码集内原样输出，表单编码中空格输出 '+'，其余输出 %XX */
+static LQ_ALWAYS_INLINE char *encode_byte(char *out, unsigned char c, unsigned char bit,
+                                          bool form) {
+  if (encode_class[c] & bit) {
+    *out++ = (char)c;
+  } else if (form && c == ' ') {
+    *out++ = '+';
+  } else {
+    out[0] = '%';
+    out[1] = HEX_UPPER[c >> 4];
+    out[2] = HEX_UPPER[c & 0x0F];
+    out += 3;
+  }
+  return out;
+}
+
+/*
+ * 编码 src 的 len 个字节写到 out，返回写出末尾。out 处须能容纳编码结果；
+ * 整块写出不会越过结果末尾：块内剩余的每个字节至少输出一个字节
+ */
+static char *encode_span(char *out, const char *input, size_t input_len, unsigned char bit,
+                         bool form) {
+  const unsigned char *src = (const unsigned char *)input;
+  size_t i = 0;
+#ifdef LQ_ENCODE_BLOCK
+  while (i + LQ_ENCODE_BLOCK <= input_len) {
+    // 逐个处理块内需要查表的字节，不重新计算位掩码；每段安全字符整块复制，
+    // 只前进该段的长度
+    size_t base = i;
+    uint32_t mask = encode_block_mask(input + base);
+    for (;;) {
+      memcpy(out, input + i, LQ_ENCODE_BLOCK);
+      if (LIKELY(mask == 0)) {
+        out += base + LQ_ENCODE_BLOCK - i;
+        i = base + LQ_ENCODE_BLOCK;
+        break;
+      }
+      size_t n = base + lq_ctz64(mask) - i;
+      out += n;
+      i += n;
+      out = encode_byte(out, src[i++], bit, form);
+      mask &= mask - 1;
+      if (i + LQ_ENCODE_BLOCK > input_len) break;
+    }
+  }
+  // 尾部不足一块：与最后一整块重叠判断，全部为未保留字符时一次复制
+  if (i < input_len && input_len >= LQ_ENCODE_BLOCK) {
+    size_t rest = input_len - i;
+    if (!(encode_block_mask(input + input_len - LQ_ENCODE_BLOCK) >> (LQ_ENCODE_BLOCK - rest))) {
+      memcpy(out, input + i, rest);
+      out += rest;
+      i = input_len;
+    }
+  }
+#endif
+  for (; i < input_len; i++) {
+    out = encode_byte(out, src[i], bit, form);
+  }
+
+  return out;
+}
+
+/* 计算去除两端空白后的范围：返回新长度，*lead 为前导空白数 */
+static LQ_ALWAYS_INLINE size_t trim_span(const char *str, size_t len, size_t *lead) {
+  size_t start = 0;
+  while (start < len && IS_SPACE(str[start])) start++;
+  while (len > start && IS_SPACE(str[len - 1])) len--;
+  *lead = start;
+  return len - start;
+}
+
+static int compare_keys(const char *a, size_t a_len, const char *b, size_t b_len) {
+  size_t min_len = a_len < b_len ? a_len : b_len;
+  int cmp = memcmp(a, b, min_len);
+  if (cmp != 0) return cmp;
+  return a_len < b_len ? -1 : (a_len > b_len ? 1 : 0);
+}
+
+/*
+ * 结构字符索引
+ *
+ * 阶段一：按 64 字节块对输入分类，生成 '&'、'='、'%'/'+' 三组位掩码；
+ * 阶段二：在位掩码上用位扫描定位键值对边界，不再逐字节检查键。
+ * 分类内核在每次解析开始时按 CPU 能力选择（AVX2 > SSE2 > 可移植内核），
+ * 可移植内核按 LLQUERY_USE_SWAR 选择 SWAR 或逐字节查表。
+ */
+#define LQ_BLOCK_SIZE 64
+
+typedef struct lq_block_masks {
+  uint64_t amp;  /* '&' 位置 */
+  uint64_t eq;   /* '=' 位置 */
+  uint64_t esc;  /* '%' 或 '+' 位置 */
+} lq_block_masks_t;
+
+typedef void (*lq_classify_fn)(const unsigned char *block, lq_block_masks_t *m);
+
+#ifndef LLQUERY_HAVE_SSE2
+#if LLQUERY_USE_SWAR
+static void classify_block_portable(const unsigned char *block, lq_block_masks_t *m) {
+  uint64_t amp = 0, eq = 0, esc = 0;
+  for (unsigned i = 0; i < LQ_BLOCK_SIZE; i += 8) {
+    uint64_t w = swar_load((const char *)block + i);
+    amp |= (uint64_t)swar_movemask(swar_eq(w, '&')) << i;
+    eq  |= (uint64_t)swar_movemask(swar_eq(w, '=')) << i;
+    esc |= (uint64_t)swar_movemask(swar_eq(w, '%') | swar_eq(w, '+')) << i;
+  }
+  m->amp = amp;
+  m->eq = eq;
+  m->esc = esc;
+}
+#else
+static void classify_block_portable(const unsigned char *block, lq_block_masks_t *m) {
+  uint64_t amp = 0, eq = 0, esc = 0;
+  for (unsigned i = 0; i < LQ_BLOCK_SIZE; i++) {
+    unsigned char f = char_flags[block[i]];
+    amp |= (uint64_t)((f & CHAR_SEPARATOR) != 0) << i;
+    eq  |= (uint64_t)((f & CHAR_EQUAL) != 0) << i;
+    esc |= (uint64_t)((f & (CHAR_PERCENT | CHAR_PLUS)) != 0) << i;
+  }
+  m->amp = amp;
+  m->eq = eq;
+  m->esc = esc;
+}
+#endif
+#endif
+
+#ifdef LLQUERY_HAVE_SSE2
+static void classify_block_sse2(const unsigned char *block, lq_block_masks_t *m) {
+  const __m128i amp_c = _mm_set1_epi8('&');
+  const __m128i eq_c = _mm_set1_epi8('=');
+  const __m128i pct_c = _mm_set1_epi8('%');
+  const __m128i plus_c = _mm_set1_epi8('+');
+  uint64_t amp = 0, eq = 0, esc = 0;
+
+  for (unsigned i = 0; i < LQ_BLOCK_SIZE; i += 16) {
+    __m128i v = _mm_loadu_si128((const __m128i *)(block + i));
+    __m128i e = _mm_or_si128(_mm_cmpeq_epi8(v, pct_c), _mm_cmpeq_epi8(v, plus_c));
+    amp |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, amp_c)) << i;
+    eq  |= (uint64_t)(uint16_t)_mm_movemask_epi8(_mm_cmpeq_epi8(v, eq_c)) << i;
+    esc |= (uint64_t)(uint16_t)_mm_movemask_epi8(e) << i;
+  }
+  m->amp = amp;
+  m->eq = eq;
+  m->esc = esc;
+}
+#endif
+
+#ifdef LLQUERY_HAVE_AVX2
+__attribute__((target("avx2")))
+static void classify_block_avx2(const unsigned char *block, lq_block_masks_t *m) {
+  const __m256i amp_c = _mm256_set1_epi8('&');
+  const __m256i eq_c = _mm256_set1_epi8('=');
+  const __m256i pct_c = _mm256_set1_epi8('%');
+  const __m256i plus_c = _mm256_set1_epi8('+');
+  uint64_t amp = 0, eq = 0, esc = 0;
+
+  for (unsigned i = 0; i < LQ_BLOCK_SIZE; i += 32) {
+    __m256i v = _mm256_loadu_si256((const __m256i *)(block + i));
+    __m256i e = _mm256_or_si256(_mm256_cmpeq_epi8(v, pct_c), _mm256_cmpeq_epi8(v, plus_c));
+    amp |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, amp_c)) << i;
+    eq  |= (uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, eq_c)) << i;
+    esc |= (uint64_t)(uint32_t)_mm256_movemask_epi8(e) << i;
+  }
+  m->amp = amp;
+  m->eq = eq;
+  m->esc = esc;
+}
+#endif
+
+/* 运行时选择分类内核（__builtin_cpu_supports 只读取 CPU 特性缓存，无全局可写状态） */
+static lq_classify_fn select_classifier(void) {
+#ifdef LLQUERY_HAVE_AVX2
+  if (__builtin_cpu_supports("avx2")) {
+    return classify_block_avx2;
+  }
+#endif
+#ifdef LLQUERY_HAVE_SSE2
+  return classify_block_sse2;
+#else
+  return classify_block_portable;
+#endif
+}
+
+typedef struct lq_scanner {
+  const char *base;          /* 输入起点 */
+  size_t len;                /* 输入长度 */
+  size_t block_pos;          /* 当前已分类块的起始偏移 */
+  lq_block_masks_t m;        /* 当前块的位掩码 */
+  lq_classify_fn classify;   /* 分类内核 */
+} lq_scanner_t;
+
+static void scanner_init(lq_scanner_t *s, const char *base, size_t len) {
+  s->base = base;
+  s->len = len;
+  s->block_pos = (size_t)-1;
+  s->classify = select_classifier();
+}
+
+static void scanner_load(lq_scanner_t *s, size_t block_pos) {
+  const unsigned char *p = (const unsigned char *)s->base + block_pos;
+  if (LIKELY(block_pos + LQ_BLOCK_SIZE <= s->len)) {
+    s->classify(p, &s->m);
+  } else {
+    // 尾部不足一块：补零后分类，补零字节不会命中任何结构字符
+    unsigned char tail[LQ_BLOCK_SIZE];
+    size_t n = s->len - block_pos;
+    memcpy(tail, p, n);
+    memset(tail + n, 0, LQ_BLOCK_SIZE - n);
+    s->classify(tail, &s->m);
+  }
+  s->block_pos = block_pos;
+}
+
+/*
+ * 从 pos 开始查找下一个 '&'（stop_at_eq 时也包括 '='），返回其偏移，
+ * 未找到返回输入长度。途经 '%'/'+' 时置位 *saw_esc。
+ */
+static size_t scanner_next(lq_scanner_t *s, size_t pos, bool stop_at_eq, bool *saw_esc) {
+  while (pos < s->len) {
+    size_t block_pos = pos & ~(size_t)(LQ_BLOCK_SIZE - 1);
+    if (block_pos != s->block_pos) {
+      scanner_load(s, block_pos);
+    }
+
+    uint64_t live = ~(uint64_t)0 << (pos - block_pos);
+    uint64_t hits = (s->m.amp | (stop_at_eq ? s->m.eq : 0)) & live;
+    if (LIKELY(hits != 0)) {
+      unsigned bit = lq_ctz64(hits);
+      if (s->m.esc & live & (((uint64_t)1 << bit) - 1)) {
+        *saw_esc = true;
+      }
+      return block_pos + bit;
+    }
+    if (s->m.esc & live) {
+      *saw_esc = true;
+    }
+    pos = block_pos + LQ_BLOCK_SIZE;
+  }
+  return s->len;
+}
+
+/* 公共API实现 */
+
+/*
+ * 写入键：解码或复制与小写合并为一遍，返回写入长度。dst 可以与 src 相同。
+ */
+static LQ_ALWAYS_INLINE size_t store_key(char *dst, const char *src, size_t len,
+                                         bool esc, const uint16_t flags) {
+  if (flags & LQF_LOWERCASE_KEYS) {
+    if (UNLIKELY(esc)) return decode_span_lower(dst, src, len);
+    copy_lower(dst, src, len);
+    return len;
+  }
+  if (UNLIKELY(esc)) return decode_span(dst, src, len);
+  if (dst != src) memcpy(dst, src, len);
+  return len;
+}
+
+/*
+ * 复制形式写入键值：原始片段解码或复制到 key_buf/val_buf 并以'\0'结尾，
+ * 同一遍中按选项小写键。去除值空白只移动指针：未转义的值在原始片段上计算范围，
+ * 转义的值解码后再计算，不再 memmove。
+ * 缓冲区至少为原始长度加 1，可与原始片段相同（原地解码）。key_buf 为 NULL 时键已是结果（驻留键）。
+ */
+static LQ_ALWAYS_INLINE void fill_pair(struct llquery_kv *kv, char *key_buf, char *val_buf,
+                                       bool key_esc, bool value_esc, const uint16_t flags) {
+  if (LIKELY(key_buf != NULL)) {
+    size_t key_len = store_key(key_buf, kv->key, kv->key_len, key_esc, flags);
+    key_buf[key_len] = '\0';
+    kv->key = key_buf;
+    kv->key_len = key_len;
+  }
+
+  size_t lead = 0;
+  size_t value_len = kv->value_len;
+  if (UNLIKELY(value_esc)) {
+    value_len = decode_span(val_buf, kv->value, value_len);
+    if (flags & LQF_TRIM_VALUES) value_len = trim_span(val_buf, value_len, &lead);
+  } else {
+    if (flags & LQF_TRIM_VALUES) value_len = trim_span(kv->value, value_len, &lead);
+    if (val_buf != kv->value) memcpy(val_buf + lead, kv->value + lead, value_len);
+  }
+  val_buf[lead + value_len] = '\0';
+  kv->value = val_buf + lead;
+  kv->value_len = value_len;
+}
+
+/*
+ * 按解析选项生成键值对：kv 中为原始片段，按需解码、小写键、去除值空白。
+ * 复制模式写入字符串池并以'\0'结尾；零拷贝模式只把需要改写的 token 写入解码缓冲区。
+ * 未转义的值为空（去空白后）且不保留空值时直接返回 value_len 为 0，不分配空间。
+ * key_done 表示键已引用驻留字符串，只需存储值。
+ * 先分配再写入，失败时 kv 保持原始片段不变。
+ */
+static LQ_ALWAYS_INLINE enum llquery_error store_pair(struct llquery *q,
+                                                      llquery_internal_t *internal,
+                                                      struct llquery_kv *kv,
+                                                      bool key_esc, bool value_esc,
+                                                      bool key_done,
+                                                      const uint16_t flags) {
+  if (!value_esc && !(flags & LQF_KEEP_EMPTY)) {
+    size_t lead = 0;
+    size_t value_len = kv->value_len;
+    if (flags & LQF_TRIM_VALUES) value_len = trim_span(kv->value, value_len, &lead);
+    if (UNLIKELY(value_len == 0)) {
+      kv->value_len = 0;
+      return LQE_OK;
+    }
+  }
+
+  if (flags & LQF_ZERO_COPY) {
+    bool lowercase = (flags & LQF_LOWERCASE_KEYS) != 0;
+
+    // 无需解码或改写的 token 直接引用输入
+    char *key_buf = NULL;
+    char *val_buf = NULL;
+    if (UNLIKELY(key_esc || lowercase) && !key_done) {
+      key_buf = side_alloc(q, internal, kv->key_len, internal->side_capacity);
+      if (UNLIKELY(!key_buf)) goto side_fail;
+    }
+    if (UNLIKELY(value_esc)) {
+      val_buf = side_alloc(q, internal, kv->value_len, internal->side_capacity);
+      if (UNLIKELY(!val_buf)) goto side_fail;
+    }
+
+    if (UNLIKELY(key_buf != NULL)) {
+      kv->key_len = store_key(key_buf, kv->key, kv->key_len, key_esc, flags);
+      kv->key = key_buf;
+    }
+    if (UNLIKELY(val_buf != NULL)) {
+      kv->value_len = decode_span(val_buf, kv->value, kv->value_len);
+      kv->value = val_buf;
+    }
+    if (flags & LQF_TRIM_VALUES) {
+      size_t lead;
+      kv->value_len = trim_span(kv->value, kv->value_len, &lead);
+      kv->value += lead;
+    }
+    return LQE_OK;
+
+  side_fail:
+    return internal->decode_buffer_owned || !q->decode_buffer ?
+           LQE_MEMORY_ERROR : LQE_BUFFER_TOO_SMALL;
+  }
+
+  // 阶段5优化：使用内存池分配 key 和 value
+  char *key_buf = key_done ? NULL : pool_alloc_string(internal, kv->key_len + 1);
+  char *val_buf = pool_alloc_string(internal, kv->value_len + 1);
+  if (UNLIKELY((!key_buf && !key_done) || !val_buf)) {
+    return LQE_MEMORY_ERROR;
+  }
+  fill_pair(kv, key_buf, val_buf, key_esc, value_esc, flags);
+  return LQE_OK;
+}
+
+/*
+ * 延迟模式：首次访问时生成键值对并缓存结果。
+ * 访问函数以 const 指针接收 llquery，缓存写入的是 llquery 自己管理的数据，
+ * 因此延迟模式下并发读取同一个实例需要调用方加锁。
+ */
+static bool lazy_materialize(const struct llquery *q, struct llquery_kv *kv) {
+  if (LIKELY(!(kv->_state & LQ_KV_PENDING))) {
+    return true;
+  }
+  struct llquery *mq = (struct llquery *)q;
+  llquery_internal_t *internal = get_internal(mq);
+  if (UNLIKELY(store_pair(mq, internal, kv, (kv->_state & LQ_KV_KEY_ESC) != 0,
+                          (kv->_state & LQ_KV_VALUE_ESC) != 0, kv->key_id != 0,
+                          q->flags) != LQE_OK)) {
+    return false;
+  }
+  kv->_state &= LQ_KV_DUP;
+  internal->lazy_pending--;
+  return true;
+}
+
+/* 生成全部未生成的键值对（排序、过滤、序列化、克隆前调用） */
+static bool lazy_materialize_all(const struct llquery *q) {
+  llquery_internal_t *internal = (llquery_internal_t *)q->_reserved;
+  if (LIKELY(!internal || internal->lazy_pending == 0)) {
+    return true;
+  }
+  for (uint32_t i = 0; i < internal->kv_count; i++) {
+    if (!lazy_materialize(q, &q->kv_pairs[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * 比较键名。延迟模式下原始键需要解码时先生成该键值对；
+ * 只需小写的原始键逐字节转小写后比较，不必生成。
+ */
+static bool key_matches(const struct llquery *q, struct llquery_kv *kv,
+                        const char *key, size_t key_len) {
+  if (UNLIKELY(kv->_state & LQ_KV_PENDING)) {
+    if (kv->_state & LQ_KV_KEY_ESC) {
+      if (!lazy_materialize(q, kv)) {
+        return false;
+      }
+    } else if (q->flags & LQF_LOWERCASE_KEYS) {
+      if (kv->key_len != key_len) {
+        return false;
+      }
+      for (size_t i = 0; i < key_len; i++) {
+        if (LQ_FOLD_LOWER(kv->key[i]) != (unsigned char)key[i]) {
+          return false;
+        }
+      }
+      return true;
+    }
+  }
+  return kv->key_len == key_len && memcmp(kv->key, key, key_len) == 0;
+}
+
+/*
+ * 键哈希索引
+ *
+ * 键哈希使用以解析器随机种子为密钥的 SipHash-1-3，构造的键无法批量碰撞。
+ * 索引在首次按键查找时建立，结果变化（解析、过滤、排序）后失效；
+ * 延迟模式下只需小写的原始键按小写字节计算哈希，无需生成。
+ */
+#define LQ_ROTL64(x, b) (uint64_t)(((x) << (b)) | ((x) >> (64 - (b))))
+#define LQ_SIPROUND(v0, v1, v2, v3) do { \
+    v0 += v1; v1 = LQ_ROTL64(v1, 13); v1 ^= v0; v0 = LQ_ROTL64(v0, 32); \
+    v2 += v3; v3 = LQ_ROTL64(v3, 16); v3 ^= v2; \
+    v0 += v3; v3 = LQ_ROTL64(v3, 21); v3 ^= v0; \
+    v2 += v1; v1 = LQ_ROTL64(v1, 17); v1 ^= v2; v2 = LQ_ROTL64(v2, 32); \
+  } while (0)
+
+static uint64_t key_hash(const uint64_t seed[2], const char *key, size_t len, bool fold) {
+  uint64_t v0 = 0x736f6d6570736575ULL ^ seed[0];
+  uint64_t v1 = 0x646f72616e646f6dULL ^ seed[1];
+  uint64_t v2 = 0x6c7967656e657261ULL ^ seed[0];
+  uint64_t v3 = 0x7465646279746573ULL ^ seed[1];
+  const unsigned char *p = (const unsigned char *)key;
+  size_t left = len;
+
+  while (left >= 8) {
+    uint64_t m;
+    if (LIKELY(!fold)) {
+      memcpy(&m, p, 8);
+    } else {
+      unsigned char w[8];
+      for (int i = 0; i < 8; i++) w[i] = LQ_FOLD_LOWER(p[i]);
+      memcpy(&m, w, 8);
+    }
+    v3 ^= m;
+    LQ_SIPROUND(v0, v1, v2, v3);
+    v0 ^= m;
+    p += 8;
+    left -= 8;
+  }
+
+  unsigned char tail[8] = {0};
+  for (size_t i = 0; i < left; i++) {
+    tail[i] = fold ? LQ_FOLD_LOWER(p[i]) : p[i];
+  }
+  uint64_t b;
+  memcpy(&b, tail, 8);
+  b ^= (uint64_t)len << 56;
+  v3 ^= b;
+  LQ_SIPROUND(v0, v1, v2, v3);
+  v0 ^= b;
+
+  v2 ^= 0xff;
+  LQ_SIPROUND(v0, v1, v2, v3);
+  LQ_SIPROUND(v0, v1, v2, v3);
+  LQ_SIPROUND(v0, v1, v2, v3);
+  return v0 ^ v1 ^ v2 ^ v3;
+}
+
+static LQ_ALWAYS_INLINE uint64_t splitmix64(uint64_t *x) {
+  uint64_t z = (*x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+/* 从操作系统取随机字节，失败返回 false */
+static bool os_entropy(void *buf, size_t len) {
+#if defined(LQ_HAVE_GETRANDOM)
+  unsigned char *p = (unsigned char *)buf;
+  while (len > 0) {
+    ssize_t n = getrandom(p, len, 0);
+    if (n <= 0) break;  // 被信号中断或系统调用不可用时改读 /dev/urandom
+    p += n;
+    len -= (size_t)n;
+  }
+  if (len == 0) return true;
+  buf = p;
+#elif defined(LQ_HAVE_ARC4RANDOM)
+  arc4random_buf(buf, len);
+  return true;
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+  FILE *f = fopen("/dev/urandom", "rb");
+  if (f) {
+    setvbuf(f, NULL, _IONBF, 0);
+    size_t got = fread(buf, 1, len, f);
+    fclose(f);
+    if (got == len) return true;
+  }
+#endif
+  (void)buf;
+  (void)len;
+  return false;
+}
+
+/* 进程级哈希密钥：首次使用时从操作系统熵源取一次并缓存。
+ * 并发初始化时各线程写入的都是随机值，结果仍不可预测。
+ * 没有熵源时退回地址、时间与时钟的混合。 */
+static uint64_t lq_seed_key[2];
+static int lq_seed_ready;
+
+static void seed_key_get(uint64_t key[2]) {
+#if defined(__GNUC__) || defined(__clang__)
+  if (LIKELY(__atomic_load_n(&lq_seed_ready, __ATOMIC_ACQUIRE))) {
+    key[0] = __atomic_load_n(&lq_seed_key[0], __ATOMIC_RELAXED);
+    key[1] = __atomic_load_n(&lq_seed_key[1], __ATOMIC_RELAXED);
+    return;
+  }
+#else
+  if (lq_seed_ready) {
+    key[0] = lq_seed_key[0];
+    key[1] = lq_seed_key[1];
+    return;
+  }
+#endif
+  uint64_t k[2];
+  if (!os_entropy(k, sizeof(k))) {
+    uint64_t x = (uint64_t)(uintptr_t)&lq_seed_key ^ ((uint64_t)(uintptr_t)&x << 31) ^
+                 (uint64_t)time(NULL) ^ ((uint64_t)clock() << 40);
+    k[0] = splitmix64(&x);
+    k[1] = splitmix64(&x);
+  }
+#if defined(__GNUC__) || defined(__clang__)
+  __atomic_store_n(&lq_seed_key[0], k[0], __ATOMIC_RELAXED);
+  __atomic_store_n(&lq_seed_key[1], k[1], __ATOMIC_RELAXED);
+  __atomic_store_n(&lq_seed_ready, 1, __ATOMIC_RELEASE);
+#else
+  lq_seed_key[0] = k[0];
+  lq_seed_key[1] = k[1];
+  lq_seed_ready = 1;
+#endif
+  key[0] = k[0];
+  key[1] = k[1];
+}
+
+/* 每个对象的种子 = 进程级密钥混入所属对象地址，解析器之间互不相同 */
+static void hash_seed_init(uint64_t seed[2], const void *a, const void *b) {
+  uint64_t key[2];
+  seed_key_get(key);
+  uint64_t x = key[0] ^ (uint64_t)(uintptr_t)a ^ ((uint64_t)(uintptr_t)b << 17);
+  seed[0] = splitmix64(&x);
+  seed[1] = splitmix64(&x) ^ key[1];
+}
+
+/* 延迟模式下只需小写的原始键按小写比较 */
+static LQ_ALWAYS_INLINE bool key_folds(const struct llquery *q, const struct llquery_kv *kv) {
+  return (kv->_state & LQ_KV_PENDING) && (q->flags & LQF_LOWERCASE_KEYS);
+}
+
+/* 比较两个键值对的键（建立索引时使用，含转义的原始键已先生成） */
+static bool kv_keys_equal(const struct llquery *q, const struct llquery_kv *a,
+                          const struct llquery_kv *b) {
+  if (a->key_id && b->key_id) {
+    // 同一驻留表中的键：ID 相同当且仅当键相同
+    return a->key_id == b->key_id;
+  }
+  if (a->key_len != b->key_len) {
+    return false;
+  }
+  bool fa = key_folds(q, a);
+  bool fb = key_folds(q, b);
+  if (!fa && !fb) {
+    return memcmp(a->key, b->key, a->key_len) == 0;
+  }
+  for (size_t i = 0; i < a->key_len; i++) {
+    unsigned char ca = (unsigned char)a->key[i];
+    unsigned char cb = (unsigned char)b->key[i];
+    if ((fa ? LQ_FOLD_LOWER(ca) : ca) != (fb ? LQ_FOLD_LOWER(cb) : cb)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/* 释放键哈希索引 */
+static void index_release(llquery_internal_t *internal) {
+  if (internal->index_slots) {
+    internal->free_fn(internal->index_slots, internal->alloc_data);
+    internal->index_slots = NULL;
+  }
+  if (internal->index_next) {
+    internal->free_fn(internal->index_next, internal->alloc_data);
+    internal->index_next = NULL;
+  }
+  internal->index_mask = 0;
+  internal->index_next_cap = 0;
+  internal->index_valid = false;
+  if (internal->ci_slots) {
+    internal->free_fn(internal->ci_slots, internal->alloc_data);
+    internal->ci_slots = NULL;
+  }
+  internal->ci_mask = 0;
+  internal->ci_valid = false;
+}
+
+/* 建立键哈希索引；内存不足时返回 false，调用方回退到线性查找 */
+static bool index_build(const struct llquery *q, llquery_internal_t *internal) {
+  uint32_t n = internal->kv_count;
+
+  // 负载因子不超过 1/2，容量跨 reset 保留
+  uint32_t slots = 32;
+  while (slots / 2 < n) {
+    if (slots > UINT32_MAX / 2) return false;
+    slots *= 2;
+  }
+  if (slots - 1 > internal->index_mask) {
+    if (internal->index_slots) {
+      internal->free_fn(internal->index_slots, internal->alloc_data);
+    }
+    internal->index_slots = internal->alloc_fn(sizeof(lq_index_slot_t) * slots,
+                                               internal->alloc_data);
+    if (UNLIKELY(!internal->index_slots)) {
+      internal->index_mask = 0;
+      return false;
+    }
+    internal->index_mask = slots - 1;
+  }
+  if (n > internal->index_next_cap) {
+    if (internal->index_next) {
+      internal->free_fn(internal->index_next, internal->alloc_data);
+    }
+    internal->index_next = internal->alloc_fn(sizeof(uint32_t) * n, internal->alloc_data);
+    if (UNLIKELY(!internal->index_next)) {
+      internal->index_next_cap = 0;
+      return false;
+    }
+    internal->index_next_cap = n;
+  }
+
+  lq_index_slot_t *table = internal->index_slots;
+  uint32_t mask = internal->index_mask;
+  memset(table, 0xFF, sizeof(lq_index_slot_t) * ((size_t)mask + 1));
+
+  for (uint32_t i = 0; i < n; i++) {
+    struct llquery_kv *kv = &q->kv_pairs[i];
+    if (UNLIKELY((kv->_state & LQ_KV_PENDING) && (kv->_state & LQ_KV_KEY_ESC)) &&
+        !lazy_materialize(q, kv)) {
+      return false;
+    }
+
+    uint32_t h = (uint32_t)key_hash(internal->hash_seed, kv->key, kv->key_len,
+                                    key_folds(q, kv));
+    uint32_t pos = h & mask;
+    internal->index_next[i] = LQ_NPOS;
+    for (;;) {
+      lq_index_slot_t *slot = &table[pos];
+      if (slot->head == LQ_NPOS) {
+        slot->hash = h;
+        slot->head = i;
+        slot->tail = i;
+        kv->_state &= (uint8_t)~LQ_KV_DUP;
+        break;
+      }
+      if (slot->hash == h && kv_keys_equal(q, &q->kv_pairs[slot->head], kv)) {
+        internal->index_next[slot->tail] = i;
+        slot->tail = i;
+        kv->_state |= LQ_KV_DUP;
+        break;
+      }
+      pos = (pos + 1) & mask;
+    }
+  }
+
+  internal->index_valid = true;
+  return true;
+}
+
+/* 在索引中查找键，返回同键链表首个下标 */
+static uint32_t index_find(const struct llquery *q, const llquery_internal_t *internal,
+                           const char *key, size_t key_len) {
+  uint32_t h = (uint32_t)key_hash(internal->hash_seed, key, key_len, false);
+  uint32_t mask = internal->index_mask;
+  const lq_index_slot_t *table = internal->index_slots;
+
+  for (uint32_t pos = h & mask; table[pos].head != LQ_NPOS; pos = (pos + 1) & mask) {
+    if (table[pos].hash == h &&
+        key_matches(q, &q->kv_pairs[table[pos].head], key, key_len)) {
+      return table[pos].head;
+    }
+  }
+  return LQ_NPOS;
+}
+
+/*
+ * 忽略大小写的键查找
+ *
+ * 原始键保持不变，只在比较和计算哈希时按 LQ_FOLD_LOWER 折叠两侧。
+ * 与按键查找相同，线性查找累计量足够后建立按折叠键哈希的独立索引，
+ * 结果变化后失效。
+ */
+static bool keys_equal_ci(const char *a, const char *b, size_t len) {
+  if (len < 8) {
+    for (size_t i = 0; i < len; i++) {
+      if (LQ_FOLD_LOWER(a[i]) != LQ_FOLD_LOWER(b[i])) return false;
+    }
+    return true;
+  }
+  // 按 8 字节比较，最后一个字可能与前一个重叠
+  uint64_t wa, wb;
+  for (size_t i = 0; i + 8 < len; i += 8) {
+    memcpy(&wa, a + i, 8);
+    memcpy(&wb, b + i, 8);
+    if (wa != wb && fold_word(wa) != fold_word(wb)) return false;
+  }
+  memcpy(&wa, a + len - 8, 8);
+  memcpy(&wb, b + len - 8, 8);
+  return wa == wb || fold_word(wa) == fold_word(wb);
+}
+
+/* 忽略大小写比较键名；含转义的原始键先生成 */
+static bool key_matches_ci(const struct llquery *q, struct llquery_kv *kv,
+                           const char *key, size_t key_len) {
+  if (UNLIKELY((kv->_state & LQ_KV_PENDING) && (kv->_state & LQ_KV_KEY_ESC)) &&
+      !lazy_materialize(q, kv)) {
+    return false;
+  }
+  return kv->key_len == key_len && keys_equal_ci(kv->key, key, key_len);
+}
+
+/* 建立忽略大小写的键索引；内存不足时返回 false */
+static bool ci_index_build(const struct llquery *q, llquery_internal_t *internal) {
+  uint32_t n = internal->kv_count;
+  uint32_t slots = 32;
+  while (slots / 2 < n) {
+    if (slots > UINT32_MAX / 2) return false;
+    slots *= 2;
+  }
+  if (slots - 1 > internal->ci_mask) {
+    if (internal->ci_slots) {
+      internal->free_fn(internal->ci_slots, internal->alloc_data);
+    }
+    internal->ci_slots = internal->alloc_fn(sizeof(lq_index_slot_t) * slots,
+                                            internal->alloc_data);
+    if (UNLIKELY(!internal->ci_slots)) {
+      internal->ci_mask = 0;
+      return false;
+    }
+    internal->ci_mask = slots - 1;
+  }
+
+  lq_index_slot_t *table = internal->ci_slots;
+  uint32_t mask = internal->ci_mask;
+  memset(table, 0xFF, sizeof(lq_index_slot_t) * ((size_t)mask + 1));
+
+  for (uint32_t i = 0; i < n; i++) {
+    struct llquery_kv *kv = &q->kv_pairs[i];
+    if (UNLIKELY((kv->_state & LQ_KV_PENDING) && (kv->_state & LQ_KV_KEY_ESC)) &&
+        !lazy_materialize(q, kv)) {
+      return false;
+    }
+    uint32_t h = (uint32_t)key_hash(internal->hash_seed, kv->key, kv->key_len, true);
+    uint32_t pos = h & mask;
+    while (table[pos].head != LQ_NPOS) {
+      const struct llquery_kv *first = &q->kv_pairs[table[pos].head];
+      if (table[pos].hash == h && first->key_len == kv->key_len &&
+          keys_equal_ci(first->key, kv->key, kv->key_len)) {
+        break;
+      }
+      pos = (pos + 1) & mask;
+    }
+    if (table[pos].head == LQ_NPOS) {
+      table[pos].hash = h;
+      table[pos].head = i;
+      table[pos].tail = i;
+    }
+  }
+
+  internal->ci_valid = true;
+  return true;
+}
+
+/* 忽略大小写查找第一个匹配键的下标，未找到返回 LQ_NPOS */
+static uint32_t find_key_index_ci(const struct llquery *q, const char *key, size_t key_len) {
+  llquery_internal_t *internal = (llquery_internal_t *)q->_reserved;
+  uint32_t n = kv_count(q);
+
+  if (internal && !internal->ci_valid && n >= LQ_INDEX_MIN_PAIRS &&
+      (uint64_t)internal->ci_scan_work >= (uint64_t)n * LQ_INDEX_SCAN_RATIO) {
+    ci_index_build(q, internal);
+  }
+  if (internal && internal->ci_valid) {
+    uint32_t h = (uint32_t)key_hash(internal->hash_seed, key, key_len, true);
+    uint32_t mask = internal->ci_mask;
+    const lq_index_slot_t *table = internal->ci_slots;
+    for (uint32_t pos = h & mask; table[pos].head != LQ_NPOS; pos = (pos + 1) & mask) {
+      const struct llquery_kv *kv = &q->kv_pairs[table[pos].head];
+      if (table[pos].hash == h && kv->key_len == key_len &&
+          keys_equal_ci(kv->key, key, key_len)) {
+        return table[pos].head;
+      }
+    }
+    return LQ_NPOS;
+  }
+
+  uint32_t i = 0;
+  while (i < n && !key_matches_ci(q, &q->kv_pairs[i], key, key_len)) {
+    i++;
+  }
+  if (internal) {
+    uint32_t work = i < n ? i + 1 : n;
+    internal->ci_scan_work = work > UINT32_MAX - internal->ci_scan_work ?
+                             UINT32_MAX : internal->ci_scan_work + work;
+  }
+  return i < n ? i : LQ_NPOS;
+}
+
+/*
+ * 小查询键表
+ *
+ * 键值对少于 LQ_INDEX_MIN_PAIRS 时哈希索引得不偿失，改用并列的签名数组：
+ * 每个键取前 8 字节，不足 8 字节时第 8 字节存长度。查找时一次比较
+ * 多个签名筛出候选，只对候选调用 key_matches() 确认。
+ */
+static LQ_ALWAYS_INLINE uint64_t load_u32(const char *p) {
+  uint32_t v;
+  memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+static LQ_ALWAYS_INLINE uint64_t key_sig(const char *key, size_t len, bool fold) {
+  // 延迟模式下只需小写的原始键：先把前 8 字节转小写，再按相同方式计算
+  char folded[8];
+  if (UNLIKELY(fold)) {
+    size_t n = len < 8 ? len : 8;
+    for (size_t i = 0; i < n; i++) folded[i] = (char)LQ_FOLD_LOWER((unsigned char)key[i]);
+    key = folded;
+  }
+
+  // 不足 8 字节时用重叠读取拼接，避免逐字节复制；签名只用于筛选，
+  // 相同的键总得到相同的签名即可
+  uint64_t sig;
+  if (len >= 8) {
+    memcpy(&sig, key, sizeof(sig));
+    return sig;
+  }
+  if (len >= 4) {
+    sig = load_u32(key) | (load_u32(key + len - 4) << (8 * (len - 4)));
+  } else if (len > 0) {
+    sig = (uint64_t)(unsigned char)key[0] |
+          ((uint64_t)(unsigned char)key[len / 2] << (8 * (len / 2))) |
+          ((uint64_t)(unsigned char)key[len - 1] << (8 * (len - 1)));
+  } else {
+    sig = 0;
+  }
+  return sig | ((uint64_t)len << 56);
+}
+
+static void keytab_build(const struct llquery *q, llquery_internal_t *internal) {
+  uint32_t wild = 0;
+  for (uint32_t i = 0; i < internal->kv_count; i++) {
+    const struct llquery_kv *kv = &q->kv_pairs[i];
+    if (UNLIKELY((kv->_state & LQ_KV_PENDING) && (kv->_state & LQ_KV_KEY_ESC))) {
+      wild |= 1u << i;
+      internal->keytab_sig[i] = 0;
+    } else {
+      internal->keytab_sig[i] = key_sig(kv->key, kv->key_len, key_folds(q, kv));
+    }
+  }
+  internal->keytab_wild = wild;
+  internal->keytab_valid = true;
+}
+
+/* 在键表中查找 start 之后第一个匹配键的下标 */
+static uint32_t keytab_find(const struct llquery *q, const llquery_internal_t *internal,
+                            uint32_t start, const char *key, size_t key_len) {
+  uint64_t needle = key_sig(key, key_len, false);
+  uint32_t n = internal->kv_count;
+  uint32_t cand = 0;
+
+#ifdef LLQUERY_HAVE_SSE2
+  // 每次比较两个签名；数组长度固定为 LQ_INDEX_MIN_PAIRS，末尾越过 n 的位随后屏蔽
+  const __m128i nv = _mm_set1_epi64x((long long)needle);
+  for (uint32_t i = 0; i < n; i += 2) {
+    __m128i v = _mm_loadu_si128((const __m128i *)&internal->keytab_sig[i]);
+    unsigned m = (unsigned)_mm_movemask_epi8(_mm_cmpeq_epi8(v, nv));
+    cand |= (((m & 0xFFu) == 0xFFu ? 1u : 0u) | ((m >> 8) == 0xFFu ? 2u : 0u)) << i;
+  }
+#else
+  for (uint32_t i = 0; i < n; i++) {
+    cand |= (internal->keytab_sig[i] == needle ? 1u : 0u) << i;
+  }
+#endif
+
+  cand = (cand | internal->keytab_wild) & ((1u << n) - 1) & ~((1u << start) - 1);
+  while (cand) {
+    uint32_t i = lq_ctz64(cand);
+    if (key_matches(q, &q->kv_pairs[i], key, key_len)) {
+      return i;
+    }
+    cand &= cand - 1;
+  }
+  return LQ_NPOS;
+}
+
+/* 按键分组需要的索引：无论数量多少都建立，内存不足时返回 NULL */
+static llquery_internal_t *group_index(const struct llquery *q) {
+  llquery_internal_t *internal = (llquery_internal_t *)q->_reserved;
+  if (!internal || (!internal->index_valid && !index_build(q, internal))) {
+    return NULL;
+  }
+  return internal;
+}
+
+/*
+ * 稳定排序
+ *
+ * 对 (键前缀, 下标) 数组排序后按下标重排键值对。默认比较先比较缓存的
+ * 8 字节大端前缀，相等时才比较完整的键；小段用插入排序，再自底向上归并。
+ * 不超过 16 个键值对或辅助内存分配失败时使用原地插入排序。
+ */
+typedef struct lq_sort_item {
+  uint64_t prefix;
+  uint32_t index;
+} lq_sort_item_t;
+
+#define LQ_SORT_RUN 16  /* 插入排序的段长 */
+
+static uint64_t key_prefix_be(const char *key, size_t len) {
+  uint64_t p = 0;
+  size_t n = len < 8 ? len : 8;
+  for (size_t i = 0; i < n; i++) {
+    p |= (uint64_t)(unsigned char)key[i] << (56 - 8 * i);
+  }
+  return p;
+}
+
+static LQ_ALWAYS_INLINE int sort_cmp(const struct llquery_kv *pairs, llquery_compare_cb compare_fn,
+                                     const lq_sort_item_t *a, const lq_sort_item_t *b) {
+  const struct llquery_kv *ka = &pairs[a->index];
+  const struct llquery_kv *kb = &pairs[b->index];
+  if (compare_fn) {
+    return compare_fn(ka, kb);
+  }
+  if (a->prefix != b->prefix) {
+    return a->prefix < b->prefix ? -1 : 1;
+  }
+  return compare_keys(ka->key, ka->key_len, kb->key, kb->key_len);
+}
+
+static void sort_items(const struct llquery_kv *pairs, llquery_compare_cb compare_fn,
+                       lq_sort_item_t *items, lq_sort_item_t *tmp, uint32_t n) {
+  // 插入排序生成有序段
+  for (uint32_t base = 0; base < n; base += LQ_SORT_RUN) {
+    uint32_t end = base + LQ_SORT_RUN < n ? base + LQ_SORT_RUN : n;
+    for (uint32_t i = base + 1; i < end; i++) {
+      lq_sort_item_t item = items[i];
+      uint32_t j = i;
+      while (j > base && sort_cmp(pairs, compare_fn, &items[j - 1], &item) > 0) {
+        items[j] = items[j - 1];
+        j--;
+      }
+      items[j] = item;
+    }
+  }
+
+  // 自底向上归并，相等时取左段保持稳定
+  lq_sort_item_t *src = items;
+  lq_sort_item_t *dst = tmp;
+  for (uint32_t width = LQ_SORT_RUN; width < n; width *= 2) {
+    for (uint32_t lo = 0; lo < n; lo += 2 * width) {
+      uint32_t mid = lo + width < n ? lo + width : n;
+      uint32_t hi = mid + width < n ? mid + width : n;
+      uint32_t i = lo, j = mid, k = lo;
+      while (i < mid && j < hi) {
+        dst[k++] = sort_cmp(pairs, compare_fn, &src[j], &src[i]) < 0 ? src[j++] : src[i++];
+      }
+      while (i < mid) dst[k++] = src[i++];
+      while (j < hi) dst[k++] = src[j++];
+    }
+    lq_sort_item_t *swap = src;
+    src = dst;
+    dst = swap;
+    if (width > UINT32_MAX / 2) break;
+  }
+  if (src != items) {
+    memcpy(items, src, sizeof(lq_sort_item_t) * n);
+  }
+}
+
+/* 原地稳定插入排序 */
+static void sort_pairs_inplace(struct llquery_kv *pairs, uint32_t n, llquery_compare_cb compare_fn) {
+  for (uint32_t i = 1; i < n; i++) {
+    struct llquery_kv kv = pairs[i];
+    uint32_t j = i;
+    while (j > 0 && (compare_fn ? compare_fn(&pairs[j - 1], &kv)
+                                : compare_keys(pairs[j - 1].key, pairs[j - 1].key_len,
+                                               kv.key, kv.key_len)) > 0) {
+      pairs[j] = pairs[j - 1];
+      j--;
+    }
+    pairs[j] = kv;
+  }
+}
+
+static enum llquery_error sort_pairs(struct llquery *q, llquery_internal_t *internal,
+                                     llquery_compare_cb compare_fn) {
+  uint32_t n = internal->kv_count;
+  if (!lazy_materialize_all(q)) {
+    return LQE_MEMORY_ERROR;
+  }
+  lookup_invalidate(internal);
+
+  if (n <= LQ_SORT_RUN) {
+    // 小结果直接原地插入排序，不分配辅助数组
+    sort_pairs_inplace(q->kv_pairs, n, compare_fn);
+  } else {
+    size_t item_bytes = sizeof(lq_sort_item_t) * (size_t)n;
+    lq_sort_item_t *items = internal->alloc_fn(item_bytes * 2, internal->alloc_data);
+    struct llquery_kv *sorted = items ?
+        internal->alloc_fn(sizeof(struct llquery_kv) * (size_t)n, internal->alloc_data) : NULL;
+
+    if (LIKELY(sorted != NULL)) {
+      for (uint32_t i = 0; i < n; i++) {
+        items[i].prefix = compare_fn ? 0 : key_prefix_be(q->kv_pairs[i].key, q->kv_pairs[i].key_len);
+        items[i].index = i;
+      }
+      sort_items(q->kv_pairs, compare_fn, items, items + n, n);
+      for (uint32_t i = 0; i < n; i++) {
+        sorted[i] = q->kv_pairs[items[i].index];
+      }
+      memcpy(q->kv_pairs, sorted, sizeof(struct llquery_kv) * (size_t)n);
+      internal->free_fn(sorted, internal->alloc_data);
+    } else {
+      sort_pairs_inplace(q->kv_pairs, n, compare_fn);
+    }
+    if (items) {
+      internal->free_fn(items, internal->alloc_data);
+    }
+  }
+
+  // 只有按键名的默认顺序才能用于二分查找
+  internal->kv_sorted = compare_fn == NULL;
+  return LQE_OK;
+}
+
+/* 解析完成后的处理：LQF_SORT_KEYS 排序，LQF_MERGE_DUPLICATES 按键分组 */
+static enum llquery_error parse_finish(struct llquery *q, llquery_internal_t *internal) {
+  // 槽位已在解析时填好；排序会使其失效，访问时重新填充
+  internal->slots_valid = internal->schema != NULL;
+  if (q->flags & LQF_SORT_KEYS) {
+    enum llquery_error err = sort_pairs(q, internal, NULL);
+    if (UNLIKELY(err != LQE_OK)) {
+      return err;
+    }
+  }
+  if (q->flags & LQF_MERGE_DUPLICATES) {
+    index_build(q, internal);
+  }
+  return LQE_OK;
+}
+
+/*
+ * 返回可用的索引，否则返回 NULL 由调用方线性查找。
+ * 建立索引的开销约等于多次线性查找，因此只在同一结果上
+ * 线性扫描的累计量足以抵消建立开销后才建立。
+ */
+static llquery_internal_t *lookup_index(const struct llquery *q) {
+  llquery_internal_t *internal = (llquery_internal_t *)q->_reserved;
+  if (!internal) {
+    return NULL;
+  }
+  if (internal->index_valid || (q->flags & LQF_MERGE_DUPLICATES)) {
+    return group_index(q);
+  }
+  if (internal->kv_sorted) {
+    // 有序结果由 scan_key_index() 二分查找
+    return NULL;
+  }
+  if (internal->kv_count < LQ_INDEX_MIN_PAIRS) {
+    // 小查询：同一结果上第二次查找起使用键表
+    if (!internal->keytab_valid && internal->scan_work >= internal->kv_count) {
+      keytab_build(q, internal);
+    }
+    return NULL;
+  }
+  if (LIKELY(internal->index_valid)) {
+    return internal;
+  }
+  if ((uint64_t)internal->scan_work < (uint64_t)internal->kv_count * LQ_INDEX_SCAN_RATIO ||
+      !index_build(q, internal)) {
+    return NULL;
+  }
+  return internal;
+}
+
+/*
+ * 键模式
+ *
+ * 哈希按 8 字节读取键，不足 8 字节的尾部复用 key_sig()（含长度）。
+ * 64 位哈希的高 32 位选桶，整个哈希与桶的位移混合后选项。
+ */
+#define LQ_SCHEMA_BUCKET_SIZE 4      /* 平均每桶键数 */
+#define LQ_SCHEMA_MAX_DISP    65535  /* 位移搜索上限，超过后换种子重建 */
+#define LQ_SCHEMA_SEED_TRIES  16     /* 64 位键哈希碰撞时换种子的次数 */
+#define LQ_SCHEMA_MAX_KEYS    (1u << 30)
+
+static LQ_ALWAYS_INLINE uint64_t schema_hash(uint64_t seed, const char *key, size_t len) {
+  uint64_t h = seed ^ ((uint64_t)len * 0x9E3779B97F4A7C15ULL);
+  while (len >= 8) {
+    uint64_t w;
+    memcpy(&w, key, 8);
+    h = (h ^ w) * 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 29;
+    key += 8;
+    len -= 8;
+  }
+  if (len > 0) {
+    h = (h ^ key_sig(key, len, false)) * 0xBF58476D1CE4E5B9ULL;
+  }
+  h = (h ^ (h >> 32)) * 0x94D049BB133111EBULL;
+  return h ^ (h >> 29);
+}
+
+static LQ_ALWAYS_INLINE uint32_t schema_bucket(uint64_t h, uint32_t bucket_count) {
+  return (uint32_t)(((h >> 32) * bucket_count) >> 32);
+}
+
+static LQ_ALWAYS_INLINE uint32_t schema_pos(uint64_t h, uint32_t d, uint32_t mask) {
+  uint64_t x = h ^ ((uint64_t)d * 0x9E3779B97F4A7C15ULL);
+  x = (x ^ (x >> 32)) * 0xD6E8FEB86659FD93ULL;
+  return (uint32_t)(x >> 32) & mask;
+}
+
+/* 返回键的槽位，不在模式中返回 LQ_NPOS */
+static LQ_ALWAYS_INLINE uint32_t schema_find(const struct llquery_schema *schema,
+                                             const char *key, size_t key_len) {
+  uint64_t h = schema_hash(schema->seed, key, key_len);
+  uint32_t d = schema->disp[schema_bucket(h, schema->bucket_count)];
+  const lq_schema_entry_t *e = &schema->entries[schema_pos(h, d, schema->mask)];
+  if (e->key && e->key_len == key_len && memcmp(e->key, key, key_len) == 0) {
+    return e->slot;
+  }
+  return LQ_NPOS;
+}
+
+/* 清空槽位（开始新的解析） */
+static void slots_clear(llquery_internal_t *internal) {
+  uint32_t n = internal->schema->key_count;
+  for (uint32_t i = 0; i < n; i++) {
+    internal->slot_first[i] = LQ_NPOS;
+  }
+  internal->unknown_count = 0;
+}
+
+/* 延迟模式下键需要解码或小写时先生成该键值对，使键可以直接比较 */
+static LQ_ALWAYS_INLINE bool schema_key_ready(const struct llquery *q, struct llquery_kv *kv) {
+  if (UNLIKELY(kv->_state & LQ_KV_PENDING) &&
+      ((kv->_state & LQ_KV_KEY_ESC) || (q->flags & LQF_LOWERCASE_KEYS))) {
+    return lazy_materialize(q, kv);
+  }
+  return true;
+}
+
+/* 解析时把新的键值对记入槽位，*keep 为 false 表示按 LQS_DROP_UNKNOWN 丢弃 */
+static enum llquery_error schema_assign(struct llquery *q, llquery_internal_t *internal,
+                                        struct llquery_kv *kv, uint32_t index, bool *keep) {
+  const struct llquery_schema *schema = internal->schema;
+  if (UNLIKELY(!schema_key_ready(q, kv))) {
+    return LQE_MEMORY_ERROR;
+  }
+
+  *keep = true;
+  uint32_t slot = schema_find(schema, kv->key, kv->key_len);
+  if (LIKELY(slot != LQ_NPOS)) {
+    if (internal->slot_first[slot] == LQ_NPOS) {
+      internal->slot_first[slot] = index;
+    }
+  } else {
+    internal->unknown_count++;
+    if (schema->flags & LQS_DROP_UNKNOWN) {
+      if (kv->_state & LQ_KV_PENDING) {
+        internal->lazy_pending--;
+      }
+      *keep = false;
+    }
+  }
+  return LQE_OK;
+}
+
+/* 排序、过滤等改变下标后按当前结果重新填充槽位（不改变未知键计数） */
+static bool slots_build(const struct llquery *q, llquery_internal_t *internal) {
+  const struct llquery_schema *schema = internal->schema;
+  for (uint32_t i = 0; i < schema->key_count; i++) {
+    internal->slot_first[i] = LQ_NPOS;
+  }
+  for (uint32_t i = 0; i < internal->kv_count; i++) {
+    struct llquery_kv *kv = &q->kv_pairs[i];
+    if (UNLIKELY(!schema_key_ready(q, kv))) {
+      return false;
+    }
+    uint32_t slot = schema_find(schema, kv->key, kv->key_len);
+    if (slot != LQ_NPOS && internal->slot_first[slot] == LQ_NPOS) {
+      internal->slot_first[slot] = i;
+    }
+  }
+  internal->slots_valid = true;
+  return true;
+}
+
+/*
+ * 键驻留
+ *
+ * 解析时不含转义的原始键先在驻留表中查找（需要小写时按小写计算哈希和比较），
+ * 找到时键直接引用驻留字符串，不再复制到内存池；其余的键存储后再查找，
+ * 学习模式下未找到的键加入驻留表。
+ */
+#define LQ_INTERN_DEFAULT_KEYS 1024
+
+static LQ_ALWAYS_INLINE bool intern_equal(const char *interned, const char *key, size_t len,
+                                          bool fold) {
+  if (LIKELY(!fold)) {
+    return memcmp(interned, key, len) == 0;
+  }
+  for (size_t i = 0; i < len; i++) {
+    unsigned char c = (unsigned char)key[i];
+    if ((unsigned char)interned[i] != LQ_FOLD_LOWER(c)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * 驻留表项数有上限且装载率不超过一半，探测长度有界，
+ * 因此使用按 8 字节混合的带种子哈希，代价远低于 key_hash()
+ */
+static LQ_ALWAYS_INLINE uint32_t intern_hash(uint64_t seed, const char *key, size_t len,
+                                             bool fold) {
+  char folded[8];
+  uint64_t h = seed ^ ((uint64_t)len * 0x9E3779B97F4A7C15ULL);
+  while (len >= 8) {
+    uint64_t w;
+    if (UNLIKELY(fold)) {
+      for (int i = 0; i < 8; i++) folded[i] = (char)LQ_FOLD_LOWER((unsigned char)key[i]);
+      memcpy(&w, folded, 8);
+    } else {
+      memcpy(&w, key, 8);
+    }
+    h = (h ^ w) * 0xBF58476D1CE4E5B9ULL;
+    h ^= h >> 29;
+    key += 8;
+    len -= 8;
+  }
+  if (len > 0) {
+    h = (h ^ key_sig(key, len, fold)) * 0xBF58476D1CE4E5B9ULL;
+  }
+  h ^= h >> 32;
+  return (uint32_t)h;
+}
+
+/* 返回键的 ID，未找到返回 0；*hash_out 返回哈希供插入使用 */
+static uint32_t intern_find(const struct llquery_intern *t, const char *key, size_t len,
+                            bool fold, uint32_t *hash_out) {
+  uint32_t h = intern_hash(t->seed[0] ^ t->seed[1], key, len, fold);
+  if (hash_out) *hash_out = h;
+  for (uint32_t pos = h & t->mask; t->slots[pos].id; pos = (pos + 1) & t->mask) {
+    uint32_t id = t->slots[pos].id;
+    if (t->slots[pos].hash == h && t->key_lens[id] == len &&
+        intern_equal(t->keys[id], key, len, fold)) {
+      return id;
+    }
+  }
+  return 0;
+}
+
+/* 查找或加入键，返回 ID；表已满或内存不足时返回 0 */
+static uint32_t intern_insert(struct llquery_intern *t, const char *key, size_t len) {
+  uint32_t h;
+  uint32_t id = intern_find(t, key, len, false, &h);
+  if (id || t->count >= t->max_keys || len > UINT32_MAX - 1) {
+    return id;
+  }
+
+  lq_pool_chunk_t *chunk = t->chunks;
+  if (!chunk || chunk->used + len + 1 > chunk->size) {
+    size_t chunk_size = len + 1 > 4096 ? len + 1 : 4096;
+    chunk = t->alloc_fn(sizeof(lq_pool_chunk_t) + chunk_size, t->alloc_data);
+    if (!chunk) {
+      return 0;
+    }
+    chunk->next = t->chunks;
+    chunk->size = chunk_size;
+    chunk->used = 0;
+    t->chunks = chunk;
+  }
+  char *str = (char *)(chunk + 1) + chunk->used;
+  memcpy(str, key, len);
+  str[len] = '\0';
+  chunk->used += len + 1;
+
+  id = ++t->count;
+  t->keys[id] = str;
+  t->key_lens[id] = (uint32_t)len;
+  uint32_t pos = h & t->mask;
+  while (t->slots[pos].id) pos = (pos + 1) & t->mask;
+  t->slots[pos].hash = h;
+  t->slots[pos].id = id;
+  return id;
+}
+
+/* 原始键（不含转义）在驻留表中时改为引用驻留字符串 */
+static LQ_ALWAYS_INLINE void intern_raw_key(const llquery_internal_t *internal,
+                                            struct llquery_kv *kv, bool fold) {
+  const struct llquery_intern *t = internal->intern;
+  uint32_t id = intern_find(t, kv->key, kv->key_len, fold, NULL);
+  if (id) {
+    kv->key = t->keys[id];
+    kv->key_id = id;
+  }
+}
+
+/* 为已存储的键分配 ID；延迟模式下键需要解码或小写时先生成该键值对 */
+static bool intern_stored_key(const struct llquery *q, llquery_internal_t *internal,
+                              struct llquery_kv *kv) {
+  if (UNLIKELY(kv->_state & LQ_KV_PENDING) &&
+      ((kv->_state & LQ_KV_KEY_ESC) || (q->flags & LQF_LOWERCASE_KEYS)) &&
+      !lazy_materialize(q, kv)) {
+    return false;
+  }
+  struct llquery_intern *t = internal->intern;
+  uint32_t id = internal->intern_learn ? intern_insert(t, kv->key, kv->key_len)
+                                       : intern_find(t, kv->key, kv->key_len, false, NULL);
+  if (id) {
+    kv->key = t->keys[id];
+    kv->key_id = id;
+  }
+  return true;
+}
+
+/*
+ * 主解析循环模板
+ *
+ * 在结构字符索引上定位键值对边界，逐对存储。tflags 为编译期常量，
+ * 解码、小写、去空白、保留空值四个选项按常量展开，每种组合生成一个循环，
+ * 每次解析只分派一次，循环内不再检查这些选项。
+ * 返回时 *consumed 为已处理的输入长度。
+ */
+#define LQ_LOOP_FLAGS (LQF_AUTO_DECODE | LQF_LOWERCASE_KEYS | LQF_TRIM_VALUES | LQF_KEEP_EMPTY)
+
+static LQ_ALWAYS_INLINE enum llquery_error parse_loop(struct llquery *q,
+                                                      llquery_internal_t *internal,
+                                                      const char *base, size_t len,
+                                                      size_t *consumed, bool *lazy_side,
+                                                      const uint16_t tflags) {
+  const uint16_t flags = (uint16_t)((q->flags & ~LQ_LOOP_FLAGS) | tflags);
+  const bool needs_decode = (tflags & LQF_AUTO_DECODE) != 0;
+  const bool lowercase = (tflags & LQF_LOWERCASE_KEYS) != 0;
+  const bool trim = (tflags & LQF_TRIM_VALUES) != 0;
+  const bool keep_empty = (tflags & LQF_KEEP_EMPTY) != 0;
+  const bool zero_copy = (flags & LQF_ZERO_COPY) != 0;
+  // 校验需要生成后的键值，延迟模式不生效；输入全部为 ASCII 时只需校验解码过的键值对
+  const bool lazy = (flags & (LQF_LAZY | LQF_VALIDATE_UTF8)) == LQF_LAZY;
+  const bool validate_raw = (flags & LQF_VALIDATE_UTF8) &&
+                            !ascii_only((const unsigned char *)base, len);
+
+  const char *current = base;
+  const char *end = base + len;
+  lq_scanner_t scanner;
+  scanner_init(&scanner, base, len);
+  uint32_t kv_index = 0;
+  enum llquery_error err = LQE_OK;
+
+  while (LIKELY(current < end && kv_index < internal->kv_limit)) {
+    // 跳过前导'&'
+    while (LIKELY(current < end) && IS_SEPARATOR(*current)) current++;
+    if (UNLIKELY(current >= end)) break;
+
+    const char* key_start = current;
+    bool key_esc = false;
+    bool value_esc = false;
+
+    // 在位掩码中查找 key 结束位置（'=' 或 '&'）
+    const char *key_end = base + scanner_next(&scanner, (size_t)(current - base),
+                                              true, &key_esc);
+    current = key_end;
+
+    const char *value_start = NULL;
     const char *value_end = NULL;
 
-    if (LIKELY(current < end) && IS_EQUAL(*current)) {
-      // 有值
-      current++;
-      value_start = current;
-      
-      // 批量查找值结束位置（'&'）
-      const char *amp = (const char *)memchr(current, '&', end - current);
-      if (amp) {
-        value_end = amp;
-        current = amp;
+    if (LIKELY(current < end) && IS_EQUAL(*current)) {
+      // 有值
+      current++;
+      value_start = current;
+
+      // 查找值结束位置（'&'）
+      value_end = base + scanner_next(&scanner, (size_t)(current - base),
+                                      false, &value_esc);
+      current = value_end;
+    } else {
+      // 无值
+      value_start = value_end = current;
+    }
+    if (current < end && IS_SEPARATOR(*current)) current++;
+
+    // 跳过空 key
+    if (UNLIKELY(key_end == key_start)) {
+      continue;
+    }
+
+    // 存储 kv（解码、小写、去空白、丢弃空值在同一步完成）
+    if (UNLIKELY(kv_index >= internal->kv_capacity) &&
+        !kv_reserve(q, internal, kv_index, kv_index + 1)) {
+      err = LQE_MEMORY_ERROR;
+      break;
+    }
+    struct llquery_kv *kv = &q->kv_pairs[kv_index];
+    key_esc = needs_decode && key_esc;
+    value_esc = needs_decode && value_esc;
+    kv->key = key_start;
+    kv->key_len = (size_t)(key_end - key_start);
+    kv->value = value_start;
+    kv->value_len = (size_t)(value_end - value_start);
+    kv->is_encoded = key_esc || value_esc;
+    kv->_state = 0;
+    kv->invalid_utf8 = false;
+    kv->key_id = 0;
+    if (internal->intern && !key_esc) {
+      intern_raw_key(internal, kv, lowercase);
+    }
+
+    if (lazy && LIKELY(!(value_esc && trim && !keep_empty))) {
+      // 只记录偏移，首次访问时再解码、改写；零拷贝且无需改写的片段本身就是结果。
+      // 丢弃空值的判断在原始片段上完成（未转义时去空白结果相同）
+      size_t kept_len = kv->value_len;
+      if (trim && !keep_empty) {
+        size_t lead;
+        kept_len = trim_span(value_start, kept_len, &lead);
+      }
+      if (!keep_empty && kept_len == 0) {
+        continue;
+      }
+      if (!zero_copy || key_esc || value_esc || (lowercase && !kv->key_id) || trim) {
+        kv->_state = LQ_KV_PENDING |
+                     (key_esc ? LQ_KV_KEY_ESC : 0) |
+                     (value_esc ? LQ_KV_VALUE_ESC : 0);
+        internal->lazy_pending++;
+      }
+      *lazy_side |= key_esc || value_esc || lowercase;
+    } else {
+      err = store_pair(q, internal, kv, key_esc, value_esc, kv->key_id != 0, flags);
+      if (UNLIKELY(err != LQE_OK)) break;
+
+      // 检查是否保留空值（字符串归内存池或缓冲区所有，跳过即可）
+      if (!keep_empty && kv->value_len == 0) {
+        continue;
+      }
+      if (UNLIKELY(flags & LQF_VALIDATE_UTF8) && (validate_raw || key_esc || value_esc)) {
+        err = validate_pair(kv, flags);
+        if (UNLIKELY(err != LQE_OK)) break;
+      }
+    }
+
+    if (internal->intern && !kv->key_id && !intern_stored_key(q, internal, kv)) {
+      err = LQE_MEMORY_ERROR;
+      break;
+    }
+    if (internal->schema) {
+      bool keep;
+      err = schema_assign(q, internal, kv, kv_index, &keep);
+      if (UNLIKELY(err != LQE_OK)) break;
+      if (!keep) continue;
+    }
+
+    kv_index++;
+  }
+
+  set_kv_count(q, internal, kv_index);
+  *consumed = (size_t)(current - base);
+  return err;
+}
+
+typedef enum llquery_error (*lq_parse_loop_fn)(struct llquery *q, llquery_internal_t *internal,
+                                               const char *base, size_t len,
+                                               size_t *consumed, bool *lazy_side);
+
+/* 变体编号的各位依次对应 解码、小写、去空白、保留空值 */
+#define LQ_LOOP_VARIANT(n) (uint16_t)(((n) & 1 ? LQF_AUTO_DECODE : 0) |    \
+                                      ((n) & 2 ? LQF_LOWERCASE_KEYS : 0) | \
+                                      ((n) & 4 ? LQF_TRIM_VALUES : 0) |    \
+                                      ((n) & 8 ? LQF_KEEP_EMPTY : 0))
+
+#define LQ_DEFINE_PARSE_LOOP(n)                                                   \
+static enum llquery_error parse_loop_##n(struct llquery *q,                       \
+                                         llquery_internal_t *internal,            \
+                                         const char *base, size_t len,            \
+                                         size_t *consumed, bool *lazy_side) {     \
+  return parse_loop(q, internal, base, len, consumed, lazy_side, LQ_LOOP_VARIANT(n)); \
+}
+
+LQ_DEFINE_PARSE_LOOP(0)  LQ_DEFINE_PARSE_LOOP(1)  LQ_DEFINE_PARSE_LOOP(2)  LQ_DEFINE_PARSE_LOOP(3)
+LQ_DEFINE_PARSE_LOOP(4)  LQ_DEFINE_PARSE_LOOP(5)  LQ_DEFINE_PARSE_LOOP(6)  LQ_DEFINE_PARSE_LOOP(7)
+LQ_DEFINE_PARSE_LOOP(8)  LQ_DEFINE_PARSE_LOOP(9)  LQ_DEFINE_PARSE_LOOP(10) LQ_DEFINE_PARSE_LOOP(11)
+LQ_DEFINE_PARSE_LOOP(12) LQ_DEFINE_PARSE_LOOP(13) LQ_DEFINE_PARSE_LOOP(14) LQ_DEFINE_PARSE_LOOP(15)
+
+static const lq_parse_loop_fn parse_loops[16] = {
+  parse_loop_0,  parse_loop_1,  parse_loop_2,  parse_loop_3,
+  parse_loop_4,  parse_loop_5,  parse_loop_6,  parse_loop_7,
+  parse_loop_8,  parse_loop_9,  parse_loop_10, parse_loop_11,
+  parse_loop_12, parse_loop_13, parse_loop_14, parse_loop_15
+};
+
+static unsigned parse_loop_index(uint16_t flags) {
+  return ((flags & LQF_AUTO_DECODE) ? 1u : 0u) |
+         ((flags & LQF_LOWERCASE_KEYS) ? 2u : 0u) |
+         ((flags & LQF_TRIM_VALUES) ? 4u : 0u) |
+         ((flags & LQF_KEEP_EMPTY) ? 8u : 0u);
+}
+
+enum llquery_error llquery_init(struct llquery *q,
+                                uint16_t max_pairs,
+                                uint16_t flags) {
+  return llquery_init_ex(q, max_pairs, flags,
+                         default_alloc, default_free, NULL);
+}
+
+/* 初始化公共部分：capacity 为初始数组容量，limit 为键值对数量上限 */
+static enum llquery_error init_common(struct llquery *q,
+                                      uint32_t capacity,
+                                      uint32_t limit,
+                                      bool growable,
+                                      uint16_t flags,
+                                      llquery_alloc_fn alloc_fn,
+                                      llquery_free_fn free_fn,
+                                      void *alloc_data) {
+  memset(q, 0, sizeof(struct llquery));
+
+  // 分配内部结构
+  llquery_internal_t *internal = alloc_fn(sizeof(llquery_internal_t), alloc_data);
+  if (!internal) {
+    return LQE_MEMORY_ERROR;
+  }
+
+  internal->alloc_fn = alloc_fn;
+  internal->free_fn = free_fn;
+  internal->alloc_data = alloc_data;
+  internal->use_custom_alloc = true;
+  internal->decode_buffer_owned = false;
+  internal->string_pool = NULL;
+  internal->string_pool_size = 0;
+  internal->string_pool_used = 0;
+  internal->string_pool_owned = false;
+  internal->pool_overflow = NULL;
+  internal->decode_buffer_used = 0;
+  internal->owned_decode_buffer = NULL;
+  internal->owned_decode_size = 0;
+  internal->side_capacity = 0;
+  internal->lazy_pending = 0;
+  internal->kv_count = 0;
+  internal->kv_capacity = capacity;
+  internal->kv_limit = limit;
+  internal->kv_growable = growable;
+  lookup_invalidate(internal);
+  internal->kv_sorted = false;
+  internal->keytab_wild = 0;
+  memset(internal->keytab_sig, 0, sizeof(internal->keytab_sig));
+  internal->index_mask = 0;
+  internal->index_next_cap = 0;
+  internal->index_slots = NULL;
+  internal->index_next = NULL;
+  internal->ci_mask = 0;
+  internal->ci_slots = NULL;
+  internal->schema = NULL;
+  internal->slot_first = NULL;
+  internal->slot_cap = 0;
+  internal->unknown_count = 0;
+  internal->intern = NULL;
+  internal->intern_learn = false;
+  hash_seed_init(internal->hash_seed, q, internal);
+
+  // 分配键值对数组
+  struct llquery_kv *kv_pairs = alloc_fn(sizeof(struct llquery_kv) * capacity, alloc_data);
+  if (!kv_pairs) {
+    free_fn(internal, alloc_data);
+    return LQE_MEMORY_ERROR;
+  }
+
+  memset(kv_pairs, 0, sizeof(struct llquery_kv) * capacity);
+
+  q->kv_pairs = kv_pairs;
+  q->max_kv_count = limit > UINT16_MAX ? UINT16_MAX : (uint16_t)limit;
+  q->flags = flags;
+  q->_reserved = internal;
+
+  return LQE_OK;
+}
+
+enum llquery_error llquery_init_ex(struct llquery *q,
+                                   uint16_t max_pairs,
+                                   uint16_t flags,
+                                   llquery_alloc_fn alloc_fn,
+                                   llquery_free_fn free_fn,
+                                   void *alloc_data) {
+  if (!q || !alloc_fn || !free_fn) {
+    return LQE_NULL_INPUT;
+  }
+
+  // 设置默认值
+  if (max_pairs == 0) {
+    max_pairs = DEFAULT_MAX_PAIRS;
+  }
+
+  return init_common(q, max_pairs, max_pairs, false, flags,
+                     alloc_fn, free_fn, alloc_data);
+}
+
+enum llquery_error llquery_init_growable(struct llquery *q,
+                                         uint32_t max_pairs,
+                                         uint16_t flags) {
+  if (!q) {
+    return LQE_NULL_INPUT;
+  }
+
+  // 0 表示不限数量；初始容量较小，解析时按实际键值对数量倍增
+  uint32_t limit = max_pairs ? max_pairs : UINT32_MAX;
+  uint32_t capacity = limit < GROWABLE_INITIAL_PAIRS ? limit : GROWABLE_INITIAL_PAIRS;
+
+  return init_common(q, capacity, limit, true, flags,
+                     default_alloc, default_free, NULL);
+}
+
+enum llquery_error llquery_parse(const char *query,
+                                 size_t query_len,
+                                 struct llquery *q) {
+  return llquery_parse_ex(query, query_len, q, NULL, 0);
+}
+
+enum llquery_error llquery_parse_ex(const char *query,
+                                    size_t query_len,
+                                    struct llquery *q,
+                                    char *decode_buf,
+                                    size_t decode_buf_size) {
+  if (!query || !q || !q->_reserved) {
+    return LQE_NULL_INPUT;
+  }
+
+  // 获取字符串长度
+  if (query_len == 0) {
+    query_len = strlen(query);
+  }
+  if (query_len == 0) {
+    return LQE_EMPTY_STRING;
+  }
+
+  // 重置解析器
+  llquery_reset(q);
+
+  // 跳过前导'?'
+  const char *work_query = query;
+  if (*work_query == '?') {
+    work_query++;
+    query_len--;
+    if (query_len == 0) {
+      return LQE_OK;
+    }
+  }
+
+  // 获取内部结构
+  llquery_internal_t *internal = get_internal(q);
+
+  bool zero_copy = (q->flags & LQF_ZERO_COPY) != 0;
+  bool lazy_side = false;
+  internal->side_capacity = query_len;
+
+  if (zero_copy) {
+    // 零拷贝模式：键值直接引用输入，需要解码或改写的 token 写入解码缓冲区
+    if (decode_buf && decode_buf_size > 0) {
+      q->decode_buffer = decode_buf;
+      q->decode_buffer_size = decode_buf_size;
+      internal->decode_buffer_used = 0;
+    }
+  } else {
+    // 阶段5优化：预分配字符串内存池以减少分配次数
+    pool_prepare(internal, estimate_string_size(work_query, query_len));
+  }
+
+  // 按选项组合选择一次特化的解析循环
+  size_t consumed = 0;
+  enum llquery_error err = parse_loops[parse_loop_index(q->flags)](
+      q, internal, work_query, query_len, &consumed, &lazy_side);
+  q->field_set = 0xFF; // 设置所有字段
+
+  // 延迟模式的零拷贝访问可能需要解码缓冲区，在此准备好，访问时不再修改 q
+  if (UNLIKELY(lazy_side && zero_copy && err == LQE_OK && !q->decode_buffer)) {
+    if (!side_alloc(q, internal, 0, query_len)) {
+      err = LQE_MEMORY_ERROR;
+    }
+  }
+
+  if (UNLIKELY(err != LQE_OK)) {
+    return err;
+  }
+
+  // 检查是否超过限制
+  if (UNLIKELY(consumed < query_len && internal->kv_count >= internal->kv_limit)) {
+    if (q->flags & LQF_STRICT) {
+      return LQE_TOO_MANY_PAIRS;
+    }
+  }
+
+  return parse_finish(q, internal);
+}
+
+/*
+ * 流式解析
+ *
+ * 分块输入按 '&' 切分：块内完整的片段直接处理，跨块的片段暂存在进位缓冲区，
+ * 直到遇到下一个 '&' 或 finish。片段完整后才解码，因此跨块的 %XX 无需特殊处理。
+ * 进位缓冲区和回调模式的解码缓冲区都只与最大的单个键值对成正比。
+ */
+typedef struct lq_stream_internal {
+  llquery_alloc_fn alloc_fn;
+  llquery_free_fn free_fn;
+  void *alloc_data;
+  char *carry;               /* 跨块片段的进位缓冲区 */
+  size_t carry_len;
+  size_t carry_cap;
+  bool carry_esc;            /* 进位片段中是否出现 '%'/'+' */
+  char *scratch;             /* 回调模式的解码缓冲区 */
+  size_t scratch_cap;
+  bool started;              /* 是否已处理过输入（用于跳过前导 '?'） */
+  bool stopped;              /* 回调要求停止或已 finish */
+  enum llquery_error error;  /* 第一个错误，之后的调用直接返回 */
+} lq_stream_internal_t;
+
+/* 确保缓冲区容量不小于 need，按至少两倍扩容并保留前 keep 字节 */
+static bool stream_reserve(lq_stream_internal_t *st, char **buf, size_t *cap,
+                           size_t need, size_t keep) {
+  if (LIKELY(need <= *cap)) {
+    return true;
+  }
+  size_t new_cap = *cap * 2;
+  if (new_cap < need) new_cap = need;
+  if (new_cap < 64) new_cap = 64;
+  char *new_buf = st->alloc_fn(new_cap, st->alloc_data);
+  if (UNLIKELY(!new_buf)) {
+    return false;
+  }
+  if (*buf) {
+    if (keep) memcpy(new_buf, *buf, keep);
+    st->free_fn(*buf, st->alloc_data);
+  }
+  *buf = new_buf;
+  *cap = new_cap;
+  return true;
+}
+
+/*
+ * 拆分一个完整片段（两个 '&' 之间的原始字节）：定位 '='，填充原始键值，
+ * 并按 token 判断是否需要解码。esc 为 false 时片段中没有 '%'/'+'，无需再检查。
+ */
+static void split_segment(struct llquery_kv *kv, const char *seg, size_t len,
+                          bool esc, uint16_t flags, bool *key_esc, bool *value_esc) {
+  const char *eq = memchr(seg, '=', len);
+  bool needs_decode = esc && (flags & LQF_AUTO_DECODE);
+
+  kv->key = seg;
+  kv->key_len = eq ? (size_t)(eq - seg) : len;
+  kv->value = eq ? eq + 1 : seg + len;
+  kv->value_len = eq ? len - kv->key_len - 1 : 0;
+  *key_esc = needs_decode && has_encoded_chars(kv->key, kv->key_len);
+  *value_esc = needs_decode && has_encoded_chars(kv->value, kv->value_len);
+  kv->is_encoded = *key_esc || *value_esc;
+  kv->_state = 0;
+  kv->invalid_utf8 = false;
+  kv->key_id = 0;
+}
+
+/*
+ * 把一个完整片段追加为 q 的键值对，遵循与 llquery_parse_ex() 相同的空键、空值和数量规则。
+ * in_place 为 true 时 seg 位于可写的自有缓冲区（至少 len + 2 字节），原地解码；
+ * 否则按 flags 的模式经 store_pair() 存储。*out 返回追加的键值对，未追加时为 NULL。
+ */
+static enum llquery_error append_segment(struct llquery *q, const char *seg, size_t len,
+                                         bool esc, uint16_t flags, bool in_place,
+                                         struct llquery_kv **out) {
+  *out = NULL;
+  if (UNLIKELY(len == 0 || *seg == '=')) {
+    // 空片段或空 key
+    return LQE_OK;
+  }
+  llquery_internal_t *internal = get_internal(q);
+  uint32_t count = internal->kv_count;
+  if (UNLIKELY(count >= internal->kv_limit)) {
+    return (flags & LQF_STRICT) ? LQE_TOO_MANY_PAIRS : LQE_OK;
+  }
+  if (UNLIKELY(count >= internal->kv_capacity) && !kv_reserve(q, internal, count, count + 1)) {
+    return LQE_MEMORY_ERROR;
+  }
+
+  struct llquery_kv *kv = &q->kv_pairs[count];
+  bool key_esc, value_esc;
+  split_segment(kv, seg, len, esc, flags, &key_esc, &value_esc);
+
+  if (in_place) {
+    char *buf = (char *)seg;
+    fill_pair(kv, buf, buf + kv->key_len + 1, key_esc, value_esc, flags);
+  } else {
+    enum llquery_error err = store_pair(q, internal, kv, key_esc, value_esc, false, flags);
+    if (UNLIKELY(err != LQE_OK)) {
+      return err;
+    }
+  }
+
+  if (UNLIKELY(!(flags & LQF_KEEP_EMPTY) && kv->value_len == 0)) {
+    return LQE_OK;
+  }
+  if (UNLIKELY(flags & LQF_VALIDATE_UTF8)) {
+    enum llquery_error err = validate_pair(kv, flags);
+    if (UNLIKELY(err != LQE_OK)) {
+      return err;
+    }
+  }
+  if (internal->intern && !intern_stored_key(q, internal, kv)) {
+    return LQE_MEMORY_ERROR;
+  }
+  if (internal->schema) {
+    bool keep;
+    enum llquery_error err = schema_assign(q, internal, kv, count, &keep);
+    if (UNLIKELY(err != LQE_OK) || !keep) {
+      return err;
+    }
+  }
+  set_kv_count(q, internal, count + 1);
+  *out = kv;
+  return LQE_OK;
+}
+
+/* 流式解析：处理一个完整片段 */
+static enum llquery_error stream_segment(struct llquery_stream *s, lq_stream_internal_t *st,
+                                         const char *seg, size_t len, bool esc) {
+  // 流式输入只能复制：分块在 feed 返回后即失效
+  uint16_t flags = s->flags & (uint16_t)~(LQF_ZERO_COPY | LQF_LAZY);
+  struct llquery_kv *kv = NULL;
+  struct llquery_kv kv_buf;
+
+  if (s->q) {
+    enum llquery_error err = append_segment(s->q, seg, len, esc, flags, false, &kv);
+    if (UNLIKELY(err != LQE_OK)) {
+      return err;
+    }
+  } else if (LIKELY(len > 0 && *seg != '=')) {
+    // 只使用回调：解码到内部缓冲区
+    if (UNLIKELY(!stream_reserve(st, &st->scratch, &st->scratch_cap, len + 2, 0))) {
+      return LQE_MEMORY_ERROR;
+    }
+    bool key_esc, value_esc;
+    split_segment(&kv_buf, seg, len, esc, flags, &key_esc, &value_esc);
+    fill_pair(&kv_buf, st->scratch, st->scratch + kv_buf.key_len + 1, key_esc, value_esc, flags);
+    if (LIKELY((flags & LQF_KEEP_EMPTY) || kv_buf.value_len > 0)) {
+      kv = &kv_buf;
+      if (UNLIKELY(flags & LQF_VALIDATE_UTF8)) {
+        enum llquery_error err = validate_pair(kv, flags);
+        if (UNLIKELY(err != LQE_OK)) {
+          return err;
+        }
+      }
+    }
+  }
+
+  if (kv && s->callback && s->callback(kv, s->user_data) != 0) {
+    st->stopped = true;
+  }
+  return LQE_OK;
+}
+
+enum llquery_error llquery_stream_init(struct llquery_stream *s,
+                                       struct llquery *q,
+                                       uint16_t flags,
+                                       llquery_iter_cb callback,
+                                       void *user_data) {
+  if (!s || (!q && !callback)) {
+    return LQE_NULL_INPUT;
+  }
+
+  llquery_alloc_fn alloc_fn = default_alloc;
+  llquery_free_fn free_fn = default_free;
+  void *alloc_data = NULL;
+  if (q) {
+    if (!q->_reserved) {
+      return LQE_NULL_INPUT;
+    }
+    llquery_internal_t *internal = get_internal(q);
+    alloc_fn = internal->alloc_fn;
+    free_fn = internal->free_fn;
+    alloc_data = internal->alloc_data;
+    flags = q->flags;
+    llquery_reset(q);
+  }
+
+  lq_stream_internal_t *st = alloc_fn(sizeof(lq_stream_internal_t), alloc_data);
+  if (!st) {
+    return LQE_MEMORY_ERROR;
+  }
+  memset(st, 0, sizeof(*st));
+  st->alloc_fn = alloc_fn;
+  st->free_fn = free_fn;
+  st->alloc_data = alloc_data;
+  st->error = LQE_OK;
+
+  s->q = q;
+  s->callback = callback;
+  s->user_data = user_data;
+  s->flags = flags;
+  s->_reserved = st;
+  return LQE_OK;
+}
+
+enum llquery_error llquery_stream_feed(struct llquery_stream *s,
+                                       const char *chunk,
+                                       size_t chunk_len) {
+  if (!s || !s->_reserved || (!chunk && chunk_len > 0)) {
+    return LQE_NULL_INPUT;
+  }
+
+  lq_stream_internal_t *st = (lq_stream_internal_t *)s->_reserved;
+  if (UNLIKELY(st->error != LQE_OK || st->stopped)) {
+    return st->error;
+  }
+  if (chunk_len == 0) {
+    return LQE_OK;
+  }
+
+  // 跳过整个输入的前导'?'
+  if (!st->started) {
+    st->started = true;
+    if (*chunk == '?') {
+      chunk++;
+      chunk_len--;
+    }
+  }
+
+  // 在结构字符索引上查找 '&'，同时记录片段中是否有转义
+  lq_scanner_t scanner;
+  scanner_init(&scanner, chunk, chunk_len);
+  size_t pos = 0;
+  enum llquery_error err = LQE_OK;
+
+  while (pos < chunk_len && !st->stopped) {
+    bool esc = false;
+    size_t amp = scanner_next(&scanner, pos, false, &esc);
+    size_t n = amp - pos;
+
+    if (amp == chunk_len || st->carry_len > 0) {
+      // 片段跨块：追加到进位缓冲区
+      if (UNLIKELY(!stream_reserve(st, &st->carry, &st->carry_cap,
+                                   st->carry_len + n, st->carry_len))) {
+        err = LQE_MEMORY_ERROR;
+        break;
+      }
+      memcpy(st->carry + st->carry_len, chunk + pos, n);
+      st->carry_len += n;
+      st->carry_esc |= esc;
+      if (amp == chunk_len) {
+        break;
+      }
+      err = stream_segment(s, st, st->carry, st->carry_len, st->carry_esc);
+      st->carry_len = 0;
+      st->carry_esc = false;
+    } else {
+      // 块内完整片段：直接处理，不复制
+      err = stream_segment(s, st, chunk + pos, n, esc);
+    }
+    if (UNLIKELY(err != LQE_OK)) {
+      break;
+    }
+    pos = amp + 1;
+  }
+
+  if (s->q) {
+    s->q->field_set = 0xFF;
+  }
+  st->error = err;
+  return err;
+}
+
+enum llquery_error llquery_stream_finish(struct llquery_stream *s) {
+  if (!s || !s->_reserved) {
+    return LQE_NULL_INPUT;
+  }
+
+  lq_stream_internal_t *st = (lq_stream_internal_t *)s->_reserved;
+  if (st->error == LQE_OK && !st->stopped && st->carry_len > 0) {
+    st->error = stream_segment(s, st, st->carry, st->carry_len, st->carry_esc);
+  }
+  st->carry_len = 0;
+  st->stopped = true;
+  if (s->q) {
+    s->q->field_set = 0xFF;
+    if (st->error == LQE_OK) {
+      st->error = parse_finish(s->q, get_internal(s->q));
+    }
+  }
+  return st->error;
+}
+
+void llquery_stream_free(struct llquery_stream *s) {
+  if (!s || !s->_reserved) {
+    return;
+  }
+
+  lq_stream_internal_t *st = (lq_stream_internal_t *)s->_reserved;
+  llquery_free_fn free_fn = st->free_fn;
+  void *alloc_data = st->alloc_data;
+  if (st->carry) free_fn(st->carry, alloc_data);
+  if (st->scratch) free_fn(st->scratch, alloc_data);
+  free_fn(st, alloc_data);
+
+  // 解析结果仍归 q 所有
+  memset(s, 0, sizeof(struct llquery_stream));
+}
+
+/*
+ * 分散输入解析
+ *
+ * 完全位于一个分段内的键值对与 llquery_parse_ex() 相同处理（零拷贝模式下为视图）；
+ * 跨越分段边界的键值对先拼接到一块自有缓冲区，再原地解码。
+ */
+enum llquery_error llquery_parse_iov(const struct iovec *iov,
+                                     int iovcnt,
+                                     struct llquery *q) {
+  if (!iov || !q || !q->_reserved || iovcnt < 0) {
+    return LQE_NULL_INPUT;
+  }
+
+  llquery_reset(q);
+  llquery_internal_t *internal = get_internal(q);
+
+  size_t total_len = 0;
+  for (int i = 0; i < iovcnt; i++) {
+    total_len += iov[i].iov_len;
+  }
+
+  // 拼接的键值对需要额外 2 字节（两个终止符），每个边界至多一个
+  uint16_t flags = q->flags & (uint16_t)~LQF_LAZY;
+  bool zero_copy = (flags & LQF_ZERO_COPY) != 0;
+  size_t stitch_extra = 2 * (size_t)iovcnt;
+  if (zero_copy) {
+    internal->side_capacity = total_len + stitch_extra;
+  } else {
+    pool_prepare(internal, estimate_string_size(NULL, total_len) + stitch_extra);
+  }
+
+  // 跳过前导'?'
+  int i = 0;
+  size_t pos = 0;
+  while (i < iovcnt && iov[i].iov_len == 0) i++;
+  if (i < iovcnt && *(const char *)iov[i].iov_base == '?') pos = 1;
+
+  enum llquery_error err = LQE_OK;
+  struct llquery_kv *kv;
+  while (i < iovcnt) {
+    const char *base = (const char *)iov[i].iov_base;
+    size_t len = iov[i].iov_len;
+
+    // 分段内完整的片段
+    lq_scanner_t scanner;
+    scanner_init(&scanner, base, len);
+    while (pos < len) {
+      bool esc = false;
+      size_t amp = scanner_next(&scanner, pos, false, &esc);
+      if (amp == len) {
+        // 片段到分段末尾：后面没有非空分段或下一分段以 '&' 开头时仍完整位于本分段
+        int next = i + 1;
+        while (next < iovcnt && iov[next].iov_len == 0) next++;
+        if (next < iovcnt && *(const char *)iov[next].iov_base != '&') break;
+        err = append_segment(q, base + pos, len - pos, esc, flags, false, &kv);
+        if (UNLIKELY(err != LQE_OK)) goto done;
+        pos = len;
+        break;
+      }
+      err = append_segment(q, base + pos, amp - pos, esc, flags, false, &kv);
+      if (UNLIKELY(err != LQE_OK)) goto done;
+      pos = amp + 1;
+    }
+    if (pos >= len) {
+      i++;
+      pos = 0;
+      continue;
+    }
+
+    // 片段跨越分段边界：找到结束的 '&' 并计算拼接长度
+    size_t stitch_len = len - pos;
+    size_t end_pos = 0;
+    int j = i + 1;
+    for (; j < iovcnt; j++) {
+      const char *next = (const char *)iov[j].iov_base;
+      const char *amp = iov[j].iov_len ? memchr(next, '&', iov[j].iov_len) : NULL;
+      if (amp) {
+        end_pos = (size_t)(amp - next);
+        stitch_len += end_pos;
+        break;
+      }
+      stitch_len += iov[j].iov_len;
+    }
+
+    char *buf = zero_copy ? side_alloc(q, internal, stitch_len + 2, internal->side_capacity)
+                          : pool_alloc_string(internal, stitch_len + 2);
+    if (UNLIKELY(!buf)) {
+      err = !zero_copy || internal->decode_buffer_owned || !q->decode_buffer ?
+            LQE_MEMORY_ERROR : LQE_BUFFER_TOO_SMALL;
+      goto done;
+    }
+    size_t n = len - pos;
+    memcpy(buf, base + pos, n);
+    for (int k = i + 1; k < j; k++) {
+      memcpy(buf + n, iov[k].iov_base, iov[k].iov_len);
+      n += iov[k].iov_len;
+    }
+    if (j < iovcnt) {
+      memcpy(buf + n, iov[j].iov_base, end_pos);
+    }
+
+    err = append_segment(q, buf, stitch_len, true, flags, true, &kv);
+    if (UNLIKELY(err != LQE_OK)) goto done;
+
+    i = j;
+    pos = end_pos + 1;
+  }
+
+done:
+  q->field_set = 0xFF;
+  if (err == LQE_OK) {
+    err = parse_finish(q, internal);
+  }
+  return err;
+}
+
+void llquery_free(struct llquery *q) {
+  if (!q || !q->_reserved) {
+    return;
+  }
+
+  llquery_internal_t *internal = get_internal(q);
+
+  // 释放内存池：键值字符串都归内存池所有（零拷贝模式下引用输入），无需逐个释放
+  pool_release(internal);
+
+  // 释放键值对数组
+  if (q->kv_pairs) {
+    internal->free_fn(q->kv_pairs, internal->alloc_data);
+  }
+
+  // 释放自有解码缓冲区
+  if (internal->owned_decode_buffer) {
+    internal->free_fn(internal->owned_decode_buffer, internal->alloc_data);
+  }
+
+  index_release(internal);
+  if (internal->slot_first) {
+    internal->free_fn(internal->slot_first, internal->alloc_data);
+  }
+
+  // 释放内部结构
+  internal->free_fn(internal, internal->alloc_data);
+
+  // 清零结构体
+  memset(q, 0, sizeof(struct llquery));
+}
+
+uint16_t llquery_count(const struct llquery *q) {
+  return q ? q->kv_count : 0;
+}
+
+uint32_t llquery_count_ex(const struct llquery *q) {
+  return q ? kv_count(q) : 0;
+}
+
+const struct llquery_kv *llquery_get_kv(const struct llquery *q,
+                                        uint16_t index) {
+  return llquery_get_kv_ex(q, index);
+}
+
+const struct llquery_kv *llquery_get_kv_ex(const struct llquery *q,
+                                           uint32_t index) {
+  if (!q || index >= kv_count(q)) {
+    return NULL;
+  }
+  struct llquery_kv *kv = &q->kv_pairs[index];
+  return lazy_materialize(q, kv) ? kv : NULL;
+}
+
+/* 有序结果：在 [start, n) 中二分查找第一个匹配键的下标 */
+static uint32_t sorted_find(const struct llquery *q, uint32_t start,
+                            const char *key, size_t key_len) {
+  uint32_t lo = start;
+  uint32_t hi = kv_count(q);
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2;
+    const struct llquery_kv *kv = &q->kv_pairs[mid];
+    if (compare_keys(kv->key, kv->key_len, key, key_len) < 0) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  if (lo < kv_count(q) && q->kv_pairs[lo].key_len == key_len &&
+      memcmp(q->kv_pairs[lo].key, key, key_len) == 0) {
+    return lo;
+  }
+  return LQ_NPOS;
+}
+
+/* 从 start 开始查找匹配键的下标（有序时二分，否则线性），未找到返回 LQ_NPOS */
+static uint32_t scan_key_index(const struct llquery *q, uint32_t start,
+                               const char *key, size_t key_len) {
+  llquery_internal_t *internal = (llquery_internal_t *)q->_reserved;
+  if (internal && internal->kv_sorted) {
+    return sorted_find(q, start, key, key_len);
+  }
+  if (internal && internal->keytab_valid) {
+    return keytab_find(q, internal, start, key, key_len);
+  }
+
+  uint32_t n = kv_count(q);
+  uint32_t i = start;
+  while (i < n && !key_matches(q, &q->kv_pairs[i], key, key_len)) {
+    i++;
+  }
+
+  // 记录扫描量，供 lookup_index() 决定何时建立索引或键表
+  if (internal) {
+    uint32_t work = (i < n ? i + 1 : n) - start;
+    internal->scan_work = work > UINT32_MAX - internal->scan_work ?
+                          UINT32_MAX : internal->scan_work + work;
+  }
+  return i < n ? i : LQ_NPOS;
+}
+
+/* 查找第一个匹配键的下标，未找到返回 LQ_NPOS */
+static uint32_t find_key_index(const struct llquery *q, const char *key, size_t key_len) {
+  const llquery_internal_t *internal = lookup_index(q);
+  if (internal) {
+    return index_find(q, internal, key, key_len);
+  }
+  return scan_key_index(q, 0, key, key_len);
+}
+
+const char *llquery_get_value(const struct llquery *q,
+                              const char *key,
+                              size_t key_len) {
+  if (!q || !key) {
+    return NULL;
+  }
+
+  if (key_len == 0) {
+    key_len = strlen(key);
+  }
+
+  uint32_t i = find_key_index(q, key, key_len);
+  if (i == LQ_NPOS || !lazy_materialize(q, &q->kv_pairs[i])) {
+    return NULL;
+  }
+  return q->kv_pairs[i].value_len > 0 ? q->kv_pairs[i].value : "";
+}
+
+const struct llquery_kv *llquery_get_kv_by_key(const struct llquery *q,
+                                               const char *key,
+                                               size_t key_len) {
+  if (!q || !key) {
+    return NULL;
+  }
+
+  if (key_len == 0) {
+    key_len = strlen(key);
+  }
+
+  uint32_t i = find_key_index(q, key, key_len);
+  if (i == LQ_NPOS || !lazy_materialize(q, &q->kv_pairs[i])) {
+    return NULL;
+  }
+  return &q->kv_pairs[i];
+}
+
+uint16_t llquery_get_all_values(const struct llquery *q,
+                                const char *key,
+                                size_t key_len,
+                                const char **values,
+                                uint16_t max_values) {
+  if (!q || !key || !values || max_values == 0) {
+    return 0;
+  }
+
+  if (key_len == 0) {
+    key_len = strlen(key);
+  }
+
+  // 有索引时沿同键链表读取，否则从上一个匹配处继续扫描
+  const llquery_internal_t *internal = lookup_index(q);
+  uint32_t i = internal ? index_find(q, internal, key, key_len)
+                        : scan_key_index(q, 0, key, key_len);
+  uint16_t count = 0;
+  while (i != LQ_NPOS && count < max_values) {
+    struct llquery_kv *kv = &q->kv_pairs[i];
+    if (lazy_materialize(q, kv)) {
+      values[count++] = kv->value_len > 0 ? kv->value : "";
+    }
+    i = internal ? internal->index_next[i] : scan_key_index(q, i + 1, key, key_len);
+  }
+
+  return count;
+}
+
+/* 一次查找的键数量上限（超过时分批），用 64 位掩码记录未找到的键 */
+#define LQ_MULTI_BATCH 64
+
+/* 按首字节、末两字节和长度把键分到 64 个桶之一，用于单遍扫描的预筛选 */
+static LQ_ALWAYS_INLINE unsigned multi_bucket(unsigned char first, unsigned char mid,
+                                              unsigned char last, size_t len) {
+  return (first * 31u + mid * 7u + last + (unsigned)len * 13u) & 63u;
+}
+
+/*
+ * 单遍扫描键值对，为 keys 中尚未找到的键填写第一个匹配的值。
+ * 所查的键按桶记录，每个键值对只与同一个桶中尚未找到的键比较；
+ * 延迟模式下需要解码的原始键无法分桶，与全部尚未找到的键比较。
+ */
+static uint32_t scan_multi(const struct llquery *q, const char *const *keys,
+                           const size_t *lens, uint32_t n, const char **values) {
+  uint64_t pending = 0;
+  uint64_t buckets[64];
+  memset(buckets, 0, sizeof(buckets));
+  for (uint32_t j = 0; j < n; j++) {
+    if (keys[j] && lens[j] > 0) {
+      const unsigned char *k = (const unsigned char *)keys[j];
+      size_t len = lens[j];
+      pending |= 1ULL << j;
+      buckets[multi_bucket(k[0], k[len > 1 ? len - 2 : 0], k[len - 1], len)] |= 1ULL << j;
+    }
+  }
+
+  uint32_t count = kv_count(q);
+  uint32_t found = 0;
+  uint32_t i = 0;
+  for (; i < count && pending; i++) {
+    struct llquery_kv *kv = &q->kv_pairs[i];
+    uint64_t candidates = pending;
+    size_t len = kv->key_len;
+    if (LIKELY(!(kv->_state & LQ_KV_KEY_ESC)) && len > 0) {
+      const unsigned char *k = (const unsigned char *)kv->key;
+      unsigned char first = k[0];
+      unsigned char mid = k[len > 1 ? len - 2 : 0];
+      unsigned char last = k[len - 1];
+      if (UNLIKELY(key_folds(q, kv))) {
+        first = LQ_FOLD_LOWER(first);
+        mid = LQ_FOLD_LOWER(mid);
+        last = LQ_FOLD_LOWER(last);
+      }
+      candidates &= buckets[multi_bucket(first, mid, last, len)];
+    }
+    for (; candidates; candidates &= candidates - 1) {
+      uint32_t j = lq_ctz64(candidates);
+      if (!key_matches(q, kv, keys[j], lens[j])) {
+        continue;
+      }
+      pending &= ~(1ULL << j);
+      if (lazy_materialize(q, kv)) {
+        values[j] = kv->value_len > 0 ? kv->value : "";
+        found++;
+      }
+    }
+  }
+
+  // 一遍扫描计入一次查找的扫描量
+  llquery_internal_t *internal = (llquery_internal_t *)q->_reserved;
+  if (internal) {
+    internal->scan_work = i > UINT32_MAX - internal->scan_work ?
+                          UINT32_MAX : internal->scan_work + i;
+  }
+  return found;
+}
+
+uint32_t llquery_get_values_multi(const struct llquery *q,
+                                  const char *const *keys,
+                                  const size_t *key_lens,
+                                  uint32_t n,
+                                  const char **values) {
+  if (!q || !keys || !values) {
+    return 0;
+  }
+
+  size_t lens[LQ_MULTI_BATCH];
+  uint32_t found = 0;
+  for (uint32_t base = 0; base < n; base += LQ_MULTI_BATCH) {
+    uint32_t batch = n - base < LQ_MULTI_BATCH ? n - base : LQ_MULTI_BATCH;
+    const char *const *bkeys = keys + base;
+    const char **bvalues = values + base;
+    for (uint32_t j = 0; j < batch; j++) {
+      bvalues[j] = NULL;
+      lens[j] = !bkeys[j] ? 0 :
+                (key_lens && key_lens[base + j]) ? key_lens[base + j] : strlen(bkeys[j]);
+    }
+
+    // 有索引或结果有序时逐键查找，每个键 O(1) 或 O(log n)；否则单遍扫描
+    const llquery_internal_t *internal = lookup_index(q);
+    const llquery_internal_t *state = (const llquery_internal_t *)q->_reserved;
+    if (!internal && !(state && state->kv_sorted)) {
+      found += scan_multi(q, bkeys, lens, batch, bvalues);
+      continue;
+    }
+    for (uint32_t j = 0; j < batch; j++) {
+      if (!bkeys[j]) continue;
+      uint32_t i = internal ? index_find(q, internal, bkeys[j], lens[j])
+                            : sorted_find(q, 0, bkeys[j], lens[j]);
+      if (i != LQ_NPOS && lazy_materialize(q, &q->kv_pairs[i])) {
+        bvalues[j] = q->kv_pairs[i].value_len > 0 ? q->kv_pairs[i].value : "";
+        found++;
+      }
+    }
+  }
+  return found;
+}
+
+bool llquery_has_key(const struct llquery *q,
+                     const char *key,
+                     size_t key_len) {
+  if (!q || !key) {
+    return false;
+  }
+
+  if (key_len == 0) {
+    key_len = strlen(key);
+  }
+
+  return find_key_index(q, key, key_len) != LQ_NPOS;
+}
+
+const char *llquery_get_value_ci(const struct llquery *q,
+                                 const char *key,
+                                 size_t key_len) {
+  if (!q || !key) {
+    return NULL;
+  }
+
+  if (key_len == 0) {
+    key_len = strlen(key);
+  }
+
+  uint32_t i = find_key_index_ci(q, key, key_len);
+  if (i == LQ_NPOS || !lazy_materialize(q, &q->kv_pairs[i])) {
+    return NULL;
+  }
+  return q->kv_pairs[i].value_len > 0 ? q->kv_pairs[i].value : "";
+}
+
+const struct llquery_kv *llquery_get_kv_by_key_ci(const struct llquery *q,
+                                                  const char *key,
+                                                  size_t key_len) {
+  if (!q || !key) {
+    return NULL;
+  }
+
+  if (key_len == 0) {
+    key_len = strlen(key);
+  }
+
+  uint32_t i = find_key_index_ci(q, key, key_len);
+  if (i == LQ_NPOS || !lazy_materialize(q, &q->kv_pairs[i])) {
+    return NULL;
+  }
+  return &q->kv_pairs[i];
+}
+
+bool llquery_has_key_ci(const struct llquery *q,
+                        const char *key,
+                        size_t key_len) {
+  if (!q || !key) {
+    return false;
+  }
+
+  if (key_len == 0) {
+    key_len = strlen(key);
+  }
+
+  return find_key_index_ci(q, key, key_len) != LQ_NPOS;
+}
+
+const struct llquery_kv *llquery_next_value(const struct llquery *q,
+                                           const struct llquery_kv *kv) {
+  if (!q || !kv || kv < q->kv_pairs || kv >= q->kv_pairs + kv_count(q)) {
+    return NULL;
+  }
+
+  // 沿同键链表前进；索引不可用时从下一项开始线性查找
+  uint32_t i = (uint32_t)(kv - q->kv_pairs);
+  const llquery_internal_t *internal = group_index(q);
+  uint32_t next = internal ? internal->index_next[i]
+                           : scan_key_index(q, i + 1, kv->key, kv->key_len);
+  if (next == LQ_NPOS || !lazy_materialize(q, &q->kv_pairs[next])) {
+    return NULL;
+  }
+  return &q->kv_pairs[next];
+}
+
+uint32_t llquery_iterate_unique(const struct llquery *q,
+                                llquery_iter_cb callback,
+                                void *user_data) {
+  if (!q || !callback) {
+    return 0;
+  }
+
+  const llquery_internal_t *internal = group_index(q);
+  uint32_t n = kv_count(q);
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    struct llquery_kv *kv = &q->kv_pairs[i];
+    if (internal && (kv->_state & LQ_KV_DUP)) {
+      continue;
+    }
+    if (!lazy_materialize(q, kv)) {
+      break;
+    }
+    // 索引不可用时以线性查找判断是否为首次出现
+    if (!internal && scan_key_index(q, 0, kv->key, kv->key_len) != i) {
+      continue;
+    }
+    if (callback(kv, user_data) != 0) {
+      break;
+    }
+    count++;
+  }
+
+  return count;
+}
+
+uint16_t llquery_iterate(const struct llquery *q,
+                         llquery_iter_cb callback,
+                         void *user_data) {
+  if (!q || !callback) {
+    return 0;
+  }
+
+  uint32_t n = kv_count(q);
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    if (!lazy_materialize(q, &q->kv_pairs[i]) ||
+        callback(&q->kv_pairs[i], user_data) != 0) {
+      break;
+    }
+    count++;
+  }
+
+  return count > UINT16_MAX ? UINT16_MAX : (uint16_t)count;
+}
+
+enum llquery_error llquery_sort(struct llquery *q,
+                                llquery_compare_cb compare_fn) {
+  if (!q || !q->_reserved) {
+    return LQE_OK;
+  }
+  return sort_pairs(q, get_internal(q), compare_fn);
+}
+
+uint16_t llquery_filter(struct llquery *q,
+                        bool (*filter_fn)(const struct llquery_kv *kv, void *user_data),
+                        void *user_data) {
+  if (!q || !filter_fn) {
+    return 0;
+  }
+  if (!lazy_materialize_all(q)) {
+    return q->kv_count;
+  }
+
+  // 字符串归内存池所有，被过滤的键值对只需从数组中移除
+  uint32_t n = kv_count(q);
+  uint32_t write_idx = 0;
+  for (uint32_t read_idx = 0; read_idx < n; read_idx++) {
+    if (filter_fn(&q->kv_pairs[read_idx], user_data)) {
+      if (write_idx != read_idx) {
+        q->kv_pairs[write_idx] = q->kv_pairs[read_idx];
+      }
+      write_idx++;
+    }
+  }
+
+  // 稳定压缩不改变相对顺序
+  llquery_internal_t *internal = get_internal(q);
+  bool sorted = internal->kv_sorted;
+  set_kv_count(q, internal, write_idx);
+  internal->kv_sorted = sorted;
+  return q->kv_count;
+}
+
+/* 序列化后的长度（不含终止符）；encode 时键和值按表单编码计算 */
+static size_t stringify_length(const struct llquery *q, uint32_t n, bool encode) {
+  const unsigned char bit = (unsigned char)(1u << LQENC_FORM);
+  size_t needed = 2 * (size_t)n - 1;  // n 个 '=' 与 n - 1 个 '&'
+  for (uint32_t i = 0; i < n; i++) {
+    const struct llquery_kv *kv = &q->kv_pairs[i];
+    if (encode) {
+      needed += encoded_length((const unsigned char *)kv->key, kv->key_len, bit, true);
+      needed += encoded_length((const unsigned char *)kv->value, kv->value_len, bit, true);
+    } else {
+      needed += kv->key_len + kv->value_len;
+    }
+  }
+  return needed;
+}
+
+/* 写出一段键或值；out 处须能容纳结果 */
+static LQ_ALWAYS_INLINE char *stringify_put(char *out, const char *src, size_t len,
+                                            bool encode) {
+  if (encode) {
+    return encode_span(out, src, len, (unsigned char)(1u << LQENC_FORM), true);
+  }
+  if (len > 0) {
+    memcpy(out, src, len);
+  }
+  return out + len;
+}
+
+size_t llquery_stringify(const struct llquery *q,
+                         char *buffer,
+                         size_t buffer_size,
+                         bool encode) {
+  uint32_t n = q ? kv_count(q) : 0;
+  if (n == 0 || !lazy_materialize_all(q)) {
+    if (buffer && buffer_size > 0) {
+      buffer[0] = '\0';
+    }
+    return 0;
+  }
+
+  // 编码结果最多为键值字节数的 3 倍：缓冲区足够时直接一遍写出，
+  // 否则先计算准确长度（只计算大小或缓冲区不足时返回该长度）
+  size_t seps = 2 * (size_t)n - 1;
+  if (!buffer || !encode || buffer_size <= seps ||
+      stringify_length(q, n, false) - seps >= (buffer_size - seps) / 3) {
+    size_t needed = stringify_length(q, n, encode);
+    if (!buffer || buffer_size <= needed) {
+      return needed;
+    }
+  }
+
+  char *pos = buffer;
+  for (uint32_t i = 0; i < n; i++) {
+    const struct llquery_kv *kv = &q->kv_pairs[i];
+    if (i > 0) {
+      *pos++ = '&';
+    }
+    pos = stringify_put(pos, kv->key, kv->key_len, encode);
+    *pos++ = '=';
+    pos = stringify_put(pos, kv->value, kv->value_len, encode);
+  }
+
+  *pos = '\0';
+  return (size_t)(pos - buffer);
+}
+
+/* 分块写出的状态：凑满 LQ_SINK_CHUNK 字节交给回调 */
+#define LQ_SINK_CHUNK 4096
+
+typedef struct {
+  char buf[LQ_SINK_CHUNK];
+  size_t used;
+  size_t total;                       /* 已交给回调的字节数 */
+  llquery_sink_cb sink;
+  void *user_data;
+} lq_sink_t;
+
+static bool sink_flush(lq_sink_t *w) {
+  if (w->used == 0) {
+    return true;
+  }
+  if (w->sink(w->buf, w->used, w->user_data) != 0) {
+    return false;
+  }
+  w->total += w->used;
+  w->used = 0;
+  return true;
+}
+
+/*
+ * 写出一段键或值。编码时每次取剩余空间三分之一的输入，保证编码结果放得下；
+ * 剩余空间不足一个编码块时先交出当前块，避免产生过小的分段
+ */
+static bool sink_put(lq_sink_t *w, const char *src, size_t len, bool encode) {
+  while (len > 0) {
+    size_t room = LQ_SINK_CHUNK - w->used;
+    size_t take;
+    if (encode) {
+      take = room / 3;
+      if (take < 16) {
+        if (!sink_flush(w)) return false;
+        continue;
+      }
+      if (take > len) take = len;
+      char *end = encode_span(w->buf + w->used, src, take,
+                              (unsigned char)(1u << LQENC_FORM), true);
+      w->used = (size_t)(end - w->buf);
+    } else {
+      if (room == 0) {
+        if (!sink_flush(w)) return false;
+        continue;
+      }
+      take = len < room ? len : room;
+      memcpy(w->buf + w->used, src, take);
+      w->used += take;
+    }
+    src += take;
+    len -= take;
+  }
+  return true;
+}
+
+static bool sink_byte(lq_sink_t *w, char c) {
+  if (w->used == LQ_SINK_CHUNK && !sink_flush(w)) {
+    return false;
+  }
+  w->buf[w->used++] = c;
+  return true;
+}
+
+size_t llquery_stringify_sink(const struct llquery *q,
+                              bool encode,
+                              llquery_sink_cb sink,
+                              void *user_data) {
+  uint32_t n = q ? kv_count(q) : 0;
+  if (!sink || n == 0 || !lazy_materialize_all(q)) {
+    return 0;
+  }
+
+  lq_sink_t w;
+  w.used = 0;
+  w.total = 0;
+  w.sink = sink;
+  w.user_data = user_data;
+
+  for (uint32_t i = 0; i < n; i++) {
+    const struct llquery_kv *kv = &q->kv_pairs[i];
+    if ((i > 0 && !sink_byte(&w, '&')) ||
+        !sink_put(&w, kv->key, kv->key_len, encode) ||
+        !sink_byte(&w, '=') ||
+        !sink_put(&w, kv->value, kv->value_len, encode)) {
+      return w.total;
+    }
+  }
+  sink_flush(&w);
+  return w.total;
+}
+
+/*
+ * 零拷贝序列化的输出状态。相邻的片段在内存中连续时合并为一项
+ * （零拷贝结果中未改写的 "k=v&k2=v2" 片段只占一项），分隔符先挂起，
+ * 下一片段紧接在原有分隔符之后时一并合并，否则指向静态分隔符
+ */
+typedef struct {
+  struct iovec *iov;
+  size_t cap;
+  size_t count;                       /* 已完成的项数（可能超过 cap） */
+  const char *base;                   /* 当前项，NULL 表示没有 */
+  size_t len;
+  char sep;                           /* 挂起的分隔符，0 表示没有 */
+} lq_iov_out_t;
+
+static const char LQ_SEP_AMP[] = "&";
+static const char LQ_SEP_EQ[] = "=";
+
+static void iov_close(lq_iov_out_t *o) {
+  if (o->base) {
+    if (o->count < o->cap) {
+      o->iov[o->count].iov_base = (void *)(uintptr_t)o->base;
+      o->iov[o->count].iov_len = o->len;
+    }
+    o->count++;
+    o->base = NULL;
+  }
+}
+
+static void iov_flush_sep(lq_iov_out_t *o) {
+  if (o->sep) {
+    iov_close(o);
+    o->base = o->sep == '&' ? LQ_SEP_AMP : LQ_SEP_EQ;
+    o->len = 1;
+    o->sep = 0;
+  }
+}
+
+static void iov_piece(lq_iov_out_t *o, const char *p, size_t len) {
+  if (len == 0) {
+    return;
+  }
+  if (o->sep) {
+    // 原输入中分隔符仍在两段之间
+    if (o->base && p == o->base + o->len + 1 && p[-1] == o->sep) {
+      o->len += 1 + len;
+      o->sep = 0;
+      return;
+    }
+    iov_flush_sep(o);
+  }
+  if (o->base && p == o->base + o->len) {
+    o->len += len;
+    return;
+  }
+  iov_close(o);
+  o->base = p;
+  o->len = len;
+}
+
+static void iov_sep(lq_iov_out_t *o, char sep) {
+  iov_flush_sep(o);
+  o->sep = sep;
+}
+
+enum llquery_error llquery_stringify_iov(const struct llquery *q,
+                                         bool encode,
+                                         struct iovec *iov,
+                                         int *iovcnt,
+                                         char *scratch,
+                                         size_t *scratch_size) {
+  if (!q || !iovcnt || !scratch_size || (*iovcnt > 0 && !iov) ||
+      (*scratch_size > 0 && !scratch)) {
+    return LQE_NULL_INPUT;
+  }
+  if (!lazy_materialize_all(q)) {
+    return LQE_MEMORY_ERROR;
+  }
+
+  const unsigned char bit = (unsigned char)(1u << LQENC_FORM);
+  lq_iov_out_t o;
+  o.iov = iov;
+  o.cap = *iovcnt > 0 ? (size_t)*iovcnt : 0;
+  o.count = 0;
+  o.base = NULL;
+  o.len = 0;
+  o.sep = 0;
+
+  size_t scratch_cap = *scratch_size;
+  size_t used = 0;
+  uint32_t n = kv_count(q);
+  for (uint32_t i = 0; i < n; i++) {
+    const struct llquery_kv *kv = &q->kv_pairs[i];
+    if (i > 0) {
+      iov_sep(&o, '&');
+    }
+    for (int part = 0; part < 2; part++) {
+      const char *p = part ? kv->value : kv->key;
+      size_t len = part ? kv->value_len : kv->key_len;
+      if (part) {
+        iov_sep(&o, '=');
+      }
+      if (!encode || !encode_needed((const unsigned char *)p, len, bit)) {
+        iov_piece(&o, p, len);
+        continue;
+      }
+      size_t enc_len = encoded_length((const unsigned char *)p, len, bit, true);
+      // 需要编码的片段写入临时区；空间不足时只累计所需大小，
+      // 之后的项数按不合并计算（上限）
+      if (used + enc_len <= scratch_cap) {
+        encode_span(scratch + used, p, len, bit, true);
+        iov_piece(&o, scratch + used, enc_len);
       } else {
-        value_end = end;
-        current = end;
+        iov_flush_sep(&o);
+        iov_close(&o);
+        o.count++;
       }
-    } else {
-      // 无值
-      value_start = value_end = current;
+      used += enc_len;
     }
+  }
+  iov_flush_sep(&o);
+  iov_close(&o);
 
-    // 跳过空 key
-    if (UNLIKELY(key_end - key_start == 0)) {
-      if (current < end && IS_SEPARATOR(*current)) current++;
-      continue;
-    }
+  *scratch_size = used;
+  *iovcnt = o.count > INT_MAX ? INT_MAX : (int)o.count;
+  return (o.count > o.cap || used > scratch_cap) ? LQE_BUFFER_TOO_SMALL : LQE_OK;
+}
 
-    // 存储 kv
-    struct llquery_kv *kv = &q->kv_pairs[kv_index];
-    // 先计算长度
-    kv->key_len = (size_t)(key_end - key_start);
-    kv->value_len = (size_t)(value_end - value_start);
-    
-    // 阶段5优化：使用内存池分配 key 和 value
-    char *key_buf = pool_alloc_string(internal, kv->key_len + 1);
-    if (UNLIKELY(!key_buf)) {
-      // 设置当前已成功解析的数量，然后返回错误
-      q->kv_count = kv_index;
+enum llquery_error llquery_clone(struct llquery *dst,
+                                 const struct llquery *src) {
+  if (!dst || !src) {
+    return LQE_NULL_INPUT;
+  }
+  if (!lazy_materialize_all(src)) {
+    return LQE_MEMORY_ERROR;
+  }
+
+  // 初始化目标（可增长模式沿用源的数量上限，并按实际数量预留容量）
+  const llquery_internal_t *src_internal = (const llquery_internal_t *)src->_reserved;
+  uint32_t n = kv_count(src);
+  enum llquery_error err;
+  if (src_internal && src_internal->kv_growable) {
+    err = llquery_init_growable(dst, src_internal->kv_limit, src->flags);
+  } else {
+    err = llquery_init(dst, src->max_kv_count, src->flags);
+  }
+  if (err != LQE_OK) {
+    return err;
+  }
+
+  llquery_internal_t *internal = get_internal(dst);
+  if (!kv_reserve(dst, internal, 0, n)) {
+    llquery_free(dst);
+    return LQE_MEMORY_ERROR;
+  }
+
+  // 复制基本字段
+  dst->field_set = src->field_set;
+  set_kv_count(dst, internal, n);
+  internal->kv_sorted = src_internal && src_internal->kv_sorted;
+  if (src_internal && src_internal->schema) {
+    if (llquery_set_schema(dst, src_internal->schema) != LQE_OK) {
+      llquery_free(dst);
       return LQE_MEMORY_ERROR;
     }
-    memcpy(key_buf, key_start, kv->key_len);
-    key_buf[kv->key_len] = '\0';
-    kv->key = key_buf;
-    
-    char *val_buf = pool_alloc_string(internal, kv->value_len + 1);
-    if (UNLIKELY(!val_buf)) {
-      // 释放key_buf（如果不在池中）
-      bool key_in_pool = (internal->string_pool && 
-                          key_buf >= internal->string_pool &&
-                          key_buf < internal->string_pool + internal->string_pool_size);
-      if (!key_in_pool) {
-        internal->free_fn(key_buf, internal->alloc_data);
-      }
-      q->kv_count = kv_index;
+    internal->unknown_count = src_internal->unknown_count;
+  }
+  if (src_internal) {
+    internal->intern = src_internal->intern;
+    internal->intern_learn = src_internal->intern_learn;
+  }
+
+  // 按总长度一次性分配内存池
+  size_t pool_size = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    pool_size += src->kv_pairs[i].key_len + src->kv_pairs[i].value_len + 2;
+  }
+  pool_prepare(internal, pool_size);
+
+  // 深拷贝键值对
+  for (uint32_t i = 0; i < n; i++) {
+    const struct llquery_kv *src_kv = &src->kv_pairs[i];
+    struct llquery_kv *dst_kv = &dst->kv_pairs[i];
+
+    // 复制 key
+    char *key_buf = pool_alloc_string(internal, src_kv->key_len + 1);
+    if (!key_buf) {
+      llquery_free(dst);
       return LQE_MEMORY_ERROR;
     }
-    memcpy(val_buf, value_start, kv->value_len);
-    val_buf[kv->value_len] = '\0';
-    kv->value = val_buf;
-    kv->is_encoded = has_encoded;
-
-    if (UNLIKELY(q->flags & LQF_LOWERCASE_KEYS))
-      lowercase_string((char *)kv->key, kv->key_len);
-    if (UNLIKELY(q->flags & LQF_TRIM_VALUES))
-      kv->value = trim_string((char *)kv->value, &kv->value_len);
-
-    // 检查是否保留空值
-    if (UNLIKELY(!(q->flags & LQF_KEEP_EMPTY) && kv->value_len == 0)) {
-      // 检查字符串是否在内存池中，只释放不在池中的
-      bool key_in_pool = (internal->string_pool && 
-                          key_buf >= internal->string_pool &&
-                          key_buf < internal->string_pool + internal->string_pool_size);
-      bool val_in_pool = (internal->string_pool && 
-                          val_buf >= internal->string_pool &&
-                          val_buf < internal->string_pool + internal->string_pool_size);
-      if (!key_in_pool) {
-        internal->free_fn(key_buf, internal->alloc_data);
-      }
-      if (!val_in_pool) {
-        internal->free_fn(val_buf, internal->alloc_data);
-      }
-      if (current < end && IS_SEPARATOR(*current)) current++;
-      continue;
-    }
+    memcpy(key_buf, src_kv->key, src_kv->key_len);
+    key_buf[src_kv->key_len] = '\0';
+    dst_kv->key = key_buf;
+    dst_kv->key_len = src_kv->key_len;
 
-    kv_index++;
-    if (current < end && IS_SEPARATOR(*current)) current++;
+    // 复制 value
+    char *val_buf = pool_alloc_string(internal, src_kv->value_len + 1);
+    if (!val_buf) {
+      llquery_free(dst);
+      return LQE_MEMORY_ERROR;
+    }
+    memcpy(val_buf, src_kv->value, src_kv->value_len);
+    val_buf[src_kv->value_len] = '\0';
+    dst_kv->value = val_buf;
+    dst_kv->value_len = src_kv->value_len;
+    dst_kv->is_encoded = src_kv->is_encoded;
+    dst_kv->_state = 0;
+    dst_kv->invalid_utf8 = src_kv->invalid_utf8;
+    dst_kv->key_id = src_kv->key_id;
   }
 
-  q->kv_count = kv_index;
-  q->field_set = 0xFF; // 设置所有字段
-
-  // 检查是否超过限制
-  if (UNLIKELY(current < end && kv_index >= q->max_kv_count)) {
-    if (q->flags & LQF_STRICT) {
-      return LQE_TOO_MANY_PAIRS;
+  // 如果需要，复制解码缓冲区
+  if (src->decode_buffer && src->decode_buffer_size > 0) {
+    char *buf = internal->alloc_fn(src->decode_buffer_size, internal->alloc_data);
+    if (!buf) {
+      llquery_free(dst);
+      return LQE_MEMORY_ERROR;
     }
+    memcpy(buf, src->decode_buffer, src->decode_buffer_size);
+    dst->decode_buffer = buf;
+    dst->decode_buffer_size = src->decode_buffer_size;
+    internal->owned_decode_buffer = buf;
+    internal->owned_decode_size = src->decode_buffer_size;
+    internal->decode_buffer_owned = true;
   }
 
   return LQE_OK;
 }
 
-void llquery_free(struct llquery *q) {
-  if (!q || !q->_reserved) {
-    return;
-  }
+/* 紧凑结果的单块内存布局：头部 | 条目数组 | 标志数组 | 数据区 */
+typedef struct lq_compact_block {
+  llquery_free_fn free_fn;
+  void *alloc_data;
+} lq_compact_block_t;
 
-  llquery_internal_t *internal = get_internal(q);
+/* 紧凑条目：值紧跟在键的 '\0' 之后，不单独存偏移 */
+typedef struct lq_compact_kv {
+  uint32_t offset;           /* 键在数据区中的偏移 */
+  uint32_t key_len;
+  uint32_t value_len;
+} lq_compact_kv_t;
 
-  // 阶段5优化：释放字符串
-  if (q->kv_pairs) {
-    for (uint16_t i = 0; i < q->kv_count; i++) {
-      // 检查key是否需要释放
-      if (q->kv_pairs[i].key) {
-        // 如果有内存池，检查指针是否在池中
-        bool in_pool = (internal->string_pool && 
-                        q->kv_pairs[i].key >= internal->string_pool &&
-                        q->kv_pairs[i].key < internal->string_pool + internal->string_pool_size);
-        if (!in_pool) {
-          internal->free_fn((void *)q->kv_pairs[i].key, internal->alloc_data);
-        }
-      }
-      // 检查value是否需要释放
-      if (q->kv_pairs[i].value) {
-        bool in_pool = (internal->string_pool && 
-                        q->kv_pairs[i].value >= internal->string_pool &&
-                        q->kv_pairs[i].value < internal->string_pool + internal->string_pool_size);
-        if (!in_pool) {
-          internal->free_fn((void *)q->kv_pairs[i].value, internal->alloc_data);
-        }
-      }
-    }
+#define LQ_COMPACT_ENCODED 0x01  /* 对应 llquery_kv::is_encoded */
+#define LQ_COMPACT_INVALID_UTF8 0x02  /* 对应 llquery_kv::invalid_utf8 */
+
+static const lq_compact_kv_t *compact_entries(const struct llquery_compact *c) {
+  return (const lq_compact_kv_t *)((const lq_compact_block_t *)c->_reserved + 1);
+}
+
+static const uint8_t *compact_flags(const struct llquery_compact *c) {
+  return (const uint8_t *)(compact_entries(c) + c->kv_count);
+}
+
+enum llquery_error llquery_compact_build(struct llquery_compact *dst,
+                                         const struct llquery *src) {
+  if (!dst || !src || !src->_reserved) {
+    return LQE_NULL_INPUT;
   }
-  
-  // 释放内存池（如果拥有）
-  if (internal->string_pool_owned && internal->string_pool) {
-    internal->free_fn(internal->string_pool, internal->alloc_data);
+  memset(dst, 0, sizeof(*dst));
+  if (!lazy_materialize_all(src)) {
+    return LQE_MEMORY_ERROR;
   }
-  
-  // 释放键值对数组
-  if (q->kv_pairs) {
-    internal->free_fn(q->kv_pairs, internal->alloc_data);
+
+  const llquery_internal_t *internal = (const llquery_internal_t *)src->_reserved;
+  uint32_t n = internal->kv_count;
+
+  // 数据区按总长度一次算出，超出 32 位偏移范围时拒绝
+  uint64_t data_size = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    data_size += (uint64_t)src->kv_pairs[i].key_len + src->kv_pairs[i].value_len + 2;
+  }
+  if (data_size > UINT32_MAX) {
+    return LQE_BUFFER_TOO_SMALL;
   }
 
-  // 释放解码缓冲区
-  if (q->decode_buffer && internal->decode_buffer_owned) {
-    internal->free_fn((void *)q->decode_buffer, internal->alloc_data);
+  size_t head = sizeof(lq_compact_block_t) + sizeof(lq_compact_kv_t) * (size_t)n + n;
+  lq_compact_block_t *block = internal->alloc_fn(head + (size_t)data_size + 1,
+                                                 internal->alloc_data);
+  if (!block) {
+    return LQE_MEMORY_ERROR;
   }
+  block->free_fn = internal->free_fn;
+  block->alloc_data = internal->alloc_data;
+
+  lq_compact_kv_t *entries = (lq_compact_kv_t *)(block + 1);
+  uint8_t *flags = (uint8_t *)(entries + n);
+  char *data = (char *)block + head;
+
+  uint32_t off = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    const struct llquery_kv *kv = &src->kv_pairs[i];
+    entries[i].offset = off;
+    entries[i].key_len = (uint32_t)kv->key_len;
+    entries[i].value_len = (uint32_t)kv->value_len;
+    flags[i] = (uint8_t)((kv->is_encoded ? LQ_COMPACT_ENCODED : 0) |
+                         (kv->invalid_utf8 ? LQ_COMPACT_INVALID_UTF8 : 0));
 
-  // 释放内部结构
-  internal->free_fn(internal, internal->alloc_data);
+    if (kv->key_len > 0) {
+      memcpy(data + off, kv->key, kv->key_len);
+    }
+    off += (uint32_t)kv->key_len;
+    data[off++] = '\0';
+    if (kv->value_len > 0) {
+      memcpy(data + off, kv->value, kv->value_len);
+    }
+    off += (uint32_t)kv->value_len;
+    data[off++] = '\0';
+  }
+  data[off] = '\0';
 
-  // 清零结构体
-  memset(q, 0, sizeof(struct llquery));
+  dst->kv_count = n;
+  dst->data_size = off;
+  dst->data = data;
+  dst->_reserved = block;
+  return LQE_OK;
 }
 
-uint16_t llquery_count(const struct llquery *q) {
-  return q ? q->kv_count : 0;
+void llquery_compact_free(struct llquery_compact *c) {
+  if (!c || !c->_reserved) {
+    return;
+  }
+  lq_compact_block_t *block = (lq_compact_block_t *)c->_reserved;
+  block->free_fn(block, block->alloc_data);
+  memset(c, 0, sizeof(*c));
 }
 
-const struct llquery_kv *llquery_get_kv(const struct llquery *q,
-                                        uint16_t index) {
-  if (!q || index >= q->kv_count) {
-    return NULL;
+bool llquery_compact_get_kv(const struct llquery_compact *c,
+                            uint32_t index,
+                            struct llquery_kv *kv) {
+  if (!c || !kv || !c->_reserved || index >= c->kv_count) {
+    return false;
   }
-  return &q->kv_pairs[index];
+  const lq_compact_kv_t *e = &compact_entries(c)[index];
+  kv->key = c->data + e->offset;
+  kv->key_len = e->key_len;
+  kv->value = kv->key + e->key_len + 1;
+  kv->value_len = e->value_len;
+  kv->is_encoded = (compact_flags(c)[index] & LQ_COMPACT_ENCODED) != 0;
+  kv->invalid_utf8 = (compact_flags(c)[index] & LQ_COMPACT_INVALID_UTF8) != 0;
+  kv->_state = 0;
+  kv->key_id = 0;
+  return true;
 }
 
-const char *llquery_get_value(const struct llquery *q,
-                              const char *key,
-                              size_t key_len) {
-  if (!q || !key) {
+const char *llquery_compact_get_value(const struct llquery_compact *c,
+                                      const char *key,
+                                      size_t key_len) {
+  if (!c || !key || !c->_reserved) {
     return NULL;
   }
 
@@ -577,388 +4189,510 @@ const char *llquery_get_value(const struct llquery *q,
     key_len = strlen(key);
   }
 
-  for (uint16_t i = 0; i < q->kv_count; i++) {
-    const struct llquery_kv *kv = &q->kv_pairs[i];
-    if (kv->key_len == key_len &&
-      memcmp(kv->key, key, key_len) == 0) {
-      return kv->value_len > 0 ? kv->value : "";
+  const lq_compact_kv_t *entries = compact_entries(c);
+  for (uint32_t i = 0; i < c->kv_count; i++) {
+    const char *k = c->data + entries[i].offset;
+    if (entries[i].key_len == key_len && memcmp(k, key, key_len) == 0) {
+      return k + key_len + 1;
     }
   }
-
   return NULL;
 }
 
-uint16_t llquery_get_all_values(const struct llquery *q,
-                                const char *key,
-                                size_t key_len,
-                                const char **values,
-                                uint16_t max_values) {
-  if (!q || !key || !values || max_values == 0) {
-    return 0;
+/*
+ * 键模式
+ */
+enum llquery_error llquery_schema_create(struct llquery_schema **out,
+                                         const char *const *keys,
+                                         uint32_t key_count,
+                                         uint16_t flags) {
+  return llquery_schema_create_ex(out, keys, key_count, flags,
+                                  default_alloc, default_free, NULL);
+}
+
+/* 建表的临时数组，一次分配 */
+typedef struct {
+  uint64_t *hash;            /* 每个键的哈希 */
+  uint32_t *len;             /* 每个键的长度 */
+  uint32_t *pos;             /* 每个键在 entries 中的位置 */
+  uint32_t *order;           /* 按桶分组的键下标 */
+  uint32_t *start;           /* 每个桶在 order 中的起点，共 bucket_count + 1 项 */
+  uint32_t *by_size;         /* 按大小降序排列的桶 */
+  uint32_t *count;           /* 计数排序用，共 key_count + 2 项 */
+  uint8_t *used;             /* entries 中已占用的项 */
+} lq_schema_work_t;
+
+/* 以给定种子为每个桶搜索位移；键哈希相同时区分重复键与碰撞 */
+static enum llquery_error schema_build(struct llquery_schema *schema, uint16_t *disp,
+                                       const char *const *keys, lq_schema_work_t *w,
+                                       uint64_t seed, bool *retry) {
+  uint32_t n = schema->key_count;
+  uint32_t nb = schema->bucket_count;
+  uint32_t mask = schema->mask;
+  *retry = false;
+  memset(disp, 0, sizeof(uint16_t) * (size_t)nb);
+
+  for (uint32_t i = 0; i < n; i++) {
+    w->hash[i] = schema_hash(seed, keys[i], w->len[i]);
   }
 
-  if (key_len == 0) {
-    key_len = strlen(key);
+  // 按桶分组
+  memset(w->start, 0, sizeof(uint32_t) * ((size_t)nb + 1));
+  for (uint32_t i = 0; i < n; i++) {
+    w->start[schema_bucket(w->hash[i], nb) + 1]++;
+  }
+  uint32_t max_size = 0;
+  for (uint32_t b = 0; b < nb; b++) {
+    if (w->start[b + 1] > max_size) max_size = w->start[b + 1];
+    w->start[b + 1] += w->start[b];
+  }
+  for (uint32_t b = 0; b < nb; b++) w->by_size[b] = w->start[b];
+  for (uint32_t i = 0; i < n; i++) {
+    w->order[w->by_size[schema_bucket(w->hash[i], nb)]++] = i;
   }
 
-  uint16_t count = 0;
-  for (uint16_t i = 0; i < q->kv_count && count < max_values; i++) {
-    const struct llquery_kv *kv = &q->kv_pairs[i];
-    if (kv->key_len == key_len &&
-      memcmp(kv->key, key, key_len) == 0) {
-      values[count++] = kv->value_len > 0 ? kv->value : "";
-    }
+  // 大桶先放：表还空时容易找到位移，最后放的都是单键桶
+  memset(w->count, 0, sizeof(uint32_t) * ((size_t)max_size + 2));
+  for (uint32_t b = 0; b < nb; b++) {
+    w->count[max_size - (w->start[b + 1] - w->start[b]) + 1]++;
+  }
+  for (uint32_t k = 1; k <= max_size + 1; k++) w->count[k] += w->count[k - 1];
+  for (uint32_t b = 0; b < nb; b++) {
+    w->by_size[w->count[max_size - (w->start[b + 1] - w->start[b])]++] = b;
   }
 
-  return count;
-}
+  memset(w->used, 0, (size_t)mask + 1);
+  for (uint32_t r = 0; r < nb; r++) {
+    uint32_t b = w->by_size[r];
+    const uint32_t *members = w->order + w->start[b];
+    uint32_t size = w->start[b + 1] - w->start[b];
+    if (size == 0) break;  // 其后都是空桶
+
+    for (uint32_t j = 1; j < size; j++) {
+      for (uint32_t k = 0; k < j; k++) {
+        uint32_t x = members[j], y = members[k];
+        if (UNLIKELY(w->hash[x] == w->hash[y])) {
+          if (w->len[x] == w->len[y] && memcmp(keys[x], keys[y], w->len[x]) == 0) {
+            return LQE_INVALID_FORMAT;
+          }
+          *retry = true;
+          return LQE_OK;
+        }
+      }
+    }
 
-bool llquery_has_key(const struct llquery *q,
-                     const char *key,
-                     size_t key_len) {
-  if (!q || !key) {
-    return false;
+    uint32_t d = 0;
+    for (; d <= LQ_SCHEMA_MAX_DISP; d++) {
+      uint32_t j = 0;
+      for (; j < size; j++) {
+        uint32_t p = schema_pos(w->hash[members[j]], d, mask);
+        if (w->used[p]) break;
+        w->used[p] = 1;
+        w->pos[members[j]] = p;
+      }
+      if (j == size) break;
+      while (j > 0) w->used[w->pos[members[--j]]] = 0;
+    }
+    if (UNLIKELY(d > LQ_SCHEMA_MAX_DISP)) {
+      *retry = true;
+      return LQE_OK;
+    }
+    disp[b] = (uint16_t)d;
   }
+  return LQE_OK;
+}
 
-  if (key_len == 0) {
-    key_len = strlen(key);
+enum llquery_error llquery_schema_create_ex(struct llquery_schema **out,
+                                            const char *const *keys,
+                                            uint32_t key_count,
+                                            uint16_t flags,
+                                            llquery_alloc_fn alloc_fn,
+                                            llquery_free_fn free_fn,
+                                            void *alloc_data) {
+  if (!out || (!keys && key_count > 0) || !alloc_fn || !free_fn) {
+    return LQE_NULL_INPUT;
+  }
+  *out = NULL;
+  if (key_count > LQ_SCHEMA_MAX_KEYS) {
+    return LQE_TOO_MANY_PAIRS;
   }
 
-  for (uint16_t i = 0; i < q->kv_count; i++) {
-    const struct llquery_kv *kv = &q->kv_pairs[i];
-    if (kv->key_len == key_len &&
-      memcmp(kv->key, key, key_len) == 0) {
-      return true;
+  // 空键永远不会被解析出来；重复的键在建表时发现
+  size_t key_bytes = 0;
+  for (uint32_t i = 0; i < key_count; i++) {
+    if (!keys[i]) {
+      return LQE_NULL_INPUT;
+    }
+    size_t len = strlen(keys[i]);
+    if (len == 0) {
+      return LQE_INVALID_FORMAT;
     }
+#if SIZE_MAX > UINT32_MAX
+    if (len > UINT32_MAX) {
+      return LQE_INVALID_FORMAT;
+    }
+#endif
+    key_bytes += len + 1;
   }
 
-  return false;
-}
+  // 装载率 0.4～0.8，平均每桶 4 个键
+  uint32_t size = 8;
+  while (size < key_count + key_count / 4) size *= 2;
+  uint32_t nb = key_count / LQ_SCHEMA_BUCKET_SIZE + 1;
 
-uint16_t llquery_iterate(const struct llquery *q,
-                         llquery_iter_cb callback,
-                         void *user_data) {
-  if (!q || !callback) {
-    return 0;
+  size_t table_bytes = sizeof(struct llquery_schema) + sizeof(lq_schema_entry_t) * (size_t)size;
+  size_t disp_bytes = sizeof(uint16_t) * (size_t)nb;
+  struct llquery_schema *schema = alloc_fn(table_bytes + disp_bytes + key_bytes, alloc_data);
+  if (!schema) {
+    return LQE_MEMORY_ERROR;
+  }
+  memset(schema, 0, table_bytes);
+  uint16_t *disp = (uint16_t *)((char *)schema + table_bytes);
+  schema->disp = disp;
+  schema->mask = size - 1;
+  schema->bucket_count = nb;
+  schema->key_count = key_count;
+  schema->flags = flags;
+  schema->free_fn = free_fn;
+  schema->alloc_data = alloc_data;
+
+  size_t n = key_count;
+  size_t work_bytes = sizeof(uint64_t) * n + sizeof(uint32_t) * (n * 3 + (size_t)nb * 2 + 1 +
+                                                                 n + 2) + size;
+  char *work = alloc_fn(work_bytes, alloc_data);
+  if (!work) {
+    free_fn(schema, alloc_data);
+    return LQE_MEMORY_ERROR;
+  }
+  lq_schema_work_t w;
+  w.hash = (uint64_t *)work;
+  w.len = (uint32_t *)(w.hash + n);
+  w.pos = w.len + n;
+  w.order = w.pos + n;
+  w.start = w.order + n;
+  w.by_size = w.start + nb + 1;
+  w.count = w.by_size + nb;
+  w.used = (uint8_t *)(w.count + n + 2);
+  for (uint32_t i = 0; i < key_count; i++) {
+    w.len[i] = (uint32_t)strlen(keys[i]);
   }
 
-  uint16_t count = 0;
-  for (uint16_t i = 0; i < q->kv_count; i++) {
-    if (callback(&q->kv_pairs[i], user_data) != 0) {
+  // 只有两个不同键的 64 位哈希相同（或位移搜索耗尽）时才需要换种子
+  enum llquery_error err = LQE_INTERNAL_ERROR;
+  uint64_t state = 0x243F6A8885A308D3ULL;
+  for (int t = 0; t < LQ_SCHEMA_SEED_TRIES; t++) {
+    uint64_t seed = splitmix64(&state);
+    bool retry;
+    enum llquery_error e = schema_build(schema, disp, keys, &w, seed, &retry);
+    if (e != LQE_OK) {
+      err = e;
+      break;
+    }
+    if (!retry) {
+      schema->seed = seed;
+      err = LQE_OK;
       break;
     }
-    count++;
   }
-
-  return count;
-}
-
-enum llquery_error llquery_sort(struct llquery *q,
-                                llquery_compare_cb compare_fn) {
-  if (!q || q->kv_count < 2) {
-    return LQE_OK;
+  if (err != LQE_OK) {
+    free_fn(work, alloc_data);
+    free_fn(schema, alloc_data);
+    return err;
   }
 
-  // 简单的冒泡排序（对于小数据集足够）
-  for (uint16_t i = 0; i < q->kv_count - 1; i++) {
-    for (uint16_t j = 0; j < q->kv_count - i - 1; j++) {
-      struct llquery_kv *a = &q->kv_pairs[j];
-      struct llquery_kv *b = &q->kv_pairs[j + 1];
+  char *data = (char *)disp + disp_bytes;
+  for (uint32_t i = 0; i < key_count; i++) {
+    memcpy(data, keys[i], (size_t)w.len[i] + 1);
+    lq_schema_entry_t *e = &schema->entries[w.pos[i]];
+    e->key = data;
+    e->key_len = w.len[i];
+    e->slot = i;
+    data += w.len[i] + 1;
+  }
+  free_fn(work, alloc_data);
 
-      int cmp;
-      if (compare_fn) {
-        cmp = compare_fn(a, b);
-      } else {
-        cmp = compare_keys(a->key, a->key_len, b->key, b->key_len);
-      }
+  *out = schema;
+  return LQE_OK;
+}
 
-      if (cmp > 0) {
-        // 交换
-        struct llquery_kv temp = *a;
-        *a = *b;
-        *b = temp;
-      }
-    }
+void llquery_schema_free(struct llquery_schema *schema) {
+  if (schema) {
+    schema->free_fn(schema, schema->alloc_data);
   }
+}
 
-  return LQE_OK;
+int32_t llquery_schema_slot(const struct llquery_schema *schema,
+                            const char *key,
+                            size_t key_len) {
+  if (!schema || !key) {
+    return -1;
+  }
+  if (key_len == 0) {
+    key_len = strlen(key);
+  }
+  uint32_t slot = schema_find(schema, key, key_len);
+  return slot == LQ_NPOS ? -1 : (int32_t)slot;
 }
 
-uint16_t llquery_filter(struct llquery *q,
-                        bool (*filter_fn)(const struct llquery_kv *kv, void *user_data),
-                        void *user_data) {
-  if (!q || !filter_fn) {
-    return 0;
+enum llquery_error llquery_set_schema(struct llquery *q,
+                                      const struct llquery_schema *schema) {
+  if (!q || !q->_reserved) {
+    return LQE_NULL_INPUT;
   }
 
   llquery_internal_t *internal = get_internal(q);
-  uint16_t write_idx = 0;
-  
-  for (uint16_t read_idx = 0; read_idx < q->kv_count; read_idx++) {
-    if (filter_fn(&q->kv_pairs[read_idx], user_data)) {
-      // Keep this item
-      if (write_idx != read_idx) {
-        // Before overwriting write_idx position, free its old content if it hasn't been moved yet
-        // We know it hasn't been moved if write_idx < read_idx and we haven't processed it yet
-        // Actually, anything at write_idx that we're about to overwrite needs to be checked:
-        // If the item at write_idx was already copied forward, its pointers are now at an earlier position
-        // If the item at write_idx was filtered out, it was already freed
-        // If the item at write_idx was kept but we're now overwriting it, we need to free it
-        
-        // The key insight: positions < write_idx have been finalized (either copied to or freed)
-        // Position write_idx might still have old data that needs freeing
-        // But ONLY if read_idx is far enough ahead that write_idx hasn't been processed yet
-        
-        // Simple solution: always free what's at write_idx before overwriting if it's different
-        // But we must be careful not to double-free
-        
-        // Actually, let's use a different approach: mark positions as we move them
-        // Or simpler: only free items that are definitely filtered out
-        
-        // New approach: track that position read_idx data is being moved
-        // When we move data FROM read_idx TO write_idx, the write_idx position loses its data
-        // We need to free write_idx's old data IFF it wasn't already moved elsewhere
-        
-        // Safest approach: mark pointers as NULL after moving
-        q->kv_pairs[write_idx] = q->kv_pairs[read_idx];
-        // Clear the source to prevent double-free
-        q->kv_pairs[read_idx].key = NULL;
-        q->kv_pairs[read_idx].value = NULL;
-      }
-      write_idx++;
-    } else {
-      // Free the filtered-out key/value pair
-      // 检查是否在内存池中
-      if (q->kv_pairs[read_idx].key) {
-        bool in_pool = (internal->string_pool && 
-                        q->kv_pairs[read_idx].key >= internal->string_pool &&
-                        q->kv_pairs[read_idx].key < internal->string_pool + internal->string_pool_size);
-        if (!in_pool) {
-          internal->free_fn((void *)q->kv_pairs[read_idx].key, internal->alloc_data);
-        }
-        q->kv_pairs[read_idx].key = NULL;
-      }
-      if (q->kv_pairs[read_idx].value) {
-        bool in_pool = (internal->string_pool && 
-                        q->kv_pairs[read_idx].value >= internal->string_pool &&
-                        q->kv_pairs[read_idx].value < internal->string_pool + internal->string_pool_size);
-        if (!in_pool) {
-          internal->free_fn((void *)q->kv_pairs[read_idx].value, internal->alloc_data);
-        }
-        q->kv_pairs[read_idx].value = NULL;
-      }
+  if (schema && schema->key_count > internal->slot_cap) {
+    uint32_t *slots = internal->alloc_fn(sizeof(uint32_t) * (size_t)schema->key_count,
+                                         internal->alloc_data);
+    if (!slots) {
+      return LQE_MEMORY_ERROR;
     }
-  }
-  
-  // Free any remaining items beyond write_idx that weren't freed yet
-  for (uint16_t i = write_idx; i < q->kv_count; i++) {
-    if (q->kv_pairs[i].key) {
-      // 检查是否在内存池中
-      bool in_pool = (internal->string_pool && 
-                      q->kv_pairs[i].key >= internal->string_pool &&
-                      q->kv_pairs[i].key < internal->string_pool + internal->string_pool_size);
-      if (!in_pool) {
-        internal->free_fn((void *)q->kv_pairs[i].key, internal->alloc_data);
-      }
-      q->kv_pairs[i].key = NULL;
-    }
-    if (q->kv_pairs[i].value) {
-      bool in_pool = (internal->string_pool && 
-                      q->kv_pairs[i].value >= internal->string_pool &&
-                      q->kv_pairs[i].value < internal->string_pool + internal->string_pool_size);
-      if (!in_pool) {
-        internal->free_fn((void *)q->kv_pairs[i].value, internal->alloc_data);
-      }
-      q->kv_pairs[i].value = NULL;
+    if (internal->slot_first) {
+      internal->free_fn(internal->slot_first, internal->alloc_data);
     }
+    internal->slot_first = slots;
+    internal->slot_cap = schema->key_count;
   }
 
-  q->kv_count = write_idx;
-  return write_idx;
+  // 已有的结果在访问槽位时按新模式重新填充
+  internal->schema = schema;
+  internal->slots_valid = false;
+  internal->unknown_count = 0;
+  return LQE_OK;
 }
 
-size_t llquery_stringify(const struct llquery *q,
-                         char *buffer,
-                         size_t buffer_size,
-                         bool encode) {
-  // Note: encode parameter reserved for future URL encoding support
-  (void)encode;  // Suppress unused parameter warning
-  
-  if (!q || q->kv_count == 0) {
-    if (buffer && buffer_size > 0) {
-      buffer[0] = '\0';
-    }
-    return 0;
+const struct llquery_kv *llquery_get_slot(const struct llquery *q,
+                                          uint32_t slot) {
+  if (!q || !q->_reserved) {
+    return NULL;
   }
-
-  size_t needed = 0;
-
-  // 计算所需空间
-  for (uint16_t i = 0; i < q->kv_count; i++) {
-    const struct llquery_kv *kv = &q->kv_pairs[i];
-    if (i > 0) needed++; // '&'
-    needed += kv->key_len;
-    needed++; // '='
-    needed += kv->value_len;
+  llquery_internal_t *internal = (llquery_internal_t *)q->_reserved;
+  if (!internal->schema || slot >= internal->schema->key_count) {
+    return NULL;
+  }
+  if (UNLIKELY(!internal->slots_valid) && !slots_build(q, internal)) {
+    return NULL;
   }
 
-  needed++; // 终止符
-
-  // 如果只计算大小，返回所需空间
-  if (!buffer || buffer_size == 0) {
-    return needed - 1; // 不包括终止符
+  uint32_t i = internal->slot_first[slot];
+  if (i == LQ_NPOS || !lazy_materialize(q, &q->kv_pairs[i])) {
+    return NULL;
   }
+  return &q->kv_pairs[i];
+}
 
-  // 检查缓冲区是否足够
-  if (buffer_size < needed) {
-    return needed - 1;
+const char *llquery_get_slot_value(const struct llquery *q,
+                                   uint32_t slot) {
+  const struct llquery_kv *kv = llquery_get_slot(q, slot);
+  if (!kv) {
+    return NULL;
   }
+  return kv->value_len > 0 ? kv->value : "";
+}
 
-  // 格式化字符串
-  char *pos = buffer;
-  for (uint16_t i = 0; i < q->kv_count; i++) {
-    const struct llquery_kv *kv = &q->kv_pairs[i];
+uint32_t llquery_unknown_count(const struct llquery *q) {
+  if (!q || !q->_reserved) {
+    return 0;
+  }
+  return ((const llquery_internal_t *)q->_reserved)->unknown_count;
+}
 
-    if (i > 0) {
-      *pos++ = '&';
-    }
+/*
+ * 键驻留
+ */
+enum llquery_error llquery_intern_create(struct llquery_intern **out,
+                                         uint32_t max_keys) {
+  return llquery_intern_create_ex(out, max_keys, default_alloc, default_free, NULL);
+}
 
-    // 复制键
-    if (kv->key_len > 0) {
-      memcpy(pos, kv->key, kv->key_len);
-      pos += kv->key_len;
-    }
+enum llquery_error llquery_intern_create_ex(struct llquery_intern **out,
+                                            uint32_t max_keys,
+                                            llquery_alloc_fn alloc_fn,
+                                            llquery_free_fn free_fn,
+                                            void *alloc_data) {
+  if (!out || !alloc_fn || !free_fn) {
+    return LQE_NULL_INPUT;
+  }
+  *out = NULL;
+  if (max_keys == 0) {
+    max_keys = LQ_INTERN_DEFAULT_KEYS;
+  }
+  if (max_keys > UINT32_MAX / 4) {
+    return LQE_TOO_MANY_PAIRS;
+  }
 
-    *pos++ = '=';
+  // 负载不超过 1/2
+  uint32_t size = 16;
+  while (size < 2 * max_keys) size *= 2;
 
-    // 复制值
-    if (kv->value_len > 0) {
-      memcpy(pos, kv->value, kv->value_len);
-      pos += kv->value_len;
-    }
+  struct llquery_intern *t = alloc_fn(sizeof(*t), alloc_data);
+  if (!t) {
+    return LQE_MEMORY_ERROR;
+  }
+  memset(t, 0, sizeof(*t));
+  t->alloc_fn = alloc_fn;
+  t->free_fn = free_fn;
+  t->alloc_data = alloc_data;
+  t->slots = alloc_fn(sizeof(lq_intern_slot_t) * (size_t)size, alloc_data);
+  t->keys = alloc_fn(sizeof(const char *) * ((size_t)max_keys + 1), alloc_data);
+  t->key_lens = alloc_fn(sizeof(uint32_t) * ((size_t)max_keys + 1), alloc_data);
+  if (!t->slots || !t->keys || !t->key_lens) {
+    llquery_intern_free(t);
+    return LQE_MEMORY_ERROR;
   }
+  memset(t->slots, 0, sizeof(lq_intern_slot_t) * (size_t)size);
+  t->keys[0] = NULL;
+  t->key_lens[0] = 0;
+  t->mask = size - 1;
+  t->max_keys = max_keys;
+  hash_seed_init(t->seed, t, t->slots);
+
+  *out = t;
+  return LQE_OK;
+}
 
-  *pos = '\0';
-  return (size_t)(pos - buffer);
+void llquery_intern_free(struct llquery_intern *t) {
+  if (!t) {
+    return;
+  }
+  while (t->chunks) {
+    lq_pool_chunk_t *next = t->chunks->next;
+    t->free_fn(t->chunks, t->alloc_data);
+    t->chunks = next;
+  }
+  // 创建失败时部分数组可能为 NULL，自定义释放函数不必处理空指针
+  if (t->slots) t->free_fn(t->slots, t->alloc_data);
+  if (t->keys) t->free_fn(t->keys, t->alloc_data);
+  if (t->key_lens) t->free_fn(t->key_lens, t->alloc_data);
+  t->free_fn(t, t->alloc_data);
 }
 
-enum llquery_error llquery_clone(struct llquery *dst,
-                                 const struct llquery *src) {
-  if (!dst || !src) {
-    return LQE_NULL_INPUT;
+uint32_t llquery_intern_add(struct llquery_intern *t,
+                            const char *key,
+                            size_t key_len) {
+  if (!t || !key) {
+    return 0;
+  }
+  if (key_len == 0) {
+    key_len = strlen(key);
   }
+  return key_len > 0 ? intern_insert(t, key, key_len) : 0;
+}
 
-  // 初始化目标
-  enum llquery_error err = llquery_init(dst, src->max_kv_count, src->flags);
-  if (err != LQE_OK) {
-    return err;
+uint32_t llquery_intern_find(const struct llquery_intern *t,
+                             const char *key,
+                             size_t key_len) {
+  if (!t || !key) {
+    return 0;
   }
+  if (key_len == 0) {
+    key_len = strlen(key);
+  }
+  return intern_find(t, key, key_len, false, NULL);
+}
 
-  llquery_internal_t *internal = get_internal(dst);
+const char *llquery_intern_key(const struct llquery_intern *t,
+                               uint32_t id,
+                               size_t *key_len) {
+  if (!t || id == 0 || id > t->count) {
+    return NULL;
+  }
+  if (key_len) {
+    *key_len = t->key_lens[id];
+  }
+  return t->keys[id];
+}
 
-  // 复制基本字段
-  dst->field_set = src->field_set;
-  dst->kv_count = src->kv_count;
+uint32_t llquery_intern_count(const struct llquery_intern *t) {
+  return t ? t->count : 0;
+}
 
-  // 深拷贝键值对
-  for (uint16_t i = 0; i < src->kv_count; i++) {
-    const struct llquery_kv *src_kv = &src->kv_pairs[i];
-    struct llquery_kv *dst_kv = &dst->kv_pairs[i];
+enum llquery_error llquery_set_intern(struct llquery *q,
+                                      struct llquery_intern *t,
+                                      bool learn) {
+  if (!q || !q->_reserved) {
+    return LQE_NULL_INPUT;
+  }
 
-    // 复制 key
-    char *key_buf = internal->alloc_fn(src_kv->key_len + 1, internal->alloc_data);
-    if (!key_buf) {
-      llquery_free(dst);
-      return LQE_MEMORY_ERROR;
+  // 已有结果的 ID 属于之前的表，清除（键字符串仍由之前的表持有）
+  llquery_internal_t *internal = get_internal(q);
+  if (internal->intern != t) {
+    for (uint32_t i = 0; i < internal->kv_count; i++) {
+      q->kv_pairs[i].key_id = 0;
     }
-    memcpy(key_buf, src_kv->key, src_kv->key_len);
-    key_buf[src_kv->key_len] = '\0';
-    dst_kv->key = key_buf;
-    dst_kv->key_len = src_kv->key_len;
+    lookup_invalidate(internal);
+  }
+  internal->intern = t;
+  internal->intern_learn = t && learn;
+  return LQE_OK;
+}
 
-    // 复制 value
-    char *val_buf = internal->alloc_fn(src_kv->value_len + 1, internal->alloc_data);
-    if (!val_buf) {
-      llquery_free(dst);
-      return LQE_MEMORY_ERROR;
-    }
-    memcpy(val_buf, src_kv->value, src_kv->value_len);
-    val_buf[src_kv->value_len] = '\0';
-    dst_kv->value = val_buf;
-    dst_kv->value_len = src_kv->value_len;
-    dst_kv->is_encoded = src_kv->is_encoded;
+const struct llquery_kv *llquery_get_kv_by_id(const struct llquery *q,
+                                              uint32_t key_id) {
+  if (!q || key_id == 0) {
+    return NULL;
   }
 
-  // 如果需要，复制解码缓冲区
-  if (src->decode_buffer && src->decode_buffer_size > 0) {
-    char *buf = internal->alloc_fn(src->decode_buffer_size, internal->alloc_data);
-    if (!buf) {
-      llquery_free(dst);
-      return LQE_MEMORY_ERROR;
+  // 整数比较，不访问键字符串
+  uint32_t n = kv_count(q);
+  for (uint32_t i = 0; i < n; i++) {
+    if (q->kv_pairs[i].key_id == key_id) {
+      return lazy_materialize(q, &q->kv_pairs[i]) ? &q->kv_pairs[i] : NULL;
     }
-    memcpy(buf, src->decode_buffer, src->decode_buffer_size);
-    dst->decode_buffer = buf;
-    dst->decode_buffer_size = src->decode_buffer_size;
-    internal->decode_buffer_owned = true;
   }
+  return NULL;
+}
 
-  return LQE_OK;
+const char *llquery_get_value_by_id(const struct llquery *q,
+                                    uint32_t key_id) {
+  const struct llquery_kv *kv = llquery_get_kv_by_id(q, key_id);
+  if (!kv) {
+    return NULL;
+  }
+  return kv->value_len > 0 ? kv->value : "";
 }
 
 void llquery_reset(struct llquery *q) {
   if (!q) return;
 
   llquery_internal_t *internal = get_internal(q);
-  
-  // 阶段5优化：释放所有字符串（检查是否在内存池中）
-  if (q->kv_pairs) {
-    for (uint16_t i = 0; i < q->kv_count; i++) {
-      if (q->kv_pairs[i].key) {
-        // 检查是否在内存池中
-        bool in_pool = (internal->string_pool && 
-                        q->kv_pairs[i].key >= internal->string_pool &&
-                        q->kv_pairs[i].key < internal->string_pool + internal->string_pool_size);
-        if (!in_pool) {
-          internal->free_fn((void *)q->kv_pairs[i].key, internal->alloc_data);
-        }
-        q->kv_pairs[i].key = NULL;
-      }
-      if (q->kv_pairs[i].value) {
-        bool in_pool = (internal->string_pool && 
-                        q->kv_pairs[i].value >= internal->string_pool &&
-                        q->kv_pairs[i].value < internal->string_pool + internal->string_pool_size);
-        if (!in_pool) {
-          internal->free_fn((void *)q->kv_pairs[i].value, internal->alloc_data);
-        }
-        q->kv_pairs[i].value = NULL;
-      }
-    }
-  }
-  
-  // 释放内存池
-  if (internal->string_pool_owned && internal->string_pool) {
-    internal->free_fn(internal->string_pool, internal->alloc_data);
-    internal->string_pool = NULL;
-    internal->string_pool_size = 0;
-    internal->string_pool_used = 0;
-    internal->string_pool_owned = false;
-  }
+
+  // 清空内存池但保留容量，溢出块释放（下次 pool_prepare 会扩容主池）
+  internal->string_pool_used = 0;
+  pool_release_overflow(internal);
 
   // 重置计数
-  q->kv_count = 0;
+  set_kv_count(q, internal, 0);
   q->field_set = 0;
 
-  // 重置解码缓冲区（不释放内存）
-  if (q->decode_buffer) {
-    if (internal->decode_buffer_owned) {
-      internal->free_fn((void *)q->decode_buffer, internal->alloc_data);
-      q->decode_buffer = NULL;
-      q->decode_buffer_size = 0;
-      internal->decode_buffer_owned = false;
-    } else {
-      q->decode_buffer = NULL;
-      q->decode_buffer_size = 0;
-    }
+  // 解除对解码缓冲区的引用，自有缓冲区保留供下次解析使用
+  q->decode_buffer = NULL;
+  q->decode_buffer_size = 0;
+  internal->decode_buffer_owned = false;
+  internal->decode_buffer_used = 0;
+  internal->lazy_pending = 0;
+  if (internal->schema) {
+    slots_clear(internal);
+  }
+}
+
+void llquery_shrink(struct llquery *q) {
+  if (!q || !q->_reserved) return;
+
+  llquery_internal_t *internal = get_internal(q);
+
+  // 只释放当前结果未引用的内存
+  if (internal->string_pool_used == 0 && !internal->pool_overflow) {
+    pool_release(internal);
+  }
+  decode_buffer_release(internal);
+  index_release(internal);
+
+  // 可增长模式下空的键值对数组也可释放，下次解析时重新分配
+  if (internal->kv_growable && internal->kv_count == 0 && q->kv_pairs) {
+    internal->free_fn(q->kv_pairs, internal->alloc_data);
+    q->kv_pairs = NULL;
+    internal->kv_capacity = 0;
   }
 }
 
@@ -972,9 +4706,12 @@ void llquery_set_allocator(struct llquery *q,
 
   llquery_internal_t *internal = get_internal(q);
   if (internal) {
+    // 空闲的保留内存由旧分配器释放
+    llquery_shrink(q);
+
     // 使用新的分配器重新分配键值对数组
     if (q->kv_pairs) {
-      size_t size = sizeof(struct llquery_kv) * q->max_kv_count;
+      size_t size = sizeof(struct llquery_kv) * internal->kv_capacity;
       struct llquery_kv *new_pairs = alloc_fn(size, alloc_data);
       if (new_pairs) {
         memcpy(new_pairs, q->kv_pairs, size);
@@ -1002,6 +4739,8 @@ const char *llquery_strerror(enum llquery_error error) {
     case LQE_TOO_MANY_PAIRS: return "Too many key-value pairs";
     case LQE_INVALID_FORMAT: return "Invalid query format";
     case LQE_INTERNAL_ERROR: return "Internal error";
+    case LQE_NOT_FOUND: return "Key not found";
+    case LQE_INVALID_UTF8: return "Invalid UTF-8";
     default: return "Unknown error";
   }
 }
@@ -1010,56 +4749,36 @@ size_t llquery_url_encode(const char *input,
                           size_t input_len,
                           char *output,
                           size_t output_size) {
-  if (!input) return 0;
+  return llquery_url_encode_ex(input, input_len, output, output_size, LQENC_FORM);
+}
+
+size_t llquery_url_encode_ex(const char *input,
+                             size_t input_len,
+                             char *output,
+                             size_t output_size,
+                             enum llquery_encode_set set) {
+  if (!input || (unsigned)set > LQENC_USERINFO) return 0;
 
   if (input_len == 0) {
     input_len = strlen(input);
   }
 
-  const char hex[] = "0123456789ABCDEF";
-  const char *unreserved = "-_.~"; // RFC 3986未保留字符
-
-  size_t needed = 0;
-
-  // 计算所需空间
-  for (size_t i = 0; i < input_len; i++) {
-    unsigned char c = (unsigned char)input[i];
-    if (IS_ALNUM(c) || strchr(unreserved, c)) {
-      needed++;
-    } else {
-      needed += 3; // %XX
-    }
-  }
-
-  needed++; // 终止符
-
-  // 如果只计算大小
-  if (!output || output_size == 0) {
-    return needed - 1;
-  }
-
-  // 检查缓冲区
-  if (output_size < needed) {
-    return needed - 1;
-  }
+  const unsigned char *src = (const unsigned char *)input;
+  const unsigned char bit = (unsigned char)(1u << set);
+  const bool form = set == LQENC_FORM;
 
-  // 编码
-  char *pos = output;
-  for (size_t i = 0; i < input_len; i++) {
-    unsigned char c = (unsigned char)input[i];
-    if (IS_ALNUM(c) || strchr(unreserved, c)) {
-      *pos++ = (char)c;
-    } else if (c == ' ') {
-      *pos++ = '+';
-    } else {
-      *pos++ = '%';
-      *pos++ = hex[c >> 4];
-      *pos++ = hex[c & 0x0F];
+  // 编码结果最多为输入的 3 倍：缓冲区足够时直接一遍编码，
+  // 否则先计算编码后长度（只计算大小或缓冲区不足时返回该长度）
+  if (!output || input_len >= output_size / 3) {
+    size_t needed = encoded_length(src, input_len, bit, form);
+    if (!output || output_size <= needed) {
+      return needed;
     }
   }
 
-  *pos = '\0';
-  return (size_t)(pos - output);
+  char *out = encode_span(output, input, input_len, bit, form);
+  *out = '\0';
+  return (size_t)(out - output);
 }
 
 size_t llquery_url_decode(const char *input,
@@ -1072,65 +4791,21 @@ size_t llquery_url_decode(const char *input,
     input_len = strlen(input);
   }
 
-  size_t needed = 0;
-  const char *src = input;
-  const char *end = input + input_len;
-
-  // 计算所需空间
-  while (src < end) {
-    if (*src == '%' && src + 2 < end) {
-      int h1 = HEX_LOOKUP[(unsigned char)src[1]];
-      int h2 = HEX_LOOKUP[(unsigned char)src[2]];
-      if (h1 >= 0 && h2 >= 0) {
-        needed++;
-        src += 3;
-        continue;
-      }
-    } else if (*src == '+') {
-      needed++;
-      src++;
-      continue;
-    }
-    needed++;
-    src++;
-  }
-
-  needed++; // 终止符
-
-  // 如果只计算大小
-  if (!output || output_size == 0) {
-    return needed - 1;
-  }
-
-  // 检查缓冲区
-  if (output_size < needed) {
-    return needed - 1;
-  }
-
-  // 解码
-  src = input;
-  char *dst = output;
-
-  while (src < end) {
-    if (*src == '%' && src + 2 < end) {
-      int h1 = HEX_LOOKUP[(unsigned char)src[1]];
-      int h2 = HEX_LOOKUP[(unsigned char)src[2]];
-      if (h1 >= 0 && h2 >= 0) {
-        *dst++ = (char)((h1 << 4) | h2);
-        src += 3;
-      } else {
-        *dst++ = *src++;
-      }
-    } else if (*src == '+') {
-      *dst++ = ' ';
-      src++;
-    } else {
-      *dst++ = *src++;
+  // 解码结果不会长于输入：缓冲区容纳输入长度时直接一遍解码，
+  // 否则先计算解码后长度（只计算大小或缓冲区不足时返回该长度），
+  // 再按解码结果的长度写出
+  bool exact = false;
+  if (!output || output_size <= input_len) {
+    size_t needed = decoded_length(input, input_len);
+    if (!output || output_size <= needed) {
+      return needed;
     }
+    exact = true;
   }
 
-  *dst = '\0';
-  return (size_t)(dst - output);
+  size_t n = decode_span_impl(output, input, input_len, false, exact);
+  output[n] = '\0';
+  return n;
 }
 
 uint16_t llquery_parse_fast(const char *query,
@@ -1165,9 +4840,8 @@ uint16_t llquery_parse_fast(const char *query,
   if (has_encoded) {
     if (query_len < MAX_STACK_BUF) {
       // 使用栈缓冲区
-      memcpy(stack_buf, query, query_len);
+      query_len = decode_span(stack_buf, query, query_len);
       stack_buf[query_len] = '\0';
-      decode_in_place(stack_buf);
       work_query = stack_buf;
     } else {
       // 需要堆分配，但快速函数不支持
@@ -1210,6 +4884,9 @@ uint16_t llquery_parse_fast(const char *query,
       kv_pairs[count].value = value_start;
       kv_pairs[count].value_len = (size_t)(current - value_start);
       kv_pairs[count].is_encoded = has_encoded;
+      kv_pairs[count]._state = 0;
+      kv_pairs[count].invalid_utf8 = false;
+      kv_pairs[count].key_id = 0;
 
       count++;
 
@@ -1223,6 +4900,9 @@ uint16_t llquery_parse_fast(const char *query,
       kv_pairs[count].value = "";
       kv_pairs[count].value_len = 0;
       kv_pairs[count].is_encoded = has_encoded;
+      kv_pairs[count]._state = 0;
+      kv_pairs[count].invalid_utf8 = false;
+      kv_pairs[count].key_id = 0;
 
       count++;
 
@@ -1235,6 +4915,168 @@ uint16_t llquery_parse_fast(const char *query,
   return count;
 }
 
+/*
+ * 单键提取
+ *
+ * 用结构字符位掩码逐对跳过原始字符串，不生成键值对。含转义的键边解码边比较，
+ * 只有匹配的值才解码（写入调用方缓冲区）。规则与 llquery_parse() 后
+ * llquery_get_value() 相同：空键跳过，不保留空值时空值的键值对不算匹配。
+ */
+
+/* 读取一个解码后的字节并前进 */
+static LQ_ALWAYS_INLINE unsigned char decode_next(const char **p, const char *end) {
+  unsigned char c = (unsigned char)**p;
+  if (c == '+') {
+    (*p)++;
+    return ' ';
+  }
+  if (c == '%' && end - *p >= 3) {
+    int h1 = HEX_LOOKUP[(unsigned char)(*p)[1]];
+    int h2 = HEX_LOOKUP[(unsigned char)(*p)[2]];
+    if (h1 >= 0 && h2 >= 0) {
+      *p += 3;
+      return (unsigned char)((h1 << 4) | h2);
+    }
+  }
+  (*p)++;
+  return c;
+}
+
+/* 原始键（按选项解码、小写后）是否等于 key */
+static bool find_key_matches(const char *raw, size_t raw_len, bool esc,
+                             const char *key, size_t key_len, uint16_t flags) {
+  bool fold = (flags & LQF_LOWERCASE_KEYS) != 0;
+  if (!esc) {
+    if (raw_len != key_len) return false;
+    if (!fold) return memcmp(raw, key, key_len) == 0;
+  } else if (raw_len < key_len) {
+    return false;
+  }
+
+  const char *p = raw;
+  const char *end = raw + raw_len;
+  for (size_t i = 0; i < key_len; i++) {
+    if (p >= end) return false;
+    unsigned char c = esc ? decode_next(&p, end) : (unsigned char)*p++;
+    if (fold) c = LQ_FOLD_LOWER(c);
+    if (c != (unsigned char)key[i]) return false;
+  }
+  return p == end;
+}
+
+/* 转义的值解码后是否为空（只在去除空白时可能） */
+static bool find_value_blank(const char *raw, size_t raw_len) {
+  const char *p = raw;
+  const char *end = raw + raw_len;
+  while (p < end) {
+    if (!IS_SPACE(decode_next(&p, end))) return false;
+  }
+  return true;
+}
+
+enum llquery_error llquery_find_ex(const char *query,
+                                   size_t query_len,
+                                   const char *key,
+                                   size_t key_len,
+                                   char *decode_buf,
+                                   size_t decode_buf_size,
+                                   const char **value,
+                                   size_t *value_len,
+                                   uint16_t flags) {
+  if (!query || !key || !value || !value_len) {
+    return LQE_NULL_INPUT;
+  }
+  *value = NULL;
+  *value_len = 0;
+
+  if (query_len == 0) {
+    query_len = strlen(query);
+  }
+  if (key_len == 0) {
+    key_len = strlen(key);
+  }
+  if (key_len == 0) {
+    return LQE_NOT_FOUND;
+  }
+  if (query_len > 0 && *query == '?') {
+    query++;
+    query_len--;
+  }
+
+  const bool needs_decode = (flags & LQF_AUTO_DECODE) != 0;
+  const bool trim = (flags & LQF_TRIM_VALUES) != 0;
+  const bool keep_empty = (flags & LQF_KEEP_EMPTY) != 0;
+  lq_scanner_t scanner;
+  scanner_init(&scanner, query, query_len);
+  size_t pos = 0;
+
+  while (pos < query_len) {
+    bool key_esc = false;
+    bool value_esc = false;
+    size_t key_end = scanner_next(&scanner, pos, true, &key_esc);
+    size_t value_start = key_end;
+    size_t value_end = key_end;
+    if (key_end < query_len && query[key_end] == '=') {
+      value_start = key_end + 1;
+      value_end = scanner_next(&scanner, value_start, false, &value_esc);
+    }
+    size_t next = value_end + 1;
+
+    // 空键与不匹配的键直接跳到下一个 '&'
+    if (key_end == pos ||
+        !find_key_matches(query + pos, key_end - pos, needs_decode && key_esc,
+                          key, key_len, flags)) {
+      pos = next;
+      continue;
+    }
+
+    const char *raw = query + value_start;
+    size_t raw_len = value_end - value_start;
+    value_esc = needs_decode && value_esc;
+    if (!value_esc) {
+      size_t lead = 0;
+      if (trim) raw_len = trim_span(raw, raw_len, &lead);
+      if (raw_len == 0 && !keep_empty) {
+        pos = next;
+        continue;
+      }
+      *value = raw + lead;
+      *value_len = raw_len;
+      return LQE_OK;
+    }
+
+    // 匹配的值需要解码
+    if (trim && !keep_empty && find_value_blank(raw, raw_len)) {
+      pos = next;
+      continue;
+    }
+    if (!decode_buf || decode_buf_size <= raw_len) {
+      *value = raw;
+      *value_len = raw_len;
+      return LQE_BUFFER_TOO_SMALL;
+    }
+    size_t lead = 0;
+    size_t len = decode_span(decode_buf, raw, raw_len);
+    if (trim) len = trim_span(decode_buf, len, &lead);
+    decode_buf[lead + len] = '\0';
+    *value = decode_buf + lead;
+    *value_len = len;
+    return LQE_OK;
+  }
+  return LQE_NOT_FOUND;
+}
+
+enum llquery_error llquery_find(const char *query,
+                                size_t query_len,
+                                const char *key,
+                                size_t key_len,
+                                const char **value,
+                                size_t *value_len,
+                                uint16_t flags) {
+  return llquery_find_ex(query, query_len, key, key_len, NULL, 0,
+                         value, value_len, flags);
+}
+
 bool llquery_is_valid(const char *str, size_t len) {
   if (!str) {
     return false;
@@ -1259,7 +5101,24 @@ bool llquery_is_valid(const char *str, size_t len) {
   }
 
   // 基本格式检查：至少包含一个键值对或键
-  for (size_t i = 0; i < len; i++) {
+  size_t i = 0;
+#if LLQUERY_USE_SWAR
+  for (; i + 8 <= len; i += 8) {
+    uint64_t w = swar_load(str + i);
+    if (w & SWAR_HIGHS) {
+      return false;  // 非 ASCII 字节
+    }
+    uint64_t ok = swar_range(w, '0', '9') | swar_range(w, 'A', 'Z') |
+                  swar_range(w, 'a', 'z') |
+                  swar_eq(w, '-') | swar_eq(w, '_') | swar_eq(w, '.') |
+                  swar_eq(w, '~') | swar_eq(w, '%') | swar_eq(w, '+') |
+                  swar_eq(w, '=') | swar_eq(w, '&');
+    if (ok != SWAR_HIGHS) {
+      return false;
+    }
+  }
+#endif
+  for (; i < len; i++) {
     char c = str[i];
     // 允许的字符：字母数字、-_.~、% (用于编码)、+、=、&
     if (!IS_ALNUM((unsigned char)c) &&
@@ -1295,27 +5154,24 @@ uint16_t llquery_count_pairs(const char *query, size_t query_len) {
     return 0;
   }
 
+  // 统计非空段的个数：段起点为前一字节是 '&'（或位于开头）的非 '&' 字节
   uint16_t count = 0;
-  const char *p = query;
-  const char *end = query + query_len;
-
-  while (p < end) {
-    // 跳过'&'
-    while (p < end && *p == '&') {
-      p++;
-    }
-    if (p >= end) break;
-
-    // 找到下一个'&'
-    while (p < end && *p != '&') {
-      p++;
-    }
-
-    count++;
-
-    if (p < end && *p == '&') {
-      p++;
+  unsigned prev_amp = 1;
+  size_t i = 0;
+#if LLQUERY_USE_SWAR
+  for (; i + 8 <= query_len; i += 8) {
+    unsigned amp = swar_movemask(swar_eq(swar_load(query + i), '&'));
+    unsigned starts = ~amp & ((amp << 1) | prev_amp) & 0xFF;
+    count = (uint16_t)(count + lq_popcount8(starts));
+    prev_amp = amp >> 7;
+  }
+#endif
+  for (; i < query_len; i++) {
+    unsigned amp = IS_SEPARATOR(query[i]) ? 1u : 0u;
+    if (!amp && prev_amp) {
+      count++;
     }
+    prev_amp = amp;
   }
 
   return count;
@@ -29,12 +29,15 @@ extern "C" {
 enum llquery_option_flags {
     LQF_NONE             = 0,      /**< 默认选项 */
     LQF_AUTO_DECODE      = 1 << 0, /**< 自动URL解码（处理%XX和+） */
-    LQF_MERGE_DUPLICATES = 1 << 1, /**< 合并重复键为数组 */
+    LQF_MERGE_DUPLICATES = 1 << 1, /**< 解析时按键分组重复键（见 llquery_next_value） */
     LQF_KEEP_EMPTY       = 1 << 2, /**< 保留空键值对 */
     LQF_STRICT           = 1 << 3, /**< 严格模式，遇到错误时返回错误 */
-    LQF_SORT_KEYS        = 1 << 4, /**< 按键名排序结果 */
+    LQF_SORT_KEYS        = 1 << 4, /**< 解析完成时按键名稳定排序结果，之后按键查找使用二分查找 */
     LQF_LOWERCASE_KEYS   = 1 << 5, /**< 键名转换为小写 */
     LQF_TRIM_VALUES      = 1 << 6, /**< 去除值的前后空白字符 */
+    LQF_ZERO_COPY        = 1 << 7, /**< 零拷贝：键值为指向输入的视图，不以'\0'结尾 */
+    LQF_LAZY             = 1 << 8, /**< 延迟解析：只记录偏移，首次访问时解码并缓存 */
+    LQF_VALIDATE_UTF8    = 1 << 9, /**< 解析时校验解码后的键值是否为有效 UTF-8（见 llquery_kv::invalid_utf8） */
     LQF_DEFAULT          = LQF_AUTO_DECODE /**< 默认配置：自动解码 */
 };
 
@@ -51,14 +54,17 @@ struct llquery_kv {
     size_t key_len;          /**< 键的长度 */
     const char *value;       /**< 值的起始指针 */
     size_t value_len;        /**< 值的长度 */
-    bool is_encoded;         /**< 是否包含URL编码字符 */
+    bool is_encoded;         /**< 该键值对的键或值是否经过URL解码 */
+    uint8_t _state;          /**< 内部状态（延迟解析），调用方勿修改 */
+    bool invalid_utf8;       /**< 启用 LQF_VALIDATE_UTF8 时，键或值不是有效 UTF-8 */
+    uint32_t key_id;         /**< 驻留键 ID（见 llquery_set_intern），0 表示无 */
 };
 
 /* 完整的查询字符串解析结果 */
 struct llquery {
     uint32_t field_set;               /**< 位掩码，表示设置了哪些字段 */
-    uint16_t kv_count;                /**< 键值对数量 */
-    uint16_t max_kv_count;            /**< 最大支持的键值对数量 */
+    uint16_t kv_count;                /**< 键值对数量（超过 65535 时饱和，见 llquery_count_ex） */
+    uint16_t max_kv_count;            /**< 最大支持的键值对数量（同样饱和） */
     uint16_t flags;                   /**< 解析时使用的选项标志 */
 
     /* 如果设置了LQF_AUTO_DECODE且需要解码，指向解码缓冲区 */
@@ -82,7 +88,9 @@ enum llquery_error {
     LQE_MEMORY_ERROR,                 /**< 内存分配错误 */
     LQE_TOO_MANY_PAIRS,               /**< 键值对数量超过限制 */
     LQE_INVALID_FORMAT,               /**< 格式无效 */
-    LQE_INTERNAL_ERROR                /**< 内部错误 */
+    LQE_INTERNAL_ERROR,               /**< 内部错误 */
+    LQE_NOT_FOUND,                    /**< 未找到指定键 */
+    LQE_INVALID_UTF8                  /**< 键或值不是有效 UTF-8（LQF_VALIDATE_UTF8 与 LQF_STRICT） */
 };
 
 /* 回调函数类型，用于遍历键值对 */
@@ -92,10 +100,57 @@ typedef int (*llquery_iter_cb)(const struct llquery_kv *kv, void *user_data);
 typedef int (*llquery_compare_cb)(const struct llquery_kv *a,
                                   const struct llquery_kv *b);
 
+/* 回调函数类型，用于分块输出；返回非0值中止输出 */
+typedef int (*llquery_sink_cb)(const char *data, size_t len, void *user_data);
+
+/* 分散输入（POSIX struct iovec） */
+struct iovec;
+
 /* 内存分配器函数类型 */
 typedef void* (*llquery_alloc_fn)(size_t size, void *user_data);
 typedef void  (*llquery_free_fn)(void *ptr, void *user_data);
 
+/* 紧凑解析结果：键值字节集中在一块缓冲区，每个键值对 12 字节偏移/长度 + 1 字节标志 */
+struct llquery_compact {
+    uint32_t kv_count;                /**< 键值对数量 */
+    uint32_t data_size;               /**< 数据区字节数 */
+    const char *data;                 /**< 数据区：键与值依次存放，各自以 '\0' 结尾 */
+
+    /* 私有数据，用于内部管理 */
+    void *_reserved;                  /**< 保留字段，供内部使用 */
+};
+
+/* 键模式：编译好的已知键集合（完美哈希），见 llquery_schema_create() */
+struct llquery_schema;
+
+/* 键模式选项 */
+enum llquery_schema_flags {
+    LQS_NONE         = 0,      /**< 默认：未知键保留在结果中并计数 */
+    LQS_DROP_UNKNOWN = 1 << 0  /**< 解析时丢弃不在模式中的键（仍计数） */
+};
+
+/* 键驻留表：多个解析器共享的键名集合，每个键一个整数 ID，见 llquery_intern_create() */
+struct llquery_intern;
+
+/* URL 编码集：各集合都原样输出 RFC 3986 未保留字符（字母数字与 -._~） */
+enum llquery_encode_set {
+    LQENC_FORM       = 0,  /**< 表单编码（llquery_url_encode 的默认）：空格编码为 '+' */
+    LQENC_UNRESERVED = 1,  /**< RFC 3986：只保留未保留字符，空格编码为 %20 */
+    LQENC_PATH       = 2,  /**< 路径段：另外保留 sub-delims 与 ':'、'@'，'/' 编码 */
+    LQENC_USERINFO   = 3   /**< 用户名或密码：另外保留 sub-delims，':'、'@' 编码 */
+};
+
+/* 流式解析器状态，用于分块到达的输入（如 application/x-www-form-urlencoded 请求体） */
+struct llquery_stream {
+    struct llquery *q;                /**< 接收键值对的解析结果（可为 NULL） */
+    llquery_iter_cb callback;         /**< 每个完整键值对的回调（可为 NULL） */
+    void *user_data;                  /**< 传递给回调的用户数据 */
+    uint16_t flags;                   /**< 解析选项标志 */
+
+    /* 私有数据，用于内部管理 */
+    void *_reserved;                  /**< 保留字段，供内部使用 */
+};
+
 /**
  * @brief 初始化查询解析器结构体
  *
@@ -133,6 +188,24 @@ enum llquery_error llquery_init_ex(struct llquery *q,
                                    llquery_free_fn free_fn,
                                    void *alloc_data);
 
+/**
+ * @brief 初始化可增长的查询解析器
+ *
+ * 键值对数组初始只分配少量槽位，解析时按实际数量倍增，
+ * 数量不再受 uint16_t 限制。超过 65535 个键值对时
+ * q->kv_count 饱和为 65535，应使用 llquery_count_ex() 和
+ * llquery_get_kv_ex() 访问全部结果。
+ *
+ * @param q 指向 llquery 结构体的指针
+ * @param max_pairs 最大键值对数量，0表示不限制
+ * @param flags 解析选项标志
+ *
+ * @return 错误码
+ */
+enum llquery_error llquery_init_growable(struct llquery *q,
+                                         uint32_t max_pairs,
+                                         uint16_t flags);
+
 /**
  * @brief 解析查询字符串
  *
@@ -151,6 +224,11 @@ enum llquery_error llquery_init_ex(struct llquery *q,
  * @return 错误码
  *
  * @note 成功解析后，必须调用 llquery_free() 释放资源
+ * @note LQF_LAZY 模式下只记录偏移，键值对在首次通过访问函数读取时才解码；
+ *       输入在使用结果期间必须保持有效，直接读取 kv_pairs 可能得到原始片段
+ * @note LQF_VALIDATE_UTF8 模式下每个保留的键值对在解码后校验，无效时置位
+ *       invalid_utf8；同时设置 LQF_STRICT 时在第一个无效键值对处返回
+ *       LQE_INVALID_UTF8。该模式下 LQF_LAZY 不生效，键值对立即生成
  */
 enum llquery_error llquery_parse(const char *query,
                                  size_t query_len,
@@ -164,10 +242,12 @@ enum llquery_error llquery_parse(const char *query,
  * @param query 要解析的查询字符串
  * @param query_len 查询字符串长度
  * @param q 已初始化的 llquery 结构体指针
- * @param decode_buf 外部提供的解码缓冲区
+ * @param decode_buf 外部提供的解码缓冲区。零拷贝模式（LQF_ZERO_COPY）下
+ *                   需要解码或改写的 token 写入此缓冲区，NULL 表示按需分配；
+ *                   复制模式下解码结果直接写入字符串池，不使用此缓冲区
  * @param decode_buf_size 解码缓冲区大小
  *
- * @return 错误码
+ * @return 错误码，外部解码缓冲区不足时返回 LQE_BUFFER_TOO_SMALL
  */
 enum llquery_error llquery_parse_ex(const char *query,
                                     size_t query_len,
@@ -175,6 +255,80 @@ enum llquery_error llquery_parse_ex(const char *query,
                                     char *decode_buf,
                                     size_t decode_buf_size);
 
+/**
+ * @brief 解析分散在多个缓冲区中的查询字符串
+ *
+ * 输入为 iovec 数组（如网络层的多段接收缓冲区），无需先拼接。
+ * 完全位于一个分段内的键值对与 llquery_parse_ex() 相同处理，
+ * 零拷贝模式（LQF_ZERO_COPY）下仍为指向分段的视图；
+ * 只有跨越分段边界的键值对会拼接到自有缓冲区（零拷贝模式下为解码缓冲区）。
+ * 分散输入不支持 LQF_LAZY，所有键值对立即生成。
+ *
+ * @param iov 输入分段数组
+ * @param iovcnt 分段数量
+ * @param q 已初始化的 llquery 结构体指针
+ *
+ * @return 错误码
+ */
+enum llquery_error llquery_parse_iov(const struct iovec *iov,
+                                     int iovcnt,
+                                     struct llquery *q);
+
+/**
+ * @brief 初始化流式解析器
+ *
+ * 输入分块到达时使用，无需先拼接完整输入。完整的键值对写入 q，
+ * 并（或）通过 callback 逐个交付；回调返回非 0 时停止解析。
+ * 跨块的片段（包括被拆开的 %XX）暂存在内部缓冲区，
+ * 内部内存只与最大的单个键值对成正比。
+ *
+ * @param s 流式解析器
+ * @param q 接收结果的已初始化 llquery（会被重置），NULL 表示只使用回调
+ * @param flags 解析选项，q 不为 NULL 时使用 q->flags；
+ *              流式输入总是复制，忽略 LQF_ZERO_COPY 和 LQF_LAZY
+ * @param callback 键值对回调，q 为 NULL 时必须提供；
+ *                 只使用回调时 kv 指向内部缓冲区，仅在回调期间有效
+ * @param user_data 传递给回调的用户数据
+ *
+ * @return 错误码
+ */
+enum llquery_error llquery_stream_init(struct llquery_stream *s,
+                                       struct llquery *q,
+                                       uint16_t flags,
+                                       llquery_iter_cb callback,
+                                       void *user_data);
+
+/**
+ * @brief 向流式解析器输入一块数据
+ *
+ * @param s 流式解析器
+ * @param chunk 数据块，调用返回后即可复用
+ * @param chunk_len 数据块长度
+ *
+ * @return 错误码，出错后后续调用返回同一错误
+ */
+enum llquery_error llquery_stream_feed(struct llquery_stream *s,
+                                       const char *chunk,
+                                       size_t chunk_len);
+
+/**
+ * @brief 结束流式输入，处理最后一个键值对
+ *
+ * @param s 流式解析器
+ *
+ * @return 错误码
+ */
+enum llquery_error llquery_stream_finish(struct llquery_stream *s);
+
+/**
+ * @brief 释放流式解析器的内部缓冲区
+ *
+ * 写入 q 的解析结果不受影响，仍需调用 llquery_free() 释放。
+ *
+ * @param s 流式解析器
+ */
+void llquery_stream_free(struct llquery_stream *s);
+
 /**
  * @brief 释放查询解析器占用的资源
  *
@@ -204,6 +358,28 @@ uint16_t llquery_count(const struct llquery *q);
 const struct llquery_kv *llquery_get_kv(const struct llquery *q,
                                         uint16_t index);
 
+/**
+ * @brief 获取键值对数量（32 位）
+ *
+ * 可增长模式下数量可能超过 65535，此时 llquery_count() 饱和。
+ *
+ * @param q 指向 llquery 结构体的指针
+ *
+ * @return 键值对数量
+ */
+uint32_t llquery_count_ex(const struct llquery *q);
+
+/**
+ * @brief 根据 32 位索引获取键值对
+ *
+ * @param q 指向 llquery 结构体的指针
+ * @param index 键值对索引（0-based）
+ *
+ * @return 指向键值对的指针，如果索引无效则返回NULL
+ */
+const struct llquery_kv *llquery_get_kv_ex(const struct llquery *q,
+                                           uint32_t index);
+
 /**
  * @brief 根据键名查找值
  *
@@ -219,6 +395,23 @@ const char *llquery_get_value(const struct llquery *q,
                               const char *key,
                               size_t key_len);
 
+/**
+ * @brief 根据键名查找键值对
+ *
+ * 与 llquery_get_value() 相同的查找规则，但返回完整的键值对，
+ * 可同时获得值的长度。零拷贝模式（LQF_ZERO_COPY）下值不以'\0'结尾，
+ * 应使用此函数或 llquery_get_kv() 读取长度。
+ *
+ * @param q 指向 llquery 结构体的指针
+ * @param key 要查找的键名
+ * @param key_len 键名长度
+ *
+ * @return 指向第一个匹配键值对的指针，如果未找到则返回NULL
+ */
+const struct llquery_kv *llquery_get_kv_by_key(const struct llquery *q,
+                                               const char *key,
+                                               size_t key_len);
+
 /**
  * @brief 根据键名查找所有值（用于重复键）
  *
@@ -238,6 +431,26 @@ uint16_t llquery_get_all_values(const struct llquery *q,
                                 const char **values,
                                 uint16_t max_values);
 
+/**
+ * @brief 一次查找多个键的值
+ *
+ * 单遍扫描键值对（有键索引或结果有序时逐键查找），所有键都找到后提前结束。
+ * 每个键的结果与 llquery_get_value() 相同。
+ *
+ * @param q 指向 llquery 结构体的指针
+ * @param keys 要查找的键名数组
+ * @param key_lens 键名长度数组（NULL 或其中的 0 表示自动计算）
+ * @param n 键名数量
+ * @param values 输出数组，values[i] 为 keys[i] 的第一个值，未找到为 NULL
+ *
+ * @return 找到的键数量
+ */
+uint32_t llquery_get_values_multi(const struct llquery *q,
+                                  const char *const *keys,
+                                  const size_t *key_lens,
+                                  uint32_t n,
+                                  const char **values);
+
 /**
  * @brief 检查是否包含指定键
  *
@@ -251,6 +464,80 @@ bool llquery_has_key(const struct llquery *q,
                      const char *key,
                      size_t key_len);
 
+/**
+ * @brief 忽略 ASCII 大小写，根据键名查找值
+ *
+ * 不要求 LQF_LOWERCASE_KEYS：键保持原样（零拷贝视图仍可用），
+ * 只在比较时折叠大小写。同一结果上多次查找时自动建立按折叠键的哈希索引。
+ *
+ * @param q 指向 llquery 结构体的指针
+ * @param key 要查找的键名（大小写任意）
+ * @param key_len 键名长度（0表示自动计算）
+ *
+ * @return 第一个匹配键的值，如果未找到则返回NULL
+ */
+const char *llquery_get_value_ci(const struct llquery *q,
+                                 const char *key,
+                                 size_t key_len);
+
+/**
+ * @brief 忽略 ASCII 大小写，根据键名查找键值对
+ *
+ * 查找规则与 llquery_get_value_ci() 相同，返回的键保持原始大小写。
+ *
+ * @param q 指向 llquery 结构体的指针
+ * @param key 要查找的键名（大小写任意）
+ * @param key_len 键名长度（0表示自动计算）
+ *
+ * @return 指向第一个匹配键值对的指针，如果未找到则返回NULL
+ */
+const struct llquery_kv *llquery_get_kv_by_key_ci(const struct llquery *q,
+                                                  const char *key,
+                                                  size_t key_len);
+
+/**
+ * @brief 忽略 ASCII 大小写，检查是否包含指定键
+ *
+ * @param q 指向 llquery 结构体的指针
+ * @param key 要检查的键名（大小写任意）
+ * @param key_len 键名长度（0表示自动计算）
+ *
+ * @return 如果包含则返回true，否则返回false
+ */
+bool llquery_has_key_ci(const struct llquery *q,
+                        const char *key,
+                        size_t key_len);
+
+/**
+ * @brief 获取同一个键的下一个值
+ *
+ * 沿按键分组的链表前进，不重新扫描全部键值对。
+ * 设置 LQF_MERGE_DUPLICATES 时分组在解析时完成，否则首次调用时建立。
+ *
+ * @param q 指向 llquery 结构体的指针
+ * @param kv 当前键值对（须来自 q 的访问函数）
+ *
+ * @return 同键的下一个键值对，没有则返回NULL
+ */
+const struct llquery_kv *llquery_next_value(const struct llquery *q,
+                                           const struct llquery_kv *kv);
+
+/**
+ * @brief 按唯一键遍历
+ *
+ * 每个不同的键只回调一次，传入该键首次出现的键值对，
+ * 可用 llquery_next_value() 读取该键的其余值。
+ *
+ * @param q 指向 llquery 结构体的指针
+ * @param callback 回调函数
+ * @param user_data 传递给回调函数的用户数据
+ *
+ * @return 处理的唯一键数量
+ */
+uint32_t llquery_iterate_unique(const struct llquery *q,
+                                llquery_iter_cb callback,
+                                void *user_data);
+
 /**
  * @brief 遍历所有键值对
  *
@@ -269,7 +556,8 @@ uint16_t llquery_iterate(const struct llquery *q,
 /**
  * @brief 按键名排序键值对
  *
- * 根据键名对解析结果进行排序。
+ * 根据键名对解析结果进行稳定排序（同名键保持原有相对顺序）。
+ * 使用默认比较排序后，按键查找改为二分查找，直到结果被修改。
  *
  * @param q 指向 llquery 结构体的指针
  * @param compare_fn 比较函数，NULL表示使用默认字典序比较
@@ -298,10 +586,11 @@ uint16_t llquery_filter(struct llquery *q,
  * @brief 将解析结果格式化为查询字符串
  *
  * 将解析后的键值对重新格式化为查询字符串。
- * 可以选择是否进行URL编码。
+ * 可以选择是否进行URL编码：编码时键和值按表单编码（同 llquery_url_encode）。
+ * 缓冲区不小于键值字节数的 3 倍加分隔符时一遍写出，否则先计算准确长度。
  *
  * @param q 指向 llquery 结构体的指针
- * @param buffer 输出缓冲区
+ * @param buffer 输出缓冲区，NULL 表示只计算长度
  * @param buffer_size 输出缓冲区大小
  * @param encode 是否进行URL编码
  *
@@ -312,6 +601,51 @@ size_t llquery_stringify(const struct llquery *q,
                          size_t buffer_size,
                          bool encode);
 
+/**
+ * @brief 将解析结果分块格式化输出
+ *
+ * 与 llquery_stringify 输出相同的内容（不含终止符），但在内部固定大小
+ * （4096 字节）的栈缓冲区中组装，每凑满一块调用一次 sink，
+ * 不需要容纳整个结果的连续缓冲区。
+ *
+ * @param q 指向 llquery 结构体的指针
+ * @param encode 是否进行URL编码
+ * @param sink 输出回调，返回非0值中止输出
+ * @param user_data 传递给回调的用户数据
+ *
+ * @return 已交给 sink 的字节数
+ */
+size_t llquery_stringify_sink(const struct llquery *q,
+                              bool encode,
+                              llquery_sink_cb sink,
+                              void *user_data);
+
+/**
+ * @brief 将解析结果格式化为 iovec 数组（零拷贝）
+ *
+ * 输出与 llquery_stringify 相同的内容（不含终止符），但不复制键值：
+ * 各项直接指向已有的键值存储，分隔符指向共享的静态字符串，
+ * 内存中相邻的片段（如零拷贝结果中未改写的部分）合并为一项。
+ * encode 时只有需要编码的键或值写入 scratch。结果可直接交给 writev/sendmsg，
+ * 在 q 被修改或释放前有效。
+ *
+ * @param q 指向 llquery 结构体的指针
+ * @param encode 是否进行URL编码
+ * @param iov 输出 iovec 数组
+ * @param iovcnt 输入为 iov 容量，输出为使用（或所需）的项数
+ * @param scratch 编码临时区，不编码时可为 NULL
+ * @param scratch_size 输入为 scratch 大小，输出为使用（或所需）的字节数
+ *
+ * @return 错误码；iov 或 scratch 不足时返回 LQE_BUFFER_TOO_SMALL，
+ *         此时 *iovcnt 与 *scratch_size 为所需大小（scratch 不足时项数为上限）
+ */
+enum llquery_error llquery_stringify_iov(const struct llquery *q,
+                                         bool encode,
+                                         struct iovec *iov,
+                                         int *iovcnt,
+                                         char *scratch,
+                                         size_t *scratch_size);
+
 /**
  * @brief 复制查询解析器
  *
@@ -325,16 +659,327 @@ size_t llquery_stringify(const struct llquery *q,
 enum llquery_error llquery_clone(struct llquery *dst,
                                  const struct llquery *src);
 
+/**
+ * @brief 生成紧凑形式的解析结果
+ *
+ * 将解析结果复制为单块内存：键值字节连续存放，每个键值对只占
+ * 12 字节（32 位偏移与长度）加 1 字节标志，适合长期保存大量结果。
+ * 使用 src 的内存分配器，之后与 src 无关。
+ *
+ * @param dst 目标紧凑结果
+ * @param src 源查询解析器
+ *
+ * @return 错误码；数据超过 32 位偏移范围时返回 LQE_BUFFER_TOO_SMALL
+ */
+enum llquery_error llquery_compact_build(struct llquery_compact *dst,
+                                         const struct llquery *src);
+
+/**
+ * @brief 释放紧凑结果
+ *
+ * @param c 指向 llquery_compact 结构体的指针
+ */
+void llquery_compact_free(struct llquery_compact *c);
+
+/**
+ * @brief 根据索引读取紧凑结果中的键值对
+ *
+ * 填充的内容与 llquery_get_kv() 相同，指针指向紧凑结果的数据区。
+ *
+ * @param c 指向 llquery_compact 结构体的指针
+ * @param index 键值对索引（0-based）
+ * @param kv 输出键值对
+ *
+ * @return 索引有效返回 true
+ */
+bool llquery_compact_get_kv(const struct llquery_compact *c,
+                            uint32_t index,
+                            struct llquery_kv *kv);
+
+/**
+ * @brief 在紧凑结果中根据键名查找值
+ *
+ * @param c 指向 llquery_compact 结构体的指针
+ * @param key 要查找的键名
+ * @param key_len 键名长度（0表示自动计算）
+ *
+ * @return 值字符串指针，未找到返回NULL
+ */
+const char *llquery_compact_get_value(const struct llquery_compact *c,
+                                      const char *key,
+                                      size_t key_len);
+
+/**
+ * @brief 编译键模式
+ *
+ * 把一组已知键名编译为完美哈希表，键名在数组中的下标即槽位号。
+ * 绑定到解析器后，解析时每个已知键直接记入槽位，读取时按槽位号访问。
+ * 使用 LQF_LOWERCASE_KEYS 时键名应为小写。
+ * 建表时间和表大小与键数量成线性关系，互不相同的键总能建表成功。
+ *
+ * @param out 输出模式指针，用 llquery_schema_free() 释放
+ * @param keys 键名数组（以'\0'结尾，非空且互不相同）
+ * @param key_count 键名数量（不超过 2^30）
+ * @param flags 模式选项（enum llquery_schema_flags）
+ *
+ * @return 错误码；键名为空或重复时返回 LQE_INVALID_FORMAT，
+ *         键数量超过上限时返回 LQE_TOO_MANY_PAIRS
+ */
+enum llquery_error llquery_schema_create(struct llquery_schema **out,
+                                         const char *const *keys,
+                                         uint32_t key_count,
+                                         uint16_t flags);
+
+/**
+ * @brief 使用自定义内存分配器编译键模式
+ *
+ * 与 llquery_schema_create() 相同，模式及建表时的临时数组都通过 alloc_fn 分配，
+ * llquery_schema_free() 用 free_fn 释放。
+ *
+ * @param out 输出模式指针
+ * @param keys 键名数组
+ * @param key_count 键名数量
+ * @param flags 模式选项
+ * @param alloc_fn 内存分配函数
+ * @param free_fn 内存释放函数
+ * @param alloc_data 传递给分配函数的用户数据
+ *
+ * @return 错误码
+ */
+enum llquery_error llquery_schema_create_ex(struct llquery_schema **out,
+                                            const char *const *keys,
+                                            uint32_t key_count,
+                                            uint16_t flags,
+                                            llquery_alloc_fn alloc_fn,
+                                            llquery_free_fn free_fn,
+                                            void *alloc_data);
+
+/**
+ * @brief 释放键模式
+ *
+ * @param schema 模式指针（可为 NULL）
+ */
+void llquery_schema_free(struct llquery_schema *schema);
+
+/**
+ * @brief 查询键名对应的槽位
+ *
+ * @param schema 模式指针
+ * @param key 键名
+ * @param key_len 键名长度（0表示自动计算）
+ *
+ * @return 槽位号，不在模式中返回 -1
+ */
+int32_t llquery_schema_slot(const struct llquery_schema *schema,
+                            const char *key,
+                            size_t key_len);
+
+/**
+ * @brief 为解析器绑定键模式
+ *
+ * 之后的解析把已知键记入槽位并统计未知键。一个模式可以绑定到多个解析器，
+ * 模式必须在所有绑定的解析器释放或解绑之前保持有效。
+ *
+ * @param q 指向 llquery 结构体的指针
+ * @param schema 模式指针，NULL 表示解绑
+ *
+ * @return 错误码
+ */
+enum llquery_error llquery_set_schema(struct llquery *q,
+                                      const struct llquery_schema *schema);
+
+/**
+ * @brief 按槽位读取键值对
+ *
+ * 返回该键第一次出现的键值对；其余同名的值可用 llquery_next_value() 读取。
+ *
+ * @param q 指向 llquery 结构体的指针
+ * @param slot 槽位号（键名在 llquery_schema_create() 数组中的下标）
+ *
+ * @return 键值对指针，未出现、槽位无效或未绑定模式时返回 NULL
+ */
+const struct llquery_kv *llquery_get_slot(const struct llquery *q,
+                                          uint32_t slot);
+
+/**
+ * @brief 按槽位读取值
+ *
+ * @param q 指向 llquery 结构体的指针
+ * @param slot 槽位号
+ *
+ * @return 值字符串指针（无值时为空字符串），未出现时返回 NULL
+ */
+const char *llquery_get_slot_value(const struct llquery *q,
+                                   uint32_t slot);
+
+/**
+ * @brief 获取上次解析遇到的未知键数量
+ *
+ * 包括按 LQS_DROP_UNKNOWN 丢弃的键。
+ *
+ * @param q 指向 llquery 结构体的指针
+ *
+ * @return 不在绑定模式中的键值对数量
+ */
+uint32_t llquery_unknown_count(const struct llquery *q);
+
+/**
+ * @brief 创建键驻留表
+ *
+ * 驻留表保存键名并分配从 1 开始的整数 ID，ID 在表的生命周期内不变。
+ * 绑定到解析器后，解析出的键带有 ID（struct llquery_kv::key_id），
+ * 表中已有的键直接引用表中的字符串，不再复制。
+ *
+ * @param out 输出驻留表指针，用 llquery_intern_free() 释放
+ * @param max_keys 最多保存的键数量（0 表示 1024）
+ *
+ * @return 错误码
+ */
+enum llquery_error llquery_intern_create(struct llquery_intern **out,
+                                         uint32_t max_keys);
+
+/**
+ * @brief 使用自定义内存分配器创建键驻留表
+ *
+ * 与 llquery_intern_create() 相同，表本身与之后加入的键字符串都通过 alloc_fn 分配，
+ * llquery_intern_free() 用 free_fn 释放。驻留表被多个解析器共享时，
+ * 分配器必须在所有线程中可用。
+ *
+ * @param out 输出驻留表指针
+ * @param max_keys 最多保存的键数量（0 表示 1024）
+ * @param alloc_fn 内存分配函数
+ * @param free_fn 内存释放函数
+ * @param alloc_data 传递给分配函数的用户数据
+ *
+ * @return 错误码
+ */
+enum llquery_error llquery_intern_create_ex(struct llquery_intern **out,
+                                            uint32_t max_keys,
+                                            llquery_alloc_fn alloc_fn,
+                                            llquery_free_fn free_fn,
+                                            void *alloc_data);
+
+/**
+ * @brief 释放键驻留表
+ *
+ * 引用表中键字符串的解析结果在此之后不能再使用。
+ *
+ * @param t 驻留表指针（可为 NULL）
+ */
+void llquery_intern_free(struct llquery_intern *t);
+
+/**
+ * @brief 向驻留表加入键（已存在时返回原有 ID）
+ *
+ * 修改驻留表，不能与使用该表的解析同时进行。
+ *
+ * @param t 驻留表指针
+ * @param key 键名
+ * @param key_len 键名长度（0表示自动计算）
+ *
+ * @return 键 ID，表已满或内存不足时返回 0
+ */
+uint32_t llquery_intern_add(struct llquery_intern *t,
+                            const char *key,
+                            size_t key_len);
+
+/**
+ * @brief 查找键的 ID
+ *
+ * @param t 驻留表指针
+ * @param key 键名
+ * @param key_len 键名长度（0表示自动计算）
+ *
+ * @return 键 ID，不在表中返回 0
+ */
+uint32_t llquery_intern_find(const struct llquery_intern *t,
+                             const char *key,
+                             size_t key_len);
+
+/**
+ * @brief 根据 ID 获取键名
+ *
+ * @param t 驻留表指针
+ * @param id 键 ID
+ * @param key_len 输出键名长度（可为 NULL）
+ *
+ * @return 以'\0'结尾的键名，ID 无效时返回 NULL
+ */
+const char *llquery_intern_key(const struct llquery_intern *t,
+                               uint32_t id,
+                               size_t *key_len);
+
+/**
+ * @brief 获取驻留表中的键数量
+ *
+ * @param t 驻留表指针
+ *
+ * @return 键数量（即当前最大的 ID）
+ */
+uint32_t llquery_intern_count(const struct llquery_intern *t);
+
+/**
+ * @brief 为解析器绑定键驻留表
+ *
+ * 只读使用（learn 为 false）时一个表可以被多个线程中的解析器同时使用；
+ * 学习模式下解析会把新键加入表中，使用该表的解析必须串行。
+ * 表必须在所有绑定的解析器释放或解绑之前保持有效。
+ *
+ * @param q 指向 llquery 结构体的指针
+ * @param t 驻留表指针，NULL 表示解绑
+ * @param learn 解析时是否把不在表中的键加入表
+ *
+ * @return 错误码
+ */
+enum llquery_error llquery_set_intern(struct llquery *q,
+                                      struct llquery_intern *t,
+                                      bool learn);
+
+/**
+ * @brief 根据驻留键 ID 查找键值对
+ *
+ * 只比较整数 ID，不比较键字符串。
+ *
+ * @param q 指向 llquery 结构体的指针
+ * @param key_id 键 ID
+ *
+ * @return 第一个匹配的键值对，未找到返回 NULL
+ */
+const struct llquery_kv *llquery_get_kv_by_id(const struct llquery *q,
+                                              uint32_t key_id);
+
+/**
+ * @brief 根据驻留键 ID 查找值
+ *
+ * @param q 指向 llquery 结构体的指针
+ * @param key_id 键 ID
+ *
+ * @return 值字符串指针（无值时为空字符串），未找到返回 NULL
+ */
+const char *llquery_get_value_by_id(const struct llquery *q,
+                                    uint32_t key_id);
+
 /**
  * @brief 重置查询解析器
  *
  * 重置查询解析器到初始状态，但不释放内存。
- * 可以用于重复解析不同的查询字符串。
+ * 字符串池和自有解码缓冲区的容量会保留并在下次解析时复用，
+ * 可以用于重复解析不同的查询字符串而无需重新分配。
  *
  * @param q 指向 llquery 结构体的指针
  */
 void llquery_reset(struct llquery *q);
 
+/**
+ * @brief 释放保留的空闲内存
+ *
+ * 释放 llquery_reset() 后保留的字符串池和自有解码缓冲区。
+ * 仍被当前解析结果引用的内存不会释放，通常在 reset 之后调用。
+ *
+ * @param q 指向 llquery 结构体的指针
+ */
+void llquery_shrink(struct llquery *q);
+
 /**
  * @brief 设置内存分配器
  *
@@ -362,7 +1007,7 @@ const char *llquery_strerror(enum llquery_error error);
 /**
  * @brief URL编码字符串
  *
- * 对字符串进行URL编码。
+ * 对字符串进行URL编码，等同于使用 LQENC_FORM 的 llquery_url_encode_ex()。
  *
  * @param input 输入字符串
  * @param input_len 输入字符串长度
@@ -376,6 +1021,27 @@ size_t llquery_url_encode(const char *input,
                           char *output,
                           size_t output_size);
 
+/**
+ * @brief 按指定编码集进行URL编码
+ *
+ * 编码集内的字节原样输出，LQENC_FORM 下空格输出 '+'，其余字节输出大写 %XX。
+ * 缓冲区不小于输入长度的 3 倍加 1 时一遍完成编码。
+ *
+ * @param input 输入字符串
+ * @param input_len 输入字符串长度（0表示自动计算）
+ * @param output 输出缓冲区（NULL 表示只计算长度）
+ * @param output_size 输出缓冲区大小
+ * @param set 编码集
+ *
+ * @return 编码后的字符串长度（不含终止符）；缓冲区放不下结果和终止符时不写入，
+ *         返回需要的长度；编码集无效时返回 0
+ */
+size_t llquery_url_encode_ex(const char *input,
+                             size_t input_len,
+                             char *output,
+                             size_t output_size,
+                             enum llquery_encode_set set);
+
 /**
  * @brief URL解码字符串
  *
@@ -413,6 +1079,54 @@ uint16_t llquery_parse_fast(const char *query,
                             uint16_t max_pairs,
                             uint16_t flags);
 
+/**
+ * @brief 从原始查询字符串中提取一个键的值（不完整解析）
+ *
+ * 直接扫描原始字符串，不分配内存。结果与 llquery_parse() 后调用
+ * llquery_get_value() 相同，flags 中的 LQF_AUTO_DECODE、LQF_LOWERCASE_KEYS、
+ * LQF_TRIM_VALUES、LQF_KEEP_EMPTY 生效（小写时 key 应为小写）。
+ * 值为指向 query 的视图，不以'\0'结尾；值需要解码时请使用 llquery_find_ex()。
+ *
+ * @param query 查询字符串
+ * @param query_len 查询字符串长度（0表示自动计算）
+ * @param key 要查找的键名
+ * @param key_len 键名长度（0表示自动计算）
+ * @param value 输出值指针
+ * @param value_len 输出值长度
+ * @param flags 解析选项
+ *
+ * @return LQE_OK；未找到返回 LQE_NOT_FOUND；值需要解码时返回
+ *         LQE_BUFFER_TOO_SMALL，此时 value 为未解码的原始值
+ */
+enum llquery_error llquery_find(const char *query,
+                                size_t query_len,
+                                const char *key,
+                                size_t key_len,
+                                const char **value,
+                                size_t *value_len,
+                                uint16_t flags);
+
+/**
+ * @brief 从原始查询字符串中提取一个键的值，需要时解码到调用方缓冲区
+ *
+ * 与 llquery_find() 相同；匹配的值需要解码时写入 decode_buf 并以'\0'结尾，
+ * 缓冲区至少为原始值长度加 1。
+ *
+ * @param decode_buf 解码缓冲区（可为 NULL）
+ * @param decode_buf_size 解码缓冲区大小
+ *
+ * @return 同 llquery_find()；缓冲区不足时返回 LQE_BUFFER_TOO_SMALL
+ */
+enum llquery_error llquery_find_ex(const char *query,
+                                   size_t query_len,
+                                   const char *key,
+                                   size_t key_len,
+                                   char *decode_buf,
+                                   size_t decode_buf_size,
+                                   const char **value,
+                                   size_t *value_len,
+                                   uint16_t flags);
+
 /**
  * @brief 检查字符串是否为有效的查询字符串
  *
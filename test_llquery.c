@@ -1,5 +1,7 @@
 #include "llquery.h"
+#include <sys/uio.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <assert.h>
 
@@ -219,6 +221,166 @@ void test_stringify() {
     TEST_PASS();
 }
 
+/* 分块输出收集器 */
+struct sink_collect {
+    char *data;
+    size_t len;
+    size_t chunks;
+    size_t max_chunk;
+    size_t stop_after;                /* 收到这么多块后中止，0 表示不中止 */
+};
+
+static int collect_sink(const char *data, size_t len, void *user_data) {
+    struct sink_collect *c = (struct sink_collect *)user_data;
+    memcpy(c->data + c->len, data, len);
+    c->len += len;
+    c->chunks++;
+    if (len > c->max_chunk) c->max_chunk = len;
+    return c->stop_after && c->chunks >= c->stop_after;
+}
+
+/* 测试编码字符串化与分块输出 */
+void test_stringify_encode() {
+    TEST_START("Stringify encode and sink");
+    struct llquery query;
+    char buffer[256];
+
+    llquery_init(&query, 0, LQF_DEFAULT | LQF_KEEP_EMPTY);
+    llquery_parse("a+b=x%26y&k=v%3Dw&e=&u=%E4%B8%AD", 0, &query);
+
+    const char *expect = "a+b=x%26y&k=v%3Dw&e=&u=%E4%B8%AD";
+    size_t expect_len = strlen(expect);
+    ASSERT_EQ(llquery_stringify(&query, NULL, 0, true), expect_len, "Wrong size-only length");
+    size_t len = llquery_stringify(&query, buffer, sizeof(buffer), true);
+    ASSERT_EQ(len, expect_len, "Wrong encoded length");
+    ASSERT_STR_EQ(buffer, expect, "Wrong encoded output");
+
+    // 缓冲区不足时不写入；恰好容纳时先计算长度再写出
+    memset(buffer, 'Z', sizeof(buffer));
+    ASSERT_EQ(llquery_stringify(&query, buffer, expect_len, true), expect_len,
+              "Short buffer should report needed length");
+    ASSERT(buffer[0] == 'Z', "Short buffer should not be written");
+    ASSERT_EQ(llquery_stringify(&query, buffer, expect_len + 1, true), expect_len,
+              "Exact buffer failed");
+    ASSERT_STR_EQ(buffer, expect, "Wrong exact-buffer output");
+
+    // 不编码时输出解码后的原始字节
+    len = llquery_stringify(&query, buffer, sizeof(buffer), false);
+    ASSERT_STR_EQ(buffer, "a b=x&y&k=v=w&e=&u=\xE4\xB8\xAD", "Wrong raw output");
+    ASSERT_EQ(len, strlen(buffer), "Wrong raw length");
+
+    struct sink_collect c;
+    memset(&c, 0, sizeof(c));
+    c.data = buffer;
+    ASSERT_EQ(llquery_stringify_sink(&query, true, collect_sink, &c), expect_len,
+              "Wrong sink length");
+    ASSERT(c.len == expect_len && memcmp(buffer, expect, expect_len) == 0,
+           "Wrong sink output");
+    llquery_free(&query);
+
+    // 大结果：分块输出与连续输出一致，每块不超过 4096 字节
+    size_t qcap = 3000 * 64;
+    char *qs = malloc(qcap);
+    size_t qlen = 0;
+    for (int i = 0; i < 3000; i++) {
+        qlen += (size_t)snprintf(qs + qlen, qcap - qlen, "%sk%d=%s%d", i ? "&" : "",
+                                 i, (i % 3) ? "plain_value_" : "sp%20%26%2F%C3%A9_", i);
+    }
+    llquery_init(&query, 3000, LQF_DEFAULT);
+    ASSERT_EQ(llquery_parse(qs, qlen, &query), LQE_OK, "Large parse failed");
+    ASSERT_EQ(llquery_count_ex(&query), 3000, "Wrong large pair count");
+    for (int enc = 0; enc < 2; enc++) {
+        size_t need = llquery_stringify(&query, NULL, 0, enc);
+        char *flat = malloc(need + 1);
+        ASSERT_EQ(llquery_stringify(&query, flat, need + 1, enc), need, "Large stringify failed");
+        memset(&c, 0, sizeof(c));
+        c.data = malloc(need);
+        ASSERT_EQ(llquery_stringify_sink(&query, enc, collect_sink, &c), need,
+                  "Large sink length mismatch");
+        ASSERT(memcmp(c.data, flat, need) == 0, "Large sink output mismatch");
+        ASSERT(c.chunks > 1 && c.max_chunk <= 4096, "Sink chunks not bounded");
+        free(c.data);
+
+        // 回调返回非0后停止
+        size_t first = c.max_chunk;
+        memset(&c, 0, sizeof(c));
+        c.data = flat;
+        c.stop_after = 1;
+        size_t got = llquery_stringify_sink(&query, enc, collect_sink, &c);
+        ASSERT(c.chunks == 1 && got == 0 && c.len <= first, "Sink abort failed");
+        free(flat);
+    }
+    free(qs);
+    llquery_free(&query);
+    TEST_PASS();
+}
+
+/* 拼接 iovec 内容 */
+static size_t join_iov(const struct iovec *iov, int cnt, char *out) {
+    size_t len = 0;
+    for (int i = 0; i < cnt; i++) {
+        memcpy(out + len, iov[i].iov_base, iov[i].iov_len);
+        len += iov[i].iov_len;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+/* 测试零拷贝字符串化为 iovec */
+void test_stringify_iov() {
+    TEST_START("Stringify iov");
+    struct llquery query;
+    struct iovec iov[16];
+    char scratch[64];
+    char out[256];
+    char expect[256];
+
+    // 零拷贝且未改写：整个结果合并为一项，指向输入
+    const char *input = "a=1&b=2&c=hello";
+    llquery_init(&query, 0, LQF_ZERO_COPY);
+    llquery_parse(input, 0, &query);
+    int cnt = 16;
+    size_t scratch_len = 0;
+    ASSERT_EQ(llquery_stringify_iov(&query, false, iov, &cnt, NULL, &scratch_len), LQE_OK,
+              "Plain iov failed");
+    ASSERT_EQ(cnt, 1, "Contiguous pairs should coalesce");
+    ASSERT(iov[0].iov_base == (void *)input && iov[0].iov_len == strlen(input),
+           "Iov should point at input");
+    ASSERT_EQ(scratch_len, 0, "Plain iov should not use scratch");
+    llquery_free(&query);
+
+    // 解码后的值编码到临时区，其余仍指向原有存储
+    input = "a=x%20y&b=2&e=&c=%2F";
+    llquery_init(&query, 0, LQF_ZERO_COPY | LQF_AUTO_DECODE | LQF_KEEP_EMPTY);
+    llquery_parse(input, 0, &query);
+    for (int enc = 0; enc < 2; enc++) {
+        size_t expect_len = llquery_stringify(&query, expect, sizeof(expect), enc);
+        cnt = 16;
+        scratch_len = sizeof(scratch);
+        ASSERT_EQ(llquery_stringify_iov(&query, enc, iov, &cnt, scratch, &scratch_len), LQE_OK,
+                  "Encoded iov failed");
+        ASSERT_EQ(join_iov(iov, cnt, out), expect_len, "Wrong iov length");
+        ASSERT_STR_EQ(out, expect, "Iov output differs from stringify");
+        ASSERT_EQ(scratch_len, enc ? strlen("x+y%2F") : 0, "Wrong scratch usage");
+    }
+
+    // 容量不足时报告所需大小
+    cnt = 1;
+    scratch_len = 2;
+    ASSERT_EQ(llquery_stringify_iov(&query, true, iov, &cnt, scratch, &scratch_len),
+              LQE_BUFFER_TOO_SMALL, "Short buffers should fail");
+    ASSERT_EQ(scratch_len, strlen("x+y%2F"), "Wrong required scratch");
+    scratch_len = sizeof(scratch);
+    int need = 1;
+    llquery_stringify_iov(&query, true, iov, &need, scratch, &scratch_len);
+    cnt = need;
+    ASSERT_EQ(llquery_stringify_iov(&query, true, iov, &cnt, scratch, &scratch_len), LQE_OK,
+              "Reported iov count should suffice");
+    ASSERT_EQ(cnt, need, "Wrong reported iov count");
+    llquery_free(&query);
+    TEST_PASS();
+}
+
 /* 测试快速解析 */
 void test_fast_parse() {
     TEST_START("Fast parse");
@@ -280,6 +442,48 @@ void test_url_encode_decode() {
     TEST_PASS();
 }
 
+/* 测试 URL 编码集 */
+void test_url_encode_sets() {
+    TEST_START("URL encode sets");
+    char out[256];
+    const char *text = "a b/c:d@e!f~g+h%i";
+
+    ASSERT_EQ(llquery_url_encode_ex(text, 0, out, sizeof(out), LQENC_FORM), 29,
+              "Form encode length wrong");
+    ASSERT_STR_EQ(out, "a+b%2Fc%3Ad%40e%21f~g%2Bh%25i", "Form encode wrong");
+    llquery_url_encode_ex(text, 0, out, sizeof(out), LQENC_UNRESERVED);
+    ASSERT_STR_EQ(out, "a%20b%2Fc%3Ad%40e%21f~g%2Bh%25i", "Unreserved encode wrong");
+    llquery_url_encode_ex(text, 0, out, sizeof(out), LQENC_PATH);
+    ASSERT_STR_EQ(out, "a%20b%2Fc:d@e!f~g+h%25i", "Path encode wrong");
+    llquery_url_encode_ex(text, 0, out, sizeof(out), LQENC_USERINFO);
+    ASSERT_STR_EQ(out, "a%20b%2Fc%3Ad%40e!f~g+h%25i", "Userinfo encode wrong");
+
+    // 表单编码中空格只占一个字节；'\0' 字节也要编码
+    ASSERT_EQ(llquery_url_encode("a b c", 0, NULL, 0), 5, "Space counted as %XX");
+    ASSERT_EQ(llquery_url_encode("a\0b", 3, out, sizeof(out)), 5, "NUL byte not encoded");
+    ASSERT_STR_EQ(out, "a%00b", "NUL byte encode wrong");
+
+    // 长的安全字符段整块复制，UTF-8 字节编码
+    const char *url = "https://example.com/callback?state=0123456789abcdef\xE4\xB8\xAD";
+    size_t len = llquery_url_encode_ex(url, 0, out, sizeof(out), LQENC_UNRESERVED);
+    ASSERT_STR_EQ(out, "https%3A%2F%2Fexample.com%2Fcallback%3Fstate%3D0123456789abcdef%E4%B8%AD",
+                  "Long encode wrong");
+
+    // 缓冲区正好容纳结果和终止符；小一个字节时返回所需长度且不写入
+    memset(out, 'X', sizeof(out));
+    ASSERT_EQ(llquery_url_encode_ex(url, 0, out, len + 1, LQENC_UNRESERVED), len,
+              "Tight encode failed");
+    ASSERT(out[len] == '\0' && out[len + 1] == 'X', "Tight encode wrote past result");
+    memset(out, 'X', sizeof(out));
+    ASSERT_EQ(llquery_url_encode_ex(url, 0, out, len, LQENC_UNRESERVED), len,
+              "Should return required size");
+    ASSERT(out[0] == 'X', "Encode wrote into a short buffer");
+    ASSERT_EQ(llquery_url_encode_ex(url, 0, out, sizeof(out), (enum llquery_encode_set)9), 0,
+              "Invalid set accepted");
+
+    TEST_PASS();
+}
+
 /* 测试克隆 */
 void test_clone() {
     TEST_START("Clone");
@@ -322,6 +526,76 @@ void test_reset() {
     TEST_PASS();
 }
 
+/* 计数分配器 */
+struct alloc_stats {
+    int allocs;
+    int frees;
+};
+
+static void *counting_alloc(size_t size, void *user_data) {
+    ((struct alloc_stats *)user_data)->allocs++;
+    return malloc(size);
+}
+
+static void counting_free(void *ptr, void *user_data) {
+    ((struct alloc_stats *)user_data)->frees++;
+    free(ptr);
+}
+
+/* 测试重置保留容量 */
+void test_reset_retains_capacity() {
+    TEST_START("Reset retains capacity");
+    struct llquery query;
+    struct alloc_stats stats = {0, 0};
+
+    llquery_init_ex(&query, 0, LQF_AUTO_DECODE, counting_alloc, counting_free, &stats);
+    ASSERT(llquery_parse("a=1&b=hello+world&c=%41", 0, &query) == LQE_OK, "First parse failed");
+    int warm = stats.allocs;
+
+    // 相近长度的查询重复解析，不再分配
+    for (int i = 0; i < 100; i++) {
+        ASSERT(llquery_parse("x=2&y=foo%20bar", 0, &query) == LQE_OK, "Reparse failed");
+    }
+    ASSERT_EQ(stats.allocs, warm, "Reparse should reuse the pool");
+    ASSERT_STR_EQ(llquery_get_value(&query, "y", 1), "foo bar", "Reparse value wrong");
+
+    // 更长的查询触发扩容，之后再次稳定
+    char long_query[1024];
+    size_t pos = 0;
+    for (int i = 0; i < 60; i++) {
+        pos += (size_t)snprintf(long_query + pos, sizeof(long_query) - pos, "k%d=v%d&", i, i);
+    }
+    ASSERT(llquery_parse(long_query, pos, &query) == LQE_OK, "Long parse failed");
+    int grown = stats.allocs;
+    ASSERT(grown > warm, "Long query should grow the pool");
+    ASSERT(llquery_parse("a=1", 0, &query) == LQE_OK, "Short parse after grow failed");
+    ASSERT(llquery_parse(long_query, pos, &query) == LQE_OK, "Long reparse failed");
+    ASSERT_EQ(stats.allocs, grown, "Grown pool should be reused");
+    ASSERT_STR_EQ(llquery_get_value(&query, "k59", 3), "v59", "Long reparse value wrong");
+
+    // 零拷贝模式复用自有解码缓冲区
+    query.flags = LQF_AUTO_DECODE | LQF_ZERO_COPY;
+    ASSERT(llquery_parse("q=%41%42", 0, &query) == LQE_OK, "Zero-copy parse failed");
+    int zc = stats.allocs;
+    ASSERT(llquery_parse("q=%43%44", 0, &query) == LQE_OK, "Zero-copy reparse failed");
+    ASSERT_EQ(stats.allocs, zc, "Zero-copy reparse should reuse decode buffer");
+
+    // 当前结果仍引用解码缓冲区时 shrink 不释放
+    int frees = stats.frees;
+    llquery_shrink(&query);
+    ASSERT_EQ(stats.frees, frees + 1, "Shrink should only release the idle pool");
+    const struct llquery_kv *kv = llquery_get_kv(&query, 0);
+    ASSERT(kv->value_len == 2 && memcmp(kv->value, "CD", 2) == 0, "Shrink broke live results");
+
+    llquery_reset(&query);
+    llquery_shrink(&query);
+    ASSERT_EQ(stats.frees, frees + 2, "Shrink after reset should release decode buffer");
+
+    llquery_free(&query);
+    ASSERT_EQ(stats.allocs, stats.frees, "Allocations leaked");
+    TEST_PASS();
+}
+
 /* 测试错误处理 */
 void test_error_handling() {
     TEST_START("Error handling");
@@ -588,7 +862,46 @@ void test_url_codec_boundary() {
     // 缓冲区太小
     len = llquery_url_encode("hello world test", 0, encoded, 5);
     ASSERT(len > 5, "Should return required size");
-    
+
+    // 长输入：转义落在块边界两侧，末尾为不完整的编码
+    char input[128];
+    char expected[128];
+    size_t in_len = 0, out_len = 0;
+    for (int i = 0; i < 40; i++) {
+        if (i % 13 == 12) {
+            memcpy(input + in_len, "%2F", 3);
+            in_len += 3;
+            expected[out_len++] = '/';
+        } else if (i % 7 == 6) {
+            input[in_len++] = '+';
+            expected[out_len++] = ' ';
+        } else {
+            input[in_len++] = (char)('a' + i % 26);
+            expected[out_len++] = (char)('a' + i % 26);
+        }
+    }
+    memcpy(input + in_len, "%4", 2);
+    in_len += 2;
+    memcpy(expected + out_len, "%4", 2);
+    out_len += 2;
+    ASSERT_EQ(llquery_url_decode(input, in_len, NULL, 0), out_len, "Wrong size-only result");
+    len = llquery_url_decode(input, in_len, decoded, sizeof(decoded));
+    ASSERT(len == out_len && memcmp(decoded, expected, out_len) == 0 && decoded[len] == '\0',
+           "Long decode wrong");
+
+    // 缓冲区只够解码结果：不写出结果以外的字节
+    memset(decoded, 'X', sizeof(decoded));
+    len = llquery_url_decode(input, in_len, decoded, out_len + 1);
+    ASSERT(len == out_len && memcmp(decoded, expected, out_len) == 0, "Tight decode wrong");
+    ASSERT(decoded[out_len + 1] == 'X', "Tight decode wrote past buffer");
+    ASSERT_EQ(llquery_url_decode(input, in_len, decoded, out_len), out_len,
+              "Should return required size");
+
+    // 原地解码
+    memcpy(decoded, input, in_len);
+    len = llquery_url_decode(decoded, in_len, decoded, in_len + 1);
+    ASSERT(len == out_len && memcmp(decoded, expected, out_len) == 0, "In-place decode wrong");
+
     TEST_PASS();
 }
 
@@ -689,6 +1002,1187 @@ void test_fast_parse_limits() {
     TEST_PASS();
 }
 
+/* 测试长查询（跨越多个 64 字节结构索引块） */
+void test_long_query_blocks() {
+    TEST_START("Long query across index blocks");
+    struct llquery query;
+    char long_query[4096];
+    size_t pos = 0;
+
+    // 48 个参数，值长度各不相同，使分隔符落在块内不同位置
+    for (int i = 0; i < 48; i++) {
+        pos += (size_t)sprintf(long_query + pos, "%sk%d=", i ? "&" : "", i);
+        for (int j = 0; j < (i * 7) % 61; j++) {
+            long_query[pos++] = (char)('a' + j % 26);
+        }
+        long_query[pos++] = 'z';
+    }
+    long_query[pos] = '\0';
+
+    llquery_init(&query, 0, LQF_DEFAULT);
+    enum llquery_error err = llquery_parse(long_query, pos, &query);
+    ASSERT(err == LQE_OK, "Parse failed");
+    ASSERT_EQ(llquery_count(&query), 48, "Wrong count");
+
+    for (int i = 0; i < 48; i++) {
+        char key[8];
+        int key_len = sprintf(key, "k%d", i);
+        const struct llquery_kv *kv = llquery_get_kv(&query, (uint16_t)i);
+        ASSERT(kv->key_len == (size_t)key_len && memcmp(kv->key, key, key_len) == 0,
+               "Wrong key");
+        ASSERT_EQ(kv->value_len, (size_t)((i * 7) % 61 + 1), "Wrong value length");
+        ASSERT(kv->value[kv->value_len - 1] == 'z', "Wrong value tail");
+    }
+    llquery_reset(&query);
+
+    // '=' 与 '&' 恰好位于块边界（偏移 63 和 64）
+    memset(long_query, 'a', 63);
+    long_query[63] = '=';
+    long_query[64] = '&';
+    strcpy(long_query + 65, "b=1");
+    err = llquery_parse(long_query, 0, &query);
+    ASSERT(err == LQE_OK, "Boundary parse failed");
+    ASSERT_EQ(llquery_count(&query), 1, "Empty value at boundary should be dropped");
+    ASSERT_STR_EQ(llquery_get_value(&query, "b", 1), "1", "Wrong value after boundary");
+
+    llquery_free(&query);
+    TEST_PASS();
+}
+
+/* 测试按字（8 字节）扫描路径与逐字节路径结果一致 */
+void test_word_scanners() {
+    TEST_START("Word-at-a-time scanners");
+
+    // 计数：连续 '&' 跨越 8 字节边界、结尾分隔符
+    ASSERT_EQ(llquery_count_pairs("alpha=1&&&&&&&&&&beta=2&gamma&&", 0), 3,
+              "Wrong pair count across words");
+    ASSERT_EQ(llquery_count_pairs("&&&&&&&&&&&&&&&&", 0), 0, "Only separators");
+    ASSERT_EQ(llquery_count_pairs("a&b&c&d&e&f&g&h&i&j&k", 0), 11, "Short pairs");
+
+    // 有效性：非法字符出现在第二个字内、非 ASCII 字节
+    ASSERT(llquery_is_valid("key_name=value-1.2~3&x=%41+b", 0) == true,
+           "Valid long string rejected");
+    ASSERT(llquery_is_valid("abcdefghij kl=1", 0) == false, "Space accepted");
+    ASSERT(llquery_is_valid("abcdefgh\xC3\xA9=1", 0) == false, "Non-ASCII accepted");
+    ASSERT(llquery_is_valid("abcdefghijklmn/p", 0) == false, "Slash accepted");
+
+    // 编码检测：'%' 位于第一个字之后
+    struct llquery query;
+    llquery_init(&query, 0, LQF_AUTO_DECODE);
+    llquery_parse("longer_key=abcdefg%21", 0, &query);
+    ASSERT_STR_EQ(llquery_get_value(&query, "longer_key", 10), "abcdefg!",
+                  "Escape after first word not decoded");
+    llquery_free(&query);
+
+    TEST_PASS();
+}
+
+/* 测试按 token 解码：编码的结构字符不影响切分，is_encoded 按键值对标记 */
+void test_per_token_decode() {
+    TEST_START("Per-token decode");
+    struct llquery query;
+
+    llquery_init(&query, 0, LQF_AUTO_DECODE);
+    llquery_parse("a=x%26y&b=p%3Dq&plain=1&k%65y=v+w", 0, &query);
+
+    ASSERT_EQ(llquery_count(&query), 4, "Encoded '&' or '=' split a pair");
+    ASSERT_STR_EQ(llquery_get_value(&query, "a", 1), "x&y", "Wrong %26 decode");
+    ASSERT_STR_EQ(llquery_get_value(&query, "b", 1), "p=q", "Wrong %3D decode");
+    ASSERT_STR_EQ(llquery_get_value(&query, "key", 3), "v w", "Encoded key not decoded");
+
+    ASSERT(llquery_get_kv(&query, 0)->is_encoded, "Pair 0 should be encoded");
+    ASSERT(!llquery_get_kv(&query, 2)->is_encoded, "Plain pair marked encoded");
+    ASSERT(llquery_get_kv(&query, 3)->is_encoded, "Pair 3 should be encoded");
+    ASSERT_EQ(llquery_get_kv(&query, 3)->key_len, 3, "Wrong decoded key length");
+
+    llquery_free(&query);
+
+    // 未开启自动解码时保留原文
+    llquery_init(&query, 0, LQF_NONE);
+    llquery_parse("a=x%26y", 0, &query);
+    ASSERT_STR_EQ(llquery_get_value(&query, "a", 1), "x%26y", "Raw value changed");
+    ASSERT(!llquery_get_kv(&query, 0)->is_encoded, "Raw pair marked encoded");
+    llquery_free(&query);
+
+    TEST_PASS();
+}
+
+/* 测试零拷贝模式 */
+void test_zero_copy() {
+    TEST_START("Zero-copy parse");
+    struct llquery query;
+
+    // 输入不以 '\0' 结尾，键值为指向输入的视图
+    const char input[] = {'a','=','1','&','n','a','m','e','=','J','o','+','D','&','K','=',' ','x',' ','!'};
+    size_t input_len = sizeof(input) - 1;  // 最后的 '!' 不属于查询
+
+    llquery_init(&query, 0, LQF_AUTO_DECODE | LQF_ZERO_COPY | LQF_TRIM_VALUES);
+    enum llquery_error err = llquery_parse(input, input_len, &query);
+    ASSERT(err == LQE_OK, "Zero-copy parse failed");
+    ASSERT_EQ(llquery_count(&query), 3, "Wrong count");
+
+    const struct llquery_kv *kv = llquery_get_kv(&query, 0);
+    ASSERT(kv->key == input && kv->value == input + 2, "Plain pair should reference input");
+
+    kv = llquery_get_kv_by_key(&query, "name", 4);
+    ASSERT(kv != NULL, "name not found");
+    ASSERT(kv->value_len == 4 && memcmp(kv->value, "Jo D", 4) == 0, "Wrong decoded value");
+    ASSERT(kv->value < input || kv->value >= input + sizeof(input),
+           "Decoded value should live in side buffer");
+
+    kv = llquery_get_kv_by_key(&query, "K", 1);
+    ASSERT(kv != NULL && kv->value_len == 1 && kv->value[0] == 'x', "Trimmed view wrong");
+    ASSERT(kv->value == input + 17, "Trimmed value should still reference input");
+    llquery_free(&query);
+
+    // 外部解码缓冲区不足
+    char small_buf[2];
+    llquery_init(&query, 0, LQF_AUTO_DECODE | LQF_ZERO_COPY);
+    err = llquery_parse_ex("a=1&b=%41%42%43", 0, &query, small_buf, sizeof(small_buf));
+    ASSERT(err == LQE_BUFFER_TOO_SMALL, "Small decode buffer not detected");
+    ASSERT_EQ(llquery_count(&query), 1, "Pairs before failure should be kept");
+
+    // 小写键需要写入外部缓冲区
+    char side_buf[64];
+    err = llquery_parse_ex("Key=%41b&x=y", 0, &query, side_buf, sizeof(side_buf));
+    ASSERT(err == LQE_OK, "Parse with side buffer failed");
+    kv = llquery_get_kv(&query, 0);
+    ASSERT(kv->value == side_buf && kv->value_len == 2 && memcmp(kv->value, "Ab", 2) == 0,
+           "Decoded value should be in caller buffer");
+    llquery_free(&query);
+
+    llquery_init(&query, 0, LQF_ZERO_COPY | LQF_LOWERCASE_KEYS);
+    llquery_parse("MiXeD=1", 0, &query);
+    kv = llquery_get_kv_by_key(&query, "mixed", 5);
+    ASSERT(kv != NULL && kv->value_len == 1, "Lowercased zero-copy key not found");
+    llquery_free(&query);
+
+    TEST_PASS();
+}
+
+/* 测试延迟解析 */
+static int count_cb(const struct llquery_kv *kv, void *user_data) {
+    (void)kv;
+    (*(int *)user_data)++;
+    return 0;
+}
+
+void test_lazy_parse() {
+    TEST_START("Lazy parse");
+    struct llquery query;
+    const char *input = "Name=John+Doe&a=1&%4Bey=%41&e=&t=+x+&u=+";
+
+    llquery_init(&query, 0, LQF_AUTO_DECODE | LQF_LAZY | LQF_LOWERCASE_KEYS | LQF_TRIM_VALUES);
+    ASSERT(llquery_parse(input, 0, &query) == LQE_OK, "Lazy parse failed");
+    // 空值和去空白后为空的值在解析时即被丢弃，与立即模式一致
+    ASSERT_EQ(llquery_count(&query), 4, "Lazy count wrong");
+
+    // 未访问的键值对仍指向输入
+    ASSERT(query.kv_pairs[1].key == input + 14, "Untouched pair should reference input");
+
+    ASSERT_STR_EQ(llquery_get_value(&query, "name", 4), "John Doe", "Lazy decode wrong");
+    ASSERT_STR_EQ(llquery_get_value(&query, "key", 3), "A", "Lazy key decode wrong");
+    ASSERT_STR_EQ(llquery_get_value(&query, "t", 1), "x", "Lazy trim wrong");
+    ASSERT(query.kv_pairs[1].key == input + 14, "Lookup should not touch other pairs");
+
+    const struct llquery_kv *kv = llquery_get_kv(&query, 1);
+    ASSERT(kv != NULL && strcmp(kv->key, "a") == 0, "Lazy get_kv wrong");
+    ASSERT(llquery_get_value(&query, "Name", 4) == NULL, "Lowercased key should not match");
+
+    // 结果与立即模式一致
+    char lazy_out[128], eager_out[128];
+    llquery_stringify(&query, lazy_out, sizeof(lazy_out), false);
+    struct llquery eager;
+    llquery_init(&eager, 0, LQF_AUTO_DECODE | LQF_LOWERCASE_KEYS | LQF_TRIM_VALUES);
+    llquery_parse(input, 0, &eager);
+    llquery_stringify(&eager, eager_out, sizeof(eager_out), false);
+    ASSERT_STR_EQ(lazy_out, eager_out, "Lazy result differs from eager");
+    llquery_free(&eager);
+
+    int visited = 0;
+    llquery_reset(&query);
+    llquery_parse("b=2&a=%31", 0, &query);
+    ASSERT_EQ(llquery_iterate(&query, count_cb, &visited), 2, "Lazy iterate wrong");
+    ASSERT(llquery_sort(&query, NULL) == LQE_OK, "Lazy sort failed");
+    ASSERT_STR_EQ(llquery_get_kv(&query, 0)->value, "1", "Lazy sort wrong");
+    llquery_free(&query);
+
+    // 零拷贝 + 延迟
+    llquery_init(&query, 0, LQF_AUTO_DECODE | LQF_LAZY | LQF_ZERO_COPY);
+    ASSERT(llquery_parse("x=1&y=%41%42", 0, &query) == LQE_OK, "Lazy zero-copy parse failed");
+    kv = llquery_get_kv_by_key(&query, "y", 1);
+    ASSERT(kv != NULL && kv->value_len == 2 && memcmp(kv->value, "AB", 2) == 0,
+           "Lazy zero-copy decode wrong");
+
+    struct llquery copy;
+    ASSERT(llquery_clone(&copy, &query) == LQE_OK, "Clone of lazy parser failed");
+    ASSERT_STR_EQ(llquery_get_value(&copy, "x", 1), "1", "Clone value wrong");
+    llquery_free(&copy);
+    llquery_free(&query);
+
+    TEST_PASS();
+}
+
+/* 测试流式解析 */
+static int collect_cb(const struct llquery_kv *kv, void *user_data) {
+    char *out = (char *)user_data;
+    size_t n = strlen(out);
+    snprintf(out + n, 256 - n, "%s%s=%s", n ? "&" : "", kv->key, kv->value);
+    return 0;
+}
+
+void test_stream_parse() {
+    TEST_START("Streaming parse");
+    const char *input = "?name=John+Doe&email=john%40example.com&&x=%E4%BD%A0&e=&last";
+    size_t len = strlen(input);
+
+    struct llquery expect;
+    llquery_init(&expect, 0, LQF_AUTO_DECODE);
+    llquery_parse(input, len, &expect);
+    char expect_str[256];
+    llquery_stringify(&expect, expect_str, sizeof(expect_str), false);
+
+    // 在每个位置切成两块（包括把 %XX 拆开）
+    for (size_t cut = 0; cut <= len; cut++) {
+        struct llquery query;
+        struct llquery_stream stream;
+        llquery_init(&query, 0, LQF_AUTO_DECODE);
+        ASSERT(llquery_stream_init(&stream, &query, 0, NULL, NULL) == LQE_OK, "Stream init failed");
+        ASSERT(llquery_stream_feed(&stream, input, cut) == LQE_OK, "Feed first chunk failed");
+        ASSERT(llquery_stream_feed(&stream, input + cut, len - cut) == LQE_OK, "Feed second chunk failed");
+        ASSERT(llquery_stream_finish(&stream) == LQE_OK, "Finish failed");
+        llquery_stream_free(&stream);
+
+        char out[256];
+        llquery_stringify(&query, out, sizeof(out), false);
+        ASSERT_STR_EQ(out, expect_str, "Split stream differs from parse");
+        llquery_free(&query);
+    }
+
+    // 逐字节输入，只使用回调
+    char collected[256] = "";
+    struct llquery_stream stream;
+    ASSERT(llquery_stream_init(&stream, NULL, LQF_AUTO_DECODE, collect_cb, collected) == LQE_OK,
+           "Callback stream init failed");
+    for (size_t i = 0; i < len; i++) {
+        ASSERT(llquery_stream_feed(&stream, input + i, 1) == LQE_OK, "Byte feed failed");
+    }
+    ASSERT(llquery_stream_finish(&stream) == LQE_OK, "Callback finish failed");
+    llquery_stream_free(&stream);
+    ASSERT_STR_EQ(collected, expect_str, "Callback stream differs from parse");
+
+    ASSERT(llquery_stream_init(&stream, NULL, 0, NULL, NULL) == LQE_NULL_INPUT,
+           "Stream without target should fail");
+
+    // 严格模式下超出限制
+    struct llquery small;
+    llquery_init(&small, 2, LQF_STRICT);
+    llquery_stream_init(&stream, &small, 0, NULL, NULL);
+    ASSERT(llquery_stream_feed(&stream, "a=1&b=2&c=3&", 12) == LQE_TOO_MANY_PAIRS,
+           "Strict stream limit not enforced");
+    ASSERT(llquery_stream_feed(&stream, "d=4", 3) == LQE_TOO_MANY_PAIRS, "Error should be sticky");
+    llquery_stream_free(&stream);
+    ASSERT_EQ(llquery_count(&small), 2, "Pairs before limit should be kept");
+    llquery_free(&small);
+
+    llquery_free(&expect);
+    TEST_PASS();
+}
+
+/* 测试分散输入解析 */
+void test_parse_iov() {
+    TEST_START("Scatter/gather parse");
+    struct llquery query;
+
+    // "a=1&name=Jo" + "hn+Doe&b=" + "2&c=%4" + "1"
+    char s1[] = "a=1&name=Jo";
+    char s2[] = "hn+Doe&b=";
+    char s3[] = "2&c=%4";
+    char s4[] = "1";
+    struct iovec iov[4] = {
+        { s1, strlen(s1) }, { s2, strlen(s2) }, { s3, strlen(s3) }, { s4, strlen(s4) }
+    };
+
+    llquery_init(&query, 0, LQF_AUTO_DECODE | LQF_ZERO_COPY);
+    ASSERT(llquery_parse_iov(iov, 4, &query) == LQE_OK, "iov parse failed");
+    ASSERT_EQ(llquery_count(&query), 4, "Wrong iov count");
+
+    // 分段内的键值对仍为视图
+    const struct llquery_kv *kv = llquery_get_kv(&query, 0);
+    ASSERT(kv->key == s1 && kv->value == s1 + 2, "In-segment pair should reference input");
+
+    kv = llquery_get_kv_by_key(&query, "name", 4);
+    ASSERT(kv != NULL && kv->value_len == 8 && memcmp(kv->value, "John Doe", 8) == 0,
+           "Stitched value wrong");
+    kv = llquery_get_kv_by_key(&query, "b", 1);
+    ASSERT(kv != NULL && kv->value_len == 1 && kv->value[0] == '2', "Boundary value wrong");
+    kv = llquery_get_kv_by_key(&query, "c", 1);
+    ASSERT(kv != NULL && kv->value_len == 1 && kv->value[0] == 'A', "Split escape wrong");
+    llquery_free(&query);
+
+    // 分段末尾的键值对：下一分段以 '&' 开头（中间可有空分段）或没有下一分段时仍为视图
+    char t1[] = "a=1&b=2";
+    char t2[] = "&c=3&d=4";
+    struct iovec iov2[3] = { { t1, strlen(t1) }, { s4, 0 }, { t2, strlen(t2) } };
+    llquery_init(&query, 0, LQF_AUTO_DECODE | LQF_ZERO_COPY);
+    ASSERT(llquery_parse_iov(iov2, 3, &query) == LQE_OK, "Aligned iov parse failed");
+    ASSERT_EQ(llquery_count(&query), 4, "Wrong aligned iov count");
+    kv = llquery_get_kv(&query, 1);
+    ASSERT(kv->key == t1 + 4 && kv->value == t1 + 6 && kv->value_len == 1,
+           "Last pair of a segment should reference input");
+    kv = llquery_get_kv(&query, 3);
+    ASSERT(kv->key == t2 + 5 && kv->value == t2 + 7 && kv->value_len == 1,
+           "Final pair of the last segment should reference input");
+    llquery_free(&query);
+
+    // 复制模式与 llquery_parse() 结果一致
+    llquery_init(&query, 0, LQF_AUTO_DECODE);
+    ASSERT(llquery_parse_iov(iov, 4, &query) == LQE_OK, "Copy iov parse failed");
+    ASSERT_STR_EQ(llquery_get_value(&query, "name", 4), "John Doe", "Copy stitched value wrong");
+    ASSERT_STR_EQ(llquery_get_value(&query, "c", 1), "A", "Copy split escape wrong");
+
+    struct iovec empty[2] = { { s1, 0 }, { s4, 0 } };
+    ASSERT(llquery_parse_iov(empty, 2, &query) == LQE_OK, "Empty iov parse failed");
+    ASSERT_EQ(llquery_count(&query), 0, "Empty iov should have no pairs");
+    ASSERT(llquery_parse_iov(NULL, 1, &query) == LQE_NULL_INPUT, "NULL iov not rejected");
+    llquery_free(&query);
+
+    TEST_PASS();
+}
+
+/* 测试可增长键值对存储（超过 65535 个键值对） */
+void test_growable_pairs() {
+    TEST_START("Growable pairs");
+    struct llquery query;
+
+    const uint32_t total = 70000;
+    size_t cap = (size_t)total * 16;
+    char *big = malloc(cap);
+    ASSERT(big != NULL, "Allocation failed");
+    size_t pos = 0;
+    for (uint32_t i = 0; i < total; i++) {
+        pos += (size_t)snprintf(big + pos, cap - pos, "%sk%u=v%u", i ? "&" : "", i, i);
+    }
+
+    // 固定容量模式仍受 max_pairs 限制
+    llquery_init(&query, 8, LQF_STRICT);
+    ASSERT(llquery_parse(big, pos, &query) == LQE_TOO_MANY_PAIRS, "Fixed mode should hit limit");
+    ASSERT_EQ(llquery_count_ex(&query), 8, "Fixed mode count wrong");
+    llquery_free(&query);
+
+    ASSERT(llquery_init_growable(&query, 0, LQF_NONE) == LQE_OK, "Growable init failed");
+    ASSERT(llquery_parse("a=1&b=2", 0, &query) == LQE_OK, "Small parse failed");
+    ASSERT_EQ(llquery_count_ex(&query), 2, "Small count wrong");
+
+    ASSERT(llquery_parse(big, pos, &query) == LQE_OK, "Big parse failed");
+    ASSERT_EQ(llquery_count_ex(&query), total, "Big count wrong");
+    ASSERT_EQ(llquery_count(&query), 65535, "16-bit count should saturate");
+    const struct llquery_kv *kv = llquery_get_kv_ex(&query, total - 1);
+    ASSERT(kv != NULL, "Last pair missing");
+    ASSERT_STR_EQ(kv->key, "k69999", "Last key wrong");
+    ASSERT(llquery_get_kv_ex(&query, total) == NULL, "Out of range index should fail");
+    ASSERT_STR_EQ(llquery_get_value(&query, "k68000", 0), "v68000", "Lookup past 65535 failed");
+
+    // 克隆保留全部键值对
+    struct llquery copy;
+    ASSERT(llquery_clone(&copy, &query) == LQE_OK, "Clone failed");
+    ASSERT_EQ(llquery_count_ex(&copy), total, "Clone count wrong");
+    ASSERT_STR_EQ(llquery_get_kv_ex(&copy, 69000)->value, "v69000", "Clone value wrong");
+    llquery_free(&copy);
+
+    // 数量上限与严格模式
+    llquery_free(&query);
+    llquery_init_growable(&query, 100000, LQF_NONE);
+    ASSERT(llquery_parse(big, pos, &query) == LQE_OK, "Limited parse failed");
+    ASSERT_EQ(llquery_count_ex(&query), total, "Limited count wrong");
+    llquery_free(&query);
+    llquery_init_growable(&query, 1000, LQF_STRICT);
+    ASSERT(llquery_parse(big, pos, &query) == LQE_TOO_MANY_PAIRS, "Growable limit not enforced");
+    ASSERT_EQ(llquery_count_ex(&query), 1000, "Growable limit count wrong");
+
+    // 收缩后可再次解析
+    llquery_reset(&query);
+    llquery_shrink(&query);
+    ASSERT(llquery_parse("x=1", 0, &query) == LQE_OK, "Parse after shrink failed");
+    ASSERT_STR_EQ(llquery_get_value(&query, "x", 1), "1", "Value after shrink wrong");
+
+    llquery_free(&query);
+    free(big);
+    TEST_PASS();
+}
+
+/* 测试键哈希索引（键值对较多时按键查找） */
+static bool drop_even_cb(const struct llquery_kv *kv, void *user_data) {
+    (void)user_data;
+    return kv->value_len > 0 && (kv->value[kv->value_len - 1] - '0') % 2 != 0;
+}
+
+void test_hash_index() {
+    TEST_START("Hash index");
+    struct llquery query;
+    char buf[8192];
+    size_t pos = 0;
+
+    // 200 个不同的键，外加 "dup" 重复 5 次、大小写混合的 "Mixed" 与编码键
+    for (int i = 0; i < 200; i++) {
+        pos += (size_t)snprintf(buf + pos, sizeof(buf) - pos, "key%d=%d&", i, i);
+        if (i % 40 == 0) {
+            pos += (size_t)snprintf(buf + pos, sizeof(buf) - pos, "dup=%d&", i / 40);
+        }
+    }
+    pos += (size_t)snprintf(buf + pos, sizeof(buf) - pos, "Mixed=m&%%41%%42=ab");
+
+    uint16_t modes[] = {LQF_DEFAULT, LQF_DEFAULT | LQF_LOWERCASE_KEYS,
+                        LQF_DEFAULT | LQF_LAZY, LQF_DEFAULT | LQF_LAZY | LQF_LOWERCASE_KEYS};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        bool lower = (modes[m] & LQF_LOWERCASE_KEYS) != 0;
+        llquery_init(&query, 512, modes[m]);
+        ASSERT(llquery_parse(buf, pos, &query) == LQE_OK, "Parse failed");
+
+        // 先做若干次未命中的查找，累计扫描量足够后建立索引
+        ASSERT_STR_EQ(llquery_get_value(&query, "key150", 0), "150", "Linear lookup wrong");
+        for (int i = 0; i < 10; i++) {
+            ASSERT(!llquery_has_key(&query, "nokey", 0), "Missing key found");
+        }
+
+        ASSERT_STR_EQ(llquery_get_value(&query, "key0", 0), "0", "First key wrong");
+        ASSERT_STR_EQ(llquery_get_value(&query, "key199", 0), "199", "Last key wrong");
+        ASSERT(llquery_get_value(&query, "key200", 0) == NULL, "Missing key found");
+        ASSERT(llquery_has_key(&query, "key123", 0), "has_key failed");
+        ASSERT(!llquery_has_key(&query, "key", 0), "Prefix should not match");
+        ASSERT_STR_EQ(llquery_get_value(&query, lower ? "mixed" : "Mixed", 0), "m", "Mixed key wrong");
+        ASSERT(llquery_get_value(&query, lower ? "Mixed" : "mixed", 0) == NULL, "Case should matter");
+        ASSERT_STR_EQ(llquery_get_value(&query, lower ? "ab" : "AB", 0), "ab", "Encoded key wrong");
+
+        // 同键链表按原始顺序返回
+        const char *values[8];
+        ASSERT_EQ(llquery_get_all_values(&query, "dup", 3, values, 8), 5, "Dup count wrong");
+        ASSERT_STR_EQ(values[0], "0", "Dup order wrong");
+        ASSERT_STR_EQ(values[4], "4", "Dup order wrong");
+        ASSERT_EQ(llquery_get_all_values(&query, "dup", 3, values, 2), 2, "Dup max_values wrong");
+
+        // 过滤与排序后索引重建
+        llquery_filter(&query, drop_even_cb, NULL);
+        ASSERT(llquery_get_value(&query, "key10", 0) == NULL, "Filtered key still found");
+        ASSERT_STR_EQ(llquery_get_value(&query, "key11", 0), "11", "Key after filter wrong");
+        ASSERT_EQ(llquery_get_all_values(&query, "dup", 3, values, 8), 2, "Dup after filter wrong");
+        llquery_sort(&query, NULL);
+        ASSERT_STR_EQ(llquery_get_value(&query, "key199", 0), "199", "Key after sort wrong");
+        ASSERT_STR_EQ(values[0], "1", "Dup after filter order wrong");
+
+        // 重新解析较少的键值对时回退到线性查找
+        ASSERT(llquery_parse("a=1&b=2", 0, &query) == LQE_OK, "Reparse failed");
+        ASSERT(llquery_get_value(&query, "key1", 0) == NULL, "Stale index used");
+        ASSERT_STR_EQ(llquery_get_value(&query, "b", 1), "2", "Small lookup wrong");
+        llquery_free(&query);
+    }
+
+    TEST_PASS();
+}
+
+/* 测试小查询键表（重复查找少量键值对） */
+void test_small_key_table() {
+    TEST_START("Small key table");
+    struct llquery query;
+    const char *input = "longprefix_a=1&longprefix_b=2&ab=3&a%00=4&A=5&a=6&%61c=7&ab=8&=9";
+
+    uint16_t modes[] = {LQF_DEFAULT, LQF_DEFAULT | LQF_LOWERCASE_KEYS,
+                        LQF_DEFAULT | LQF_LAZY, LQF_DEFAULT | LQF_LAZY | LQF_LOWERCASE_KEYS};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        bool lower = (modes[m] & LQF_LOWERCASE_KEYS) != 0;
+        llquery_init(&query, 0, modes[m]);
+        ASSERT(llquery_parse(input, 0, &query) == LQE_OK, "Parse failed");
+
+        // 多轮查找：首轮线性扫描，之后使用键表
+        for (int round = 0; round < 3; round++) {
+            ASSERT_STR_EQ(llquery_get_value(&query, "longprefix_b", 0), "2", "Long key wrong");
+            ASSERT(llquery_get_value(&query, "longprefix_c", 0) == NULL, "Shared prefix matched");
+            ASSERT(llquery_get_value(&query, "longprefix_", 0) == NULL, "Prefix matched");
+            ASSERT_STR_EQ(llquery_get_value(&query, "a\0", 2), "4", "Key with NUL wrong");
+            ASSERT_STR_EQ(llquery_get_value(&query, "a", 1), lower ? "5" : "6", "Short key wrong");
+            ASSERT_STR_EQ(llquery_get_value(&query, "ac", 2), "7", "Encoded key wrong");
+            ASSERT(llquery_has_key(&query, "A", 1) == !lower, "Case handling wrong");
+            ASSERT(!llquery_has_key(&query, "b", 1), "Missing key found");
+
+            const char *values[4];
+            ASSERT_EQ(llquery_get_all_values(&query, "ab", 2, values, 4), 2, "Dup count wrong");
+            ASSERT_STR_EQ(values[0], "3", "Dup order wrong");
+            ASSERT_STR_EQ(values[1], "8", "Dup order wrong");
+        }
+        llquery_free(&query);
+    }
+
+    TEST_PASS();
+}
+
+/* 测试紧凑结果 */
+void test_compact_result() {
+    TEST_START("Compact result");
+    struct llquery query;
+    struct llquery_compact compact;
+    struct alloc_stats stats = {0, 0};
+    const char *input = "name=John+Doe&EMAIL=a%40b.c&flag=&tag=x&tag=y&%E4%B8%AD=1";
+
+    uint16_t modes[] = {LQF_DEFAULT | LQF_KEEP_EMPTY, LQF_DEFAULT | LQF_LAZY | LQF_LOWERCASE_KEYS,
+                        LQF_DEFAULT | LQF_ZERO_COPY};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        llquery_init_ex(&query, 0, modes[m], counting_alloc, counting_free, &stats);
+        ASSERT(llquery_parse(input, 0, &query) == LQE_OK, "Parse failed");
+        ASSERT(llquery_compact_build(&compact, &query) == LQE_OK, "Compact build failed");
+        ASSERT_EQ(compact.kv_count, llquery_count_ex(&query), "Compact count wrong");
+
+        // 逐项与 llquery_get_kv 一致
+        for (uint32_t i = 0; i < compact.kv_count; i++) {
+            struct llquery_kv ckv;
+            const struct llquery_kv *kv = llquery_get_kv_ex(&query, i);
+            ASSERT(llquery_compact_get_kv(&compact, i, &ckv), "Compact get_kv failed");
+            ASSERT(ckv.key_len == kv->key_len && memcmp(ckv.key, kv->key, kv->key_len) == 0,
+                   "Compact key mismatch");
+            ASSERT(ckv.value_len == kv->value_len && memcmp(ckv.value, kv->value, kv->value_len) == 0,
+                   "Compact value mismatch");
+            ASSERT(ckv.key[ckv.key_len] == '\0' && ckv.value[ckv.value_len] == '\0',
+                   "Compact strings not terminated");
+            ASSERT(ckv.is_encoded == kv->is_encoded, "Compact flag mismatch");
+        }
+        struct llquery_kv ckv;
+        ASSERT(!llquery_compact_get_kv(&compact, compact.kv_count, &ckv), "Out of range index accepted");
+
+        // 释放源解析器后仍可使用
+        llquery_free(&query);
+        ASSERT_STR_EQ(llquery_compact_get_value(&compact, "name", 0), "John Doe", "Compact value wrong");
+        ASSERT_STR_EQ(llquery_compact_get_value(&compact, "tag", 3), "x", "Compact first match wrong");
+        ASSERT(llquery_compact_get_value(&compact, "nope", 0) == NULL, "Missing key found");
+        llquery_compact_free(&compact);
+        ASSERT(compact.data == NULL, "Compact not cleared");
+    }
+    ASSERT_EQ(stats.allocs, stats.frees, "Allocations leaked");
+
+    // 空结果
+    llquery_init(&query, 0, LQF_DEFAULT);
+    llquery_parse("&&", 0, &query);
+    ASSERT(llquery_compact_build(&compact, &query) == LQE_OK, "Empty compact build failed");
+    ASSERT_EQ(compact.kv_count, 0, "Empty compact count wrong");
+    llquery_compact_free(&compact);
+    llquery_free(&query);
+
+    TEST_PASS();
+}
+
+/* 测试按键分组（LQF_MERGE_DUPLICATES） */
+struct group_ctx {
+    const struct llquery *q;
+    char out[256];
+};
+
+static int group_cb(const struct llquery_kv *kv, void *user_data) {
+    struct group_ctx *ctx = (struct group_ctx *)user_data;
+    size_t n = strlen(ctx->out);
+    n += (size_t)snprintf(ctx->out + n, sizeof(ctx->out) - n, "%s%.*s:", n ? ";" : "",
+                          (int)kv->key_len, kv->key);
+    for (const struct llquery_kv *v = kv; v; v = llquery_next_value(ctx->q, v)) {
+        n += (size_t)snprintf(ctx->out + n, sizeof(ctx->out) - n, "%s%.*s", v == kv ? "" : ",",
+                              (int)v->value_len, v->value);
+    }
+    return 0;
+}
+
+void test_merge_duplicates() {
+    TEST_START("Merge duplicates");
+    struct llquery query;
+    const char *input = "tag=a&Tag=b&x=1&tag=c&%74ag=d&y=2&TAG=e";
+
+    uint16_t modes[] = {LQF_DEFAULT | LQF_MERGE_DUPLICATES,
+                        LQF_DEFAULT | LQF_MERGE_DUPLICATES | LQF_LOWERCASE_KEYS,
+                        LQF_DEFAULT | LQF_MERGE_DUPLICATES | LQF_LAZY | LQF_LOWERCASE_KEYS,
+                        LQF_DEFAULT | LQF_MERGE_DUPLICATES | LQF_ZERO_COPY,
+                        LQF_DEFAULT};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        bool lower = (modes[m] & LQF_LOWERCASE_KEYS) != 0;
+        llquery_init(&query, 0, modes[m]);
+        ASSERT(llquery_parse(input, 0, &query) == LQE_OK, "Parse failed");
+        ASSERT_EQ(llquery_count(&query), 7, "Pairs should keep input order");
+
+        struct group_ctx ctx = { &query, "" };
+        uint32_t groups = llquery_iterate_unique(&query, group_cb, &ctx);
+        if (lower) {
+            ASSERT_EQ(groups, 3, "Unique count wrong");
+            ASSERT_STR_EQ(ctx.out, "tag:a,b,c,d,e;x:1;y:2", "Groups wrong");
+        } else {
+            ASSERT_EQ(groups, 5, "Unique count wrong");
+            ASSERT_STR_EQ(ctx.out, "tag:a,c,d;Tag:b;x:1;y:2;TAG:e", "Groups wrong");
+        }
+
+        const char *values[8];
+        ASSERT_EQ(llquery_get_all_values(&query, "tag", 3, values, 8), lower ? 5 : 3,
+                  "All values count wrong");
+        ASSERT(llquery_next_value(&query, llquery_get_kv_by_key(&query, "x", 1)) == NULL,
+               "Single value should have no next");
+
+        // 过滤后重新分组
+        llquery_filter(&query, drop_even_cb, NULL);
+        memset(ctx.out, 0, sizeof(ctx.out));
+        llquery_iterate_unique(&query, group_cb, &ctx);
+        ASSERT_STR_EQ(ctx.out, lower ? "tag:a,c,e;x:1" : "tag:a,c;x:1;TAG:e",
+                      "Groups after filter wrong");
+        llquery_free(&query);
+    }
+
+    // 流式输入完成时分组
+    struct llquery_stream stream;
+    llquery_init(&query, 0, LQF_DEFAULT | LQF_MERGE_DUPLICATES);
+    llquery_stream_init(&stream, &query, LQF_DEFAULT | LQF_MERGE_DUPLICATES, NULL, NULL);
+    llquery_stream_feed(&stream, "k=1&j=2&k", 9);
+    llquery_stream_feed(&stream, "=3", 2);
+    ASSERT(llquery_stream_finish(&stream) == LQE_OK, "Stream finish failed");
+    llquery_stream_free(&stream);
+    struct group_ctx sctx = { &query, "" };
+    ASSERT_EQ(llquery_iterate_unique(&query, group_cb, &sctx), 2, "Stream unique count wrong");
+    ASSERT_STR_EQ(sctx.out, "k:1,3;j:2", "Stream groups wrong");
+    llquery_free(&query);
+
+    TEST_PASS();
+}
+
+/* 测试 LQF_SORT_KEYS 与稳定排序 */
+static int value_desc_cb(const struct llquery_kv *a, const struct llquery_kv *b) {
+    return strcmp(b->value, a->value);
+}
+
+void test_sort_keys() {
+    TEST_START("Sort keys at parse");
+    struct llquery query;
+
+    // 解析时排序，同名键保持输入顺序
+    uint16_t modes[] = {LQF_DEFAULT | LQF_SORT_KEYS,
+                        LQF_DEFAULT | LQF_SORT_KEYS | LQF_LAZY,
+                        LQF_DEFAULT | LQF_SORT_KEYS | LQF_MERGE_DUPLICATES};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        llquery_init(&query, 0, modes[m]);
+        ASSERT(llquery_parse("b=1&a=2&b=3&ab=4&a%62=5&a=7", 0, &query) == LQE_OK,
+               "Parse failed");
+        const char *order[][2] = {{"a", "2"}, {"a", "7"}, {"ab", "4"},
+                                  {"ab", "5"}, {"b", "1"}, {"b", "3"}};
+        ASSERT_EQ(llquery_count(&query), 6, "Wrong count");
+        for (uint16_t i = 0; i < 6; i++) {
+            const struct llquery_kv *kv = llquery_get_kv(&query, i);
+            ASSERT_STR_EQ(kv->key, order[i][0], "Wrong sorted key");
+            ASSERT_STR_EQ(kv->value, order[i][1], "Sort not stable");
+        }
+
+        const char *values[4];
+        ASSERT_EQ(llquery_get_all_values(&query, "ab", 2, values, 4), 2, "Wrong value count");
+        ASSERT_STR_EQ(values[1], "5", "Wrong second value");
+        ASSERT_STR_EQ(llquery_get_value(&query, "b", 1), "1", "Lookup failed");
+        ASSERT(!llquery_has_key(&query, "c", 1), "Missing key found");
+        llquery_free(&query);
+    }
+
+    // 大量键值对走归并排序与二分查找
+    char buf[16384];
+    size_t pos = 0;
+    for (int i = 999; i >= 0; i--) {
+        pos += (size_t)snprintf(buf + pos, sizeof(buf) - pos, "%sk%03d=%d", pos ? "&" : "", i % 500, i);
+    }
+    llquery_init_growable(&query, 0, LQF_DEFAULT | LQF_SORT_KEYS);
+    ASSERT(llquery_parse(buf, pos, &query) == LQE_OK, "Large parse failed");
+    ASSERT_EQ(llquery_count_ex(&query), 1000, "Wrong large count");
+    for (uint32_t i = 1; i < 1000; i++) {
+        const struct llquery_kv *prev = llquery_get_kv_ex(&query, i - 1);
+        const struct llquery_kv *kv = llquery_get_kv_ex(&query, i);
+        int cmp = strcmp(prev->key, kv->key);
+        ASSERT(cmp < 0 || (cmp == 0 && atoi(prev->value) > atoi(kv->value)), "Large sort wrong");
+    }
+    ASSERT_STR_EQ(llquery_get_value(&query, "k123", 4), "623", "Sorted lookup failed");
+    ASSERT_STR_EQ(llquery_get_value(&query, "k499", 4), "999", "Sorted lookup failed");
+    ASSERT(llquery_get_value(&query, "k500", 4) == NULL, "Missing key found");
+
+    // 自定义比较后不再使用二分查找
+    ASSERT(llquery_sort(&query, value_desc_cb) == LQE_OK, "Custom sort failed");
+    ASSERT_STR_EQ(llquery_get_kv_ex(&query, 0)->value, "999", "Custom order wrong");
+    ASSERT_STR_EQ(llquery_get_value(&query, "k123", 4), "623", "Lookup after custom sort failed");
+    llquery_free(&query);
+
+    TEST_PASS();
+}
+
+/* 测试键模式 */
+enum { SLOT_ID, SLOT_NAME, SLOT_PAGE, SLOT_TAG, SLOT_LONG };
+
+static bool drop_name_cb(const struct llquery_kv *kv, void *user_data) {
+    (void)user_data;
+    return !(kv->key_len == 4 && memcmp(kv->key, "name", 4) == 0);
+}
+
+void test_schema() {
+    TEST_START("Schema slots");
+    const char *keys[] = {"id", "name", "page", "tag", "very_long_parameter_name"};
+    struct llquery_schema *schema = NULL;
+    ASSERT(llquery_schema_create(&schema, keys, 5, LQS_NONE) == LQE_OK, "Schema create failed");
+    ASSERT_EQ(llquery_schema_slot(schema, "tag", 0), SLOT_TAG, "Wrong slot");
+    ASSERT_EQ(llquery_schema_slot(schema, "very_long_parameter_name", 0), SLOT_LONG, "Wrong slot");
+    ASSERT_EQ(llquery_schema_slot(schema, "ta", 0), -1, "Unknown key has slot");
+
+    const char *input = "Name=bob&x=1&tag=a&id=42&t%61g=b&zz=&very_long_parameter_name=v&y";
+    uint16_t modes[] = {LQF_DEFAULT | LQF_LOWERCASE_KEYS | LQF_KEEP_EMPTY,
+                        LQF_DEFAULT | LQF_LOWERCASE_KEYS | LQF_KEEP_EMPTY | LQF_LAZY,
+                        LQF_DEFAULT | LQF_LOWERCASE_KEYS | LQF_KEEP_EMPTY | LQF_ZERO_COPY,
+                        LQF_DEFAULT | LQF_LOWERCASE_KEYS | LQF_KEEP_EMPTY | LQF_SORT_KEYS |
+                            LQF_MERGE_DUPLICATES};
+    struct llquery query;
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        llquery_init(&query, 0, modes[m]);
+        ASSERT(llquery_set_schema(&query, schema) == LQE_OK, "Set schema failed");
+        ASSERT(llquery_parse(input, 0, &query) == LQE_OK, "Parse failed");
+        ASSERT_EQ(llquery_count(&query), 8, "Unknown keys should be kept");
+        ASSERT_EQ(llquery_unknown_count(&query), 3, "Wrong unknown count");
+
+        const struct llquery_kv *tag = llquery_get_slot(&query, SLOT_TAG);
+        ASSERT(tag != NULL, "Tag slot empty");
+        ASSERT(strncmp(tag->value, "a", tag->value_len) == 0 && tag->value_len == 1, "Wrong tag");
+        const struct llquery_kv *tag2 = llquery_next_value(&query, tag);
+        ASSERT(tag2 != NULL && tag2->value_len == 1 && tag2->value[0] == 'b', "Wrong second tag");
+        ASSERT(strncmp(llquery_get_slot_value(&query, SLOT_ID), "42", 2) == 0, "Wrong id");
+        ASSERT(strncmp(llquery_get_slot_value(&query, SLOT_NAME), "bob", 3) == 0, "Wrong name");
+        ASSERT(llquery_get_slot_value(&query, SLOT_LONG)[0] == 'v', "Wrong long key");
+        ASSERT(llquery_get_slot(&query, SLOT_PAGE) == NULL, "Page should be absent");
+        ASSERT(llquery_get_slot(&query, 5) == NULL, "Out of range slot");
+
+        // 过滤改变下标后槽位重新填充
+        llquery_filter(&query, drop_name_cb, NULL);
+        ASSERT(llquery_get_slot(&query, SLOT_NAME) == NULL, "Filtered slot still set");
+        ASSERT(strncmp(llquery_get_slot_value(&query, SLOT_ID), "42", 2) == 0, "Wrong id after filter");
+
+        // 复用解析器
+        ASSERT(llquery_parse("page=3", 0, &query) == LQE_OK, "Reparse failed");
+        ASSERT(llquery_get_slot(&query, SLOT_ID) == NULL, "Stale slot after reparse");
+        ASSERT(strncmp(llquery_get_slot_value(&query, SLOT_PAGE), "3", 1) == 0, "Wrong page");
+        ASSERT_EQ(llquery_unknown_count(&query), 0, "Stale unknown count");
+        llquery_free(&query);
+    }
+
+    // 丢弃未知键
+    struct llquery_schema *strict = NULL;
+    ASSERT(llquery_schema_create(&strict, keys, 5, LQS_DROP_UNKNOWN) == LQE_OK,
+           "Schema create failed");
+    llquery_init(&query, 0, LQF_DEFAULT | LQF_LAZY);
+    llquery_set_schema(&query, strict);
+    ASSERT(llquery_parse("a=1&id=7&b=%41&page=2&c", 0, &query) == LQE_OK, "Parse failed");
+    ASSERT_EQ(llquery_count(&query), 2, "Unknown keys should be dropped");
+    ASSERT_EQ(llquery_unknown_count(&query), 2, "Wrong unknown count");
+    ASSERT_STR_EQ(llquery_get_slot_value(&query, SLOT_PAGE), "2", "Wrong page");
+
+    // 流式输入与克隆
+    struct llquery_stream stream;
+    llquery_stream_init(&stream, &query, LQF_DEFAULT, NULL, NULL);
+    llquery_stream_feed(&stream, "x=1&ta", 6);
+    llquery_stream_feed(&stream, "g=z&id=9", 8);
+    ASSERT(llquery_stream_finish(&stream) == LQE_OK, "Stream finish failed");
+    llquery_stream_free(&stream);
+    ASSERT_EQ(llquery_count(&query), 2, "Stream unknown keys should be dropped");
+    ASSERT_STR_EQ(llquery_get_slot_value(&query, SLOT_TAG), "z", "Wrong stream tag");
+    struct llquery copy;
+    ASSERT(llquery_clone(&copy, &query) == LQE_OK, "Clone failed");
+    ASSERT_STR_EQ(llquery_get_slot_value(&copy, SLOT_ID), "9", "Wrong cloned slot");
+    ASSERT_EQ(llquery_unknown_count(&copy), 1, "Wrong cloned unknown count");
+    llquery_free(&copy);
+    llquery_free(&query);
+    llquery_schema_free(strict);
+
+    // 较大的键集合
+    static char names[300][12];
+    const char *many[300];
+    for (int i = 0; i < 300; i++) {
+        snprintf(names[i], sizeof(names[i]), "p%d", i * 7);
+        many[i] = names[i];
+    }
+    struct llquery_schema *big = NULL;
+    ASSERT(llquery_schema_create(&big, many, 300, LQS_NONE) == LQE_OK, "Big schema failed");
+    for (int i = 0; i < 300; i++) {
+        ASSERT_EQ(llquery_schema_slot(big, many[i], 0), i, "Big schema slot wrong");
+    }
+    ASSERT_EQ(llquery_schema_slot(big, "p1", 0), -1, "Unknown key has slot");
+    llquery_schema_free(big);
+
+    // 数千个键也能建表，且通过自定义分配器分配
+    static char huge_names[5000][12];
+    static const char *huge[5000];
+    for (int i = 0; i < 5000; i++) {
+        snprintf(huge_names[i], sizeof(huge_names[i]), "key%d", i);
+        huge[i] = huge_names[i];
+    }
+    struct alloc_stats stats = {0, 0};
+    ASSERT(llquery_schema_create_ex(&big, huge, 5000, LQS_NONE,
+                                    counting_alloc, counting_free, &stats) == LQE_OK,
+           "Huge schema failed");
+    ASSERT(stats.allocs > 0, "Schema did not use custom allocator");
+    for (int i = 0; i < 5000; i++) {
+        ASSERT_EQ(llquery_schema_slot(big, huge[i], 0), i, "Huge schema slot wrong");
+    }
+    ASSERT_EQ(llquery_schema_slot(big, "key5000", 0), -1, "Unknown key has slot");
+    llquery_schema_free(big);
+    ASSERT_EQ(stats.allocs, stats.frees, "Schema allocations leaked");
+
+    // 无效的键集合
+    const char *dup[] = {"a", "b", "a"};
+    const char *empty[] = {"a", ""};
+    struct llquery_schema *bad = NULL;
+    ASSERT(llquery_schema_create(&bad, dup, 3, LQS_NONE) == LQE_INVALID_FORMAT, "Duplicate accepted");
+    huge[4321] = huge[17];
+    ASSERT(llquery_schema_create(&bad, huge, 5000, LQS_NONE) == LQE_INVALID_FORMAT,
+           "Duplicate in large schema accepted");
+    ASSERT(llquery_schema_create(&bad, empty, 2, LQS_NONE) == LQE_INVALID_FORMAT, "Empty key accepted");
+    ASSERT(bad == NULL, "Schema set on failure");
+
+    llquery_schema_free(schema);
+    TEST_PASS();
+}
+
+/* 测试一次查找多个键 */
+void test_get_values_multi() {
+    TEST_START("Multi-key lookup");
+    struct llquery query;
+    const char *keys[] = {"page", "missing", "Q", "tag", "page", "e"};
+    size_t lens[] = {0, 7, 1, 3, 4, 0};
+    const char *values[6];
+
+    uint16_t modes[] = {LQF_DEFAULT, LQF_DEFAULT | LQF_LAZY, LQF_DEFAULT | LQF_SORT_KEYS,
+                        LQF_DEFAULT | LQF_MERGE_DUPLICATES};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        llquery_init(&query, 0, modes[m]);
+        ASSERT(llquery_parse("tag=a&%51=hello%20world&page=2&tag=b&e", 0, &query) == LQE_OK,
+               "Parse failed");
+        ASSERT_EQ(llquery_get_values_multi(&query, keys, lens, 6, values), 4, "Wrong found count");
+        ASSERT_STR_EQ(values[0], "2", "Wrong page");
+        ASSERT(values[1] == NULL, "Missing key found");
+        ASSERT_STR_EQ(values[2], "hello world", "Wrong decoded key value");
+        ASSERT_STR_EQ(values[3], "a", "Should return first value");
+        ASSERT_STR_EQ(values[4], "2", "Repeated key wrong");
+        ASSERT(values[5] == NULL, "Dropped empty value found");
+        llquery_free(&query);
+    }
+
+    // 超过一批的键，较多键值对时使用索引
+    char buf[4096];
+    size_t pos = 0;
+    for (int i = 0; i < 100; i++) {
+        pos += (size_t)snprintf(buf + pos, sizeof(buf) - pos, "%sk%d=%d", i ? "&" : "", i, i * 2);
+    }
+    static char names[80][8];
+    const char *many[80];
+    const char *out[80];
+    for (int i = 0; i < 80; i++) {
+        snprintf(names[i], sizeof(names[i]), "k%d", i * 3);
+        many[i] = names[i];
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        llquery_init(&query, 0, pass ? LQF_DEFAULT | LQF_MERGE_DUPLICATES : LQF_DEFAULT);
+        ASSERT(llquery_parse(buf, pos, &query) == LQE_OK, "Parse failed");
+        ASSERT_EQ(llquery_get_values_multi(&query, many, NULL, 80, out), 34, "Wrong batch count");
+        for (int i = 0; i < 80; i++) {
+            if (i * 3 < 100) {
+                ASSERT(out[i] != NULL && atoi(out[i]) == i * 6, "Wrong batch value");
+            } else {
+                ASSERT(out[i] == NULL, "Out of range key found");
+            }
+        }
+        llquery_free(&query);
+    }
+
+    TEST_PASS();
+}
+
+/* 测试不解析直接提取单个键 */
+void test_find() {
+    TEST_START("Find without parse");
+    const char *q = "?a=1&session=&%73ession=abc%20def&Ver=+2+&v=x&v=y";
+    const char *value;
+    size_t len;
+    char buf[64];
+
+    ASSERT(llquery_find(q, 0, "a", 0, &value, &len, LQF_DEFAULT) == LQE_OK, "Find a failed");
+    ASSERT(len == 1 && value[0] == '1', "Wrong a");
+    ASSERT(llquery_find(q, 0, "v", 1, &value, &len, LQF_DEFAULT) == LQE_OK, "Find v failed");
+    ASSERT(len == 1 && value[0] == 'x', "Should return first value");
+    ASSERT(llquery_find(q, 0, "missing", 0, &value, &len, LQF_DEFAULT) == LQE_NOT_FOUND,
+           "Missing key found");
+    ASSERT(value == NULL && len == 0, "Output not cleared");
+
+    // 空值跳过，转义的键解码后匹配，值需要解码时没有缓冲区返回原始值
+    ASSERT(llquery_find(q, 0, "session", 0, &value, &len, LQF_DEFAULT) == LQE_BUFFER_TOO_SMALL,
+           "Encoded value without buffer");
+    ASSERT(len == 9 && strncmp(value, "abc%20def", len) == 0, "Wrong raw value");
+    ASSERT(llquery_find_ex(q, 0, "session", 0, buf, sizeof(buf), &value, &len,
+                           LQF_DEFAULT) == LQE_OK, "Find session failed");
+    ASSERT_STR_EQ(value, "abc def", "Wrong decoded value");
+    ASSERT(llquery_find_ex(q, 0, "session", 0, buf, 5, &value, &len,
+                           LQF_DEFAULT) == LQE_BUFFER_TOO_SMALL, "Small buffer accepted");
+    ASSERT(llquery_find(q, 0, "session", 0, &value, &len, LQF_DEFAULT | LQF_KEEP_EMPTY) == LQE_OK,
+           "Keep empty failed");
+    ASSERT(len == 0, "Should match empty value");
+
+    // 选项与 llquery_parse() 相同
+    ASSERT(llquery_find(q, 0, "ver", 0, &value, &len, LQF_DEFAULT) == LQE_NOT_FOUND,
+           "Case-sensitive match");
+    ASSERT(llquery_find_ex(q, 0, "ver", 0, buf, sizeof(buf), &value, &len,
+                           LQF_DEFAULT | LQF_LOWERCASE_KEYS | LQF_TRIM_VALUES) == LQE_OK,
+           "Lowercase find failed");
+    ASSERT_STR_EQ(value, "2", "Wrong trimmed value");
+    ASSERT(llquery_find(q, 0, "%73ession", 0, &value, &len, LQF_NONE) == LQE_OK,
+           "Raw key without decode");
+
+    // 较长输入跨越多个扫描块
+    char longq[2048];
+    size_t pos = 0;
+    for (int i = 0; i < 60; i++) {
+        pos += (size_t)snprintf(longq + pos, sizeof(longq) - pos, "p%d=%d&", i, i * 3);
+    }
+    ASSERT(llquery_find(longq, pos, "p59", 3, &value, &len, LQF_DEFAULT) == LQE_OK, "Long find failed");
+    ASSERT(len == 3 && strncmp(value, "177", 3) == 0, "Wrong long value");
+    ASSERT(llquery_find(NULL, 0, "a", 1, &value, &len, LQF_DEFAULT) == LQE_NULL_INPUT, "Null input");
+    ASSERT_STR_EQ(llquery_strerror(LQE_NOT_FOUND), "Key not found", "Wrong error string");
+
+    TEST_PASS();
+}
+
+/* 测试键驻留 */
+void test_intern() {
+    TEST_START("Key interning");
+    struct llquery_intern *table = NULL;
+    ASSERT(llquery_intern_create(&table, 4) == LQE_OK, "Intern create failed");
+    uint32_t id_page = llquery_intern_add(table, "page", 0);
+    uint32_t id_user = llquery_intern_add(table, "user", 4);
+    ASSERT(id_page == 1 && id_user == 2, "IDs should start at 1");
+    ASSERT_EQ(llquery_intern_add(table, "page", 0), id_page, "Re-adding changed ID");
+    ASSERT_EQ(llquery_intern_find(table, "nope", 0), 0, "Unknown key has ID");
+    size_t len = 0;
+    ASSERT_STR_EQ(llquery_intern_key(table, id_user, &len), "user", "Wrong key by ID");
+    ASSERT(len == 4 && llquery_intern_key(table, 3, NULL) == NULL, "Invalid ID has key");
+
+    // 只读共享：表中的键引用同一个字符串，其余键 ID 为 0
+    const char *input = "Page=1&%75ser=bob&x=2&page=3";
+    uint16_t modes[] = {LQF_DEFAULT | LQF_LOWERCASE_KEYS,
+                        LQF_DEFAULT | LQF_LOWERCASE_KEYS | LQF_LAZY,
+                        LQF_DEFAULT | LQF_LOWERCASE_KEYS | LQF_ZERO_COPY,
+                        LQF_DEFAULT | LQF_LOWERCASE_KEYS | LQF_ZERO_COPY | LQF_LAZY |
+                            LQF_MERGE_DUPLICATES};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        struct llquery query;
+        llquery_init(&query, 0, modes[m]);
+        ASSERT(llquery_set_intern(&query, table, false) == LQE_OK, "Set intern failed");
+        ASSERT(llquery_parse(input, 0, &query) == LQE_OK, "Parse failed");
+        const struct llquery_kv *kv0 = llquery_get_kv(&query, 0);
+        const struct llquery_kv *kv1 = llquery_get_kv(&query, 1);
+        ASSERT_EQ(kv0->key_id, id_page, "Wrong page ID");
+        ASSERT(kv0->key == llquery_intern_key(table, id_page, NULL), "Key not shared");
+        ASSERT_EQ(kv1->key_id, id_user, "Escaped key not interned");
+        ASSERT_EQ(llquery_get_kv(&query, 2)->key_id, 0, "Unknown key has ID");
+        const struct llquery_kv *user = llquery_get_kv_by_id(&query, id_user);
+        ASSERT(user && user->value_len == 3 && strncmp(user->value, "bob", 3) == 0,
+               "Wrong value by ID");
+        ASSERT(llquery_get_value(&query, "page", 4)[0] == '1', "String lookup failed");
+
+        const char *values[4];
+        ASSERT_EQ(llquery_get_all_values(&query, "page", 4, values, 4), 2, "Grouping by ID failed");
+        ASSERT(values[1][0] == '3', "Wrong second page");
+        llquery_free(&query);
+    }
+    ASSERT_EQ(llquery_intern_count(table), 2, "Read-only parse changed table");
+
+    // 学习模式：新键加入表，直到达到上限
+    struct llquery query;
+    llquery_init(&query, 0, LQF_DEFAULT);
+    llquery_set_intern(&query, table, true);
+    ASSERT(llquery_parse("a=1&b=2&c=3&a=4", 0, &query) == LQE_OK, "Learn parse failed");
+    ASSERT_EQ(llquery_intern_count(table), 4, "Table should be full");
+    ASSERT_EQ(llquery_get_kv(&query, 0)->key_id, 3, "Learned ID wrong");
+    ASSERT_EQ(llquery_get_kv(&query, 2)->key_id, 0, "Key beyond capacity has ID");
+    ASSERT_EQ(llquery_get_kv(&query, 3)->key_id, 3, "Repeated key ID wrong");
+
+    // 流式输入与克隆保留 ID
+    struct llquery_stream stream;
+    llquery_stream_init(&stream, &query, LQF_DEFAULT, NULL, NULL);
+    llquery_stream_feed(&stream, "us", 2);
+    llquery_stream_feed(&stream, "er=z&b=1", 8);
+    llquery_stream_finish(&stream);
+    llquery_stream_free(&stream);
+    ASSERT_EQ(llquery_get_kv(&query, 0)->key_id, id_user, "Stream key not interned");
+    struct llquery copy;
+    ASSERT(llquery_clone(&copy, &query) == LQE_OK, "Clone failed");
+    ASSERT_STR_EQ(llquery_get_value_by_id(&copy, 4), "1", "Cloned ID lookup failed");
+    llquery_free(&copy);
+
+    // 解绑后不再分配 ID
+    llquery_set_intern(&query, NULL, false);
+    ASSERT_EQ(llquery_get_kv(&query, 0)->key_id, 0, "IDs kept after unbind");
+    llquery_parse("page=1", 0, &query);
+    ASSERT_EQ(llquery_get_kv(&query, 0)->key_id, 0, "ID assigned without table");
+    llquery_free(&query);
+
+    llquery_intern_free(table);
+
+    // 自定义分配器：表与键字符串块都通过它分配和释放
+    struct alloc_stats stats = {0, 0};
+    ASSERT(llquery_intern_create_ex(&table, 8, counting_alloc, counting_free, &stats) == LQE_OK,
+           "Intern create with allocator failed");
+    int created = stats.allocs;
+    ASSERT(created > 0, "Intern table did not use custom allocator");
+    ASSERT(llquery_intern_add(table, "page", 0) == 1, "Wrong first ID");
+    ASSERT(stats.allocs > created, "Key chunk did not use custom allocator");
+    llquery_intern_free(table);
+    ASSERT_EQ(stats.allocs, stats.frees, "Intern allocations leaked");
+    TEST_PASS();
+}
+
+void test_case_insensitive_lookup() {
+    TEST_START("Case-insensitive lookup");
+    const char *input = "Content-Type=json&UserID=7&%41uth=t0k&userid=8";
+    uint16_t modes[] = {LQF_DEFAULT, LQF_DEFAULT | LQF_ZERO_COPY,
+                        LQF_DEFAULT | LQF_ZERO_COPY | LQF_LAZY,
+                        LQF_DEFAULT | LQF_LAZY | LQF_LOWERCASE_KEYS,
+                        LQF_DEFAULT | LQF_SORT_KEYS};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        struct llquery query;
+        llquery_init(&query, 0, modes[m]);
+        ASSERT(llquery_parse(input, 0, &query) == LQE_OK, "Parse failed");
+
+        const struct llquery_kv *kv = llquery_get_kv_by_key_ci(&query, "content-type", 0);
+        ASSERT(kv && kv->value_len == 4 && strncmp(kv->value, "json", 4) == 0,
+               "Folded lookup failed");
+        if (!(modes[m] & LQF_LOWERCASE_KEYS)) {
+            ASSERT(strncmp(kv->key, "Content-Type", 12) == 0, "Original key modified");
+        }
+        // 返回结果顺序中的第一个匹配（排序后 "UserID" 仍在 "userid" 之前）
+        kv = llquery_get_kv_by_key_ci(&query, "USERID", 6);
+        ASSERT(kv && kv->value[0] == '7', "Wrong first match");
+        ASSERT(llquery_has_key_ci(&query, "AUTH", 4), "Escaped key not folded");
+        ASSERT(!llquery_has_key_ci(&query, "user", 4), "Prefix matched");
+        ASSERT(llquery_get_value_ci(&query, "missing", 0) == NULL, "Missing key found");
+        llquery_free(&query);
+    }
+
+    // 多次查找后改用折叠键索引，重新解析后索引失效
+    char buf[512];
+    size_t pos = 0;
+    for (int i = 0; i < 40; i++) {
+        pos += (size_t)snprintf(buf + pos, sizeof(buf) - pos, "%sKey_%d=%d", i ? "&" : "", i, i);
+    }
+    struct llquery query;
+    llquery_init(&query, 0, LQF_DEFAULT | LQF_ZERO_COPY);
+    llquery_parse(buf, 0, &query);
+    for (int round = 0; round < 20; round++) {
+        for (int i = 0; i < 40; i += 7) {
+            char key[16];
+            snprintf(key, sizeof(key), "kEY_%d", i);
+            const struct llquery_kv *kv = llquery_get_kv_by_key_ci(&query, key, 0);
+            ASSERT(kv && atoi(kv->value) == i, "Indexed lookup failed");
+        }
+    }
+    ASSERT(!llquery_has_key_ci(&query, "key_40", 0), "Indexed lookup false positive");
+    llquery_parse("KEY_40=x", 0, &query);
+    ASSERT(llquery_has_key_ci(&query, "key_40", 0), "Stale index after reparse");
+    llquery_free(&query);
+    TEST_PASS();
+}
+
+/* 测试 UTF-8 校验 */
+void test_validate_utf8() {
+    TEST_START("UTF-8 validation");
+    struct llquery query;
+    const char *input = "name=%E4%B8%AD%E6%96%87&bad=%FF&ok=caf%C3%A9&ov=%C0%AF"
+                        "&sur=%ED%A0%80&max=%F4%8F%BF%BF&big=%F4%90%80%80&trunc=%E4%B8"
+                        "&k\xFF=1&emoji=%F0%9F%98%80+x";
+    const char *keys[] = {"name", "bad", "ok", "ov", "sur", "max", "big", "trunc", "k\xFF", "emoji"};
+    const bool invalid[] = {false, true, false, true, true, false, true, true, true, false};
+
+    uint16_t modes[] = {LQF_NONE, LQF_ZERO_COPY, LQF_LAZY, LQF_ZERO_COPY | LQF_LAZY};
+    for (size_t m = 0; m < sizeof(modes) / sizeof(modes[0]); m++) {
+        llquery_init(&query, 0, LQF_DEFAULT | LQF_VALIDATE_UTF8 | modes[m]);
+        ASSERT_EQ(llquery_parse(input, 0, &query), LQE_OK, "Non-strict parse should succeed");
+        ASSERT_EQ(llquery_count(&query), 10, "Wrong pair count");
+        for (int i = 0; i < 10; i++) {
+            const struct llquery_kv *kv = &query.kv_pairs[i];
+            ASSERT(kv->key_len == strlen(keys[i]) && memcmp(kv->key, keys[i], kv->key_len) == 0,
+                   "Wrong key order");
+            ASSERT_EQ(kv->invalid_utf8, invalid[i], "Wrong UTF-8 verdict");
+        }
+        llquery_free(&query);
+    }
+
+    // 严格模式在第一个无效键值对处返回
+    llquery_init(&query, 0, LQF_DEFAULT | LQF_VALIDATE_UTF8 | LQF_STRICT);
+    ASSERT_EQ(llquery_parse("a=%E4%B8%AD&b=%FF&c=1", 0, &query), LQE_INVALID_UTF8,
+              "Strict parse should fail");
+    ASSERT_STR_EQ(llquery_strerror(LQE_INVALID_UTF8), "Invalid UTF-8", "Wrong error string");
+    ASSERT_EQ(llquery_parse("a=%E4%B8%AD&c=1", 0, &query), LQE_OK, "Valid strict parse failed");
+    llquery_free(&query);
+
+    // 未启用时不校验
+    llquery_init(&query, 0, LQF_DEFAULT);
+    llquery_parse("bad=%FF", 0, &query);
+    ASSERT(!query.kv_pairs[0].invalid_utf8, "Validation should be opt-in");
+    llquery_free(&query);
+
+    // 分散输入：跨分段的序列在拼接后校验
+    llquery_init(&query, 0, LQF_DEFAULT | LQF_VALIDATE_UTF8);
+    struct iovec iov[2] = {{(void *)"a=%E4%B8", 8}, {(void *)"%AD&b=%E4%B8", 12}};
+    ASSERT_EQ(llquery_parse_iov(iov, 2, &query), LQE_OK, "Iov parse failed");
+    ASSERT(!query.kv_pairs[0].invalid_utf8 && query.kv_pairs[1].invalid_utf8,
+           "Wrong iov UTF-8 verdict");
+    llquery_free(&query);
+
+    // 流式解析
+    llquery_init(&query, 0, LQF_DEFAULT | LQF_VALIDATE_UTF8 | LQF_STRICT);
+    struct llquery_stream stream;
+    llquery_stream_init(&stream, &query, 0, NULL, NULL);
+    ASSERT_EQ(llquery_stream_feed(&stream, "a=%E4%B8%AD&b=%E", 16), LQE_OK, "Stream feed failed");
+    ASSERT_EQ(llquery_stream_feed(&stream, "D%A0%80", 7), LQE_OK, "Stream feed failed");
+    ASSERT_EQ(llquery_stream_finish(&stream), LQE_INVALID_UTF8, "Stream should reject surrogate");
+    llquery_stream_free(&stream);
+    llquery_free(&query);
+    TEST_PASS();
+}
+
+/* 测试选项组合（每种组合使用特化的解析循环） */
+void test_option_combinations() {
+    TEST_START("Option combinations");
+    const char *input = "A%42c=+%20x%20+&e=+%20&Plain=%20v&raw=+y+";
+
+    for (uint16_t n = 0; n < 16; n++) {
+        uint16_t flags = (uint16_t)(((n & 1) ? LQF_AUTO_DECODE : 0) |
+                                    ((n & 2) ? LQF_LOWERCASE_KEYS : 0) |
+                                    ((n & 4) ? LQF_TRIM_VALUES : 0) |
+                                    ((n & 8) ? LQF_KEEP_EMPTY : 0));
+        bool decode = (flags & LQF_AUTO_DECODE) != 0;
+        bool lower = (flags & LQF_LOWERCASE_KEYS) != 0;
+        bool trim = (flags & LQF_TRIM_VALUES) != 0;
+        bool keep = (flags & LQF_KEEP_EMPTY) != 0;
+
+        struct llquery query;
+        llquery_init(&query, 0, flags);
+        ASSERT(llquery_parse(input, 0, &query) == LQE_OK, "Parse failed");
+
+        // "e=+%20" 只有在解码并去空白后才为空
+        int expected = (decode && trim && !keep) ? 3 : 4;
+        ASSERT_EQ(llquery_count(&query), expected, "Wrong count for option combination");
+
+        const char *key = decode ? (lower ? "abc" : "ABc") : (lower ? "a%42c" : "A%42c");
+        const char *value = llquery_get_value(&query, key, 0);
+        ASSERT(value != NULL, "Fused key not found");
+        if (decode) {
+            ASSERT_STR_EQ(value, trim ? "x" : "  x  ", "Fused decode/trim wrong");
+        } else {
+            ASSERT_STR_EQ(value, "+%20x%20+", "Raw value wrong");
+        }
+
+        const char *raw = llquery_get_value(&query, "raw", 3);
+        ASSERT(raw != NULL, "raw not found");
+        ASSERT_STR_EQ(raw, decode ? (trim ? "y" : " y ") : "+y+", "Fused raw value wrong");
+        llquery_free(&query);
+    }
+
+    TEST_PASS();
+}
+
 /* 主函数 */
 int main() {
     printf("=== llquery Test Suite ===\n\n");
@@ -702,12 +2196,17 @@ int main() {
     test_sort();
     test_iterate();
     test_stringify();
+    test_stringify_encode();
+    test_stringify_iov();
     test_fast_parse();
     test_is_valid();
     test_count_pairs();
+    test_word_scanners();
     test_url_encode_decode();
+    test_url_encode_sets();
     test_clone();
     test_reset();
+    test_reset_retains_capacity();
     test_error_handling();
     test_lowercase_keys();
     test_has_key();
@@ -718,15 +2217,34 @@ int main() {
     test_boundary_large_params();
     test_boundary_long_values();
     test_boundary_empty_strings();
+    test_long_query_blocks();
     
     // 特殊情况测试
     test_special_characters();
+    test_per_token_decode();
+    test_zero_copy();
+    test_lazy_parse();
+    test_stream_parse();
+    test_parse_iov();
+    test_growable_pairs();
+    test_hash_index();
+    test_small_key_table();
+    test_compact_result();
+    test_merge_duplicates();
+    test_sort_keys();
+    test_schema();
+    test_get_values_multi();
+    test_find();
+    test_intern();
+    test_case_insensitive_lookup();
+    test_validate_utf8();
     test_invalid_inputs();
     test_memory_limits();
     test_url_codec_boundary();
     test_thread_safety_basic();
     test_strict_mode();
     test_combined_options();
+    test_option_combinations();
     test_fast_parse_limits();
     
     printf("\n=== Test Results ===\n");